@@ -28,62 +28,54 @@ struct registers {
 // Interrupt handlers
 typedef void (*isr_t)(struct registers*);
 
+// Legacy PIC lines are remapped to vectors 32-47
+#define IRQ_BASE  32
+#define IRQ_COUNT 16
+
+// Vectors raised by the local APIC itself (timer, error, spurious)
+#define LOCAL_IRQ_BASE 0xF0
+
+// Interrupt controller used for the legacy IRQ lines
+typedef struct {
+    const char* name;
+    void (*mask)(u8 irq);
+    void (*unmask)(u8 irq);
+    void (*eoi)(u8 irq);
+    bool (*is_spurious)(u8 irq);
+} irq_chip_t;
+
+// Handler time histogram: bucket n counts handlers of [2^(n-1), 2^n) cycles
+#define IRQSTAT_BUCKETS 24
+
+typedef struct {
+    u32 handled;
+    u32 unhandled;
+    u32 spurious;
+    u32 max_cycles;
+    u64 cycles;
+    u32 histogram[IRQSTAT_BUCKETS];
+} irq_stat_t;
+
 // Functions
 void idt_init(void);
+void idt_load(void);
 void idt_set_gate(u8 num, u32 base, u16 selector, u8 flags);
 void register_interrupt_handler(u8 n, isr_t handler);
+const char* irq_chip_name(void);
+
+// Per-vector statistics, kept per CPU; irqstat_get sums them into *sum
+void irqstat_get(u8 vector, irq_stat_t* sum);
+void irqstat_reset(void);
+void irqstat_print(void);
+void irqstat_print_histogram(u8 vector);
+
+// Called from the common stub with a pointer to the on-stack frame
+void interrupt_dispatch(struct registers* regs);
+void isr_handler(struct registers* regs);
+void irq_handler(struct registers* regs);
 
-// ISR declarations
-extern void isr0(void);
-extern void isr1(void);
-extern void isr2(void);
-extern void isr3(void);
-extern void isr4(void);
-extern void isr5(void);
-extern void isr6(void);
-extern void isr7(void);
-extern void isr8(void);
-extern void isr9(void);
-extern void isr10(void);
-extern void isr11(void);
-extern void isr12(void);
-extern void isr13(void);
-extern void isr14(void);
-extern void isr15(void);
-extern void isr16(void);
-extern void isr17(void);
-extern void isr18(void);
-extern void isr19(void);
-extern void isr20(void);
-extern void isr21(void);
-extern void isr22(void);
-extern void isr23(void);
-extern void isr24(void);
-extern void isr25(void);
-extern void isr26(void);
-extern void isr27(void);
-extern void isr28(void);
-extern void isr29(void);
-extern void isr30(void);
-extern void isr31(void);
-
-// IRQ declarations
-extern void irq0(void);
-extern void irq1(void);
-extern void irq2(void);
-extern void irq3(void);
-extern void irq4(void);
-extern void irq5(void);
-extern void irq6(void);
-extern void irq7(void);
-extern void irq8(void);
-extern void irq9(void);
-extern void irq10(void);
-extern void irq11(void);
-extern void irq12(void);
-extern void irq13(void);
-extern void irq14(void);
-extern void irq15(void);
+// Entry stubs generated in isr.asm, indexed by vector
+extern u32 isr_stub_table[256];
 
 extern void idt_flush(u32 idt_ptr);
 
@@ -0,0 +1,74 @@
+#ifndef IRQFLAGS_H
+#define IRQFLAGS_H
+
+#include <kernel/kernel.h>
+
+#define EFLAGS_IF 0x200
+
+// Raw helpers touch EFLAGS.IF only; tracers use them for their own bookkeeping
+static inline NOTRACE u32 raw_local_save_flags(void) {
+    u32 flags;
+    __asm__ volatile("pushf\n\tpop %0" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline NOTRACE void raw_local_irq_disable(void) {
+    __asm__ volatile("cli" ::: "memory");
+}
+
+static inline NOTRACE void raw_local_irq_enable(void) {
+    __asm__ volatile("sti" ::: "memory");
+}
+
+static inline NOTRACE u32 raw_local_irq_save(void) {
+    u32 flags;
+    __asm__ volatile("pushf\n\tpop %0\n\tcli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline NOTRACE void raw_local_irq_restore(u32 flags) {
+    __asm__ volatile("push %0\n\tpopf" :: "r"(flags) : "memory", "cc");
+}
+
+#ifdef CONFIG_IRQSOFF_TRACER
+void trace_hardirqs_off(u32 ip);
+void trace_hardirqs_on(u32 ip);
+#else
+static inline NOTRACE void trace_hardirqs_off(u32 ip) { (void)ip; }
+static inline NOTRACE void trace_hardirqs_on(u32 ip) { (void)ip; }
+#endif
+
+// Traced helpers: every enabled -> disabled -> enabled transition is timed
+// by the irqsoff tracer when it is built in
+#define local_irq_disable() do {                \
+    raw_local_irq_disable();                    \
+    trace_hardirqs_off(_THIS_IP_);              \
+} while (0)
+
+#define local_irq_enable() do {                 \
+    trace_hardirqs_on(_THIS_IP_);               \
+    raw_local_irq_enable();                     \
+} while (0)
+
+#define local_irq_save() ({                     \
+    u32 __flags = raw_local_irq_save();         \
+    if (__flags & EFLAGS_IF) {                  \
+        trace_hardirqs_off(_THIS_IP_);          \
+    }                                           \
+    __flags;                                    \
+})
+
+#define local_irq_restore(flags) do {           \
+    if ((flags) & EFLAGS_IF) {                  \
+        trace_hardirqs_on(_THIS_IP_);           \
+    }                                           \
+    raw_local_irq_restore(flags);               \
+} while (0)
+
+// Enable and halt in one go; sti holds interrupts off until hlt has started
+#define safe_halt() do {                        \
+    trace_hardirqs_on(_THIS_IP_);               \
+    __asm__ volatile("sti\n\thlt" ::: "memory"); \
+} while (0)
+
+#endif // IRQFLAGS_H
@@ -22,10 +22,29 @@ typedef int64_t  s64;
 #define USER_CODE_SEGMENT   0x18
 #define USER_DATA_SEGMENT   0x20
 #define TSS_SEGMENT         0x28
+#define PERCPU_SEGMENT      0x30
+#define VDSO_CPU_SEGMENT    0x38
+
+// Null, kernel code/data, user code/data, TSS, per-CPU area, vDSO CPU number
+#define GDT_ENTRIES         8
 
 #define RING_0 0
 #define RING_3 3
 
+// The bootstrap processor is CPU 0; application processors follow in MADT order
+#define NR_CPUS 8
+
+// Offsets into the per-CPU area GS points at (cpu_t in arch/x86/smp.h)
+#define PERCPU_SELF_OFFSET    0
+#define PERCPU_ID_OFFSET      4
+#define PERCPU_CURRENT_OFFSET 8
+
+// Keeps tracer plumbing out of -finstrument-functions builds
+#define NOTRACE __attribute__((no_instrument_function))
+
+// Address of the current instruction
+#define _THIS_IP_ ({ __label__ __here; __here: (u32)&&__here; })
+
 void kernel_panic(const char* message);
 
 static inline void outb(u16 port, u8 value) {
@@ -42,6 +61,35 @@ static inline void io_wait(void) {
     outb(0x80, 0);
 }
 
+// A single GS-relative load, so it cannot straddle a migration
+static inline NOTRACE u32 cpu_id(void) {
+    u32 id;
+    __asm__ volatile("movl %%gs:%c1, %0" : "=r"(id) : "i"(PERCPU_ID_OFFSET));
+    return id;
+}
+
+static inline u64 rdtsc(void) {
+    u32 low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((u64)high << 32) | low;
+}
+
+static inline u64 rdmsr(u32 msr) {
+    u32 low, high;
+    __asm__ volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((u64)high << 32) | low;
+}
+
+static inline void wrmsr(u32 msr, u64 value) {
+    __asm__ volatile("wrmsr" :: "c"(msr), "a"((u32)value), "d"((u32)(value >> 32)));
+}
+
+static inline void cpuid(u32 leaf, u32* eax, u32* ebx, u32* ecx, u32* edx) {
+    __asm__ volatile ("cpuid"
+                      : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                      : "a"(leaf), "c"(0));
+}
+
 struct gdt_entry {
     u16 limit_low;
     u16 base_low;
@@ -87,9 +135,11 @@ struct tss_entry {
 } __attribute__((packed));
 
 void gdt_init(void);
-void gdt_set_gate(int num, u32 base, u32 limit, u8 access, u8 gran);
-void tss_init(u32 idx, u32 ss0, u32 esp0);
+void gdt_init_cpu(u32 cpu);
+void gdt_set_gate(u32 cpu, int num, u32 base, u32 limit, u8 access, u8 gran);
+void tss_init(u32 cpu, u32 idx, u32 ss0, u32 esp0);
 void tss_set_kernel_stack(u32 ss, u32 esp);
+u32 tss_get_kernel_stack(void);
 
 extern void gdt_flush(u32 gdt_ptr);
 extern void tss_flush(void);
@@ -10,6 +10,8 @@
 #define PAGE_PRESENT    0x1
 #define PAGE_WRITE      0x2
 #define PAGE_USER       0x4
+#define PAGE_WRITETHROUGH 0x8
+#define PAGE_NOCACHE    0x10
 #define PAGE_ACCESSED   0x20
 #define PAGE_DIRTY      0x40
 
@@ -48,6 +50,7 @@ void memory_init(u32 mem_size);
 void paging_init(void);
 
 u32 pmm_alloc_frame(void);
+u32 pmm_try_alloc_frame(void);
 void pmm_free_frame(u32 frame_addr);
 
 page_directory_t* paging_get_kernel_directory(void);
@@ -56,6 +59,10 @@ void paging_switch_directory(page_directory_t* dir);
 page_t* paging_get_page(u32 address, bool make, page_directory_t* dir);
 void paging_map_page(page_t* page, u32 frame, bool is_kernel, bool is_writeable);
 void paging_unmap_page(page_t* page);
+void* paging_map_physical(u32 phys_addr, u32 size, bool uncached);
+void paging_map_user_frame(u32 vaddr, u32 phys, bool writeable, page_directory_t* dir);
+void* paging_map_user(u32 vaddr, u32 size, bool writeable, page_directory_t* dir);
+void paging_unmap_user(u32 vaddr, u32 size, page_directory_t* dir);
 
 void* kmalloc(u32 size);
 void* kmalloc_a(u32 size);
@@ -0,0 +1,37 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "kernel.h"
+#include "spinlock.h"
+
+// Each slab is carved out of one heap allocation of KMEM_SLAB_PAGES pages
+#define KMEM_SLAB_PAGES 4
+
+struct kmem_slab;
+
+// Fixed-size object cache. Freed objects go back on their slab's free list
+// instead of the general heap, so hot structures allocate in O(1).
+typedef struct kmem_cache {
+    spinlock_t lock;
+    const char* name;
+    u32 object_size;
+    u32 align;
+    u32 stride;             // Object plus its slab back-pointer, aligned
+    u32 objs_per_slab;
+    struct kmem_slab* partial;
+    struct kmem_slab* full;
+    struct kmem_slab* empty;
+    u32 active_objs;
+    u32 total_objs;
+    u32 slabs;
+    struct kmem_cache* next;
+} kmem_cache_t;
+
+// Slab functions
+kmem_cache_t* kmem_cache_create(const char* name, u32 size, u32 align);
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+void kmem_cache_shrink(kmem_cache_t* cache);
+void slab_print_info(void);
+
+#endif // SLAB_H
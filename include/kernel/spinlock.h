@@ -0,0 +1,47 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <kernel/kernel.h>
+#include <kernel/irqflags.h>
+
+// Test-and-test-and-set lock; waiters spin on a plain read so the cache line
+// stays shared until the holder releases it
+typedef struct {
+    volatile u32 locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline NOTRACE void spin_lock_init(spinlock_t* lock) {
+    lock->locked = 0;
+}
+
+static inline NOTRACE void spin_lock(spinlock_t* lock) {
+    while (__sync_lock_test_and_set(&lock->locked, 1)) {
+        while (lock->locked) {
+            __asm__ volatile("pause" ::: "memory");
+        }
+    }
+}
+
+static inline NOTRACE bool spin_trylock(spinlock_t* lock) {
+    return __sync_lock_test_and_set(&lock->locked, 1) == 0;
+}
+
+static inline NOTRACE void spin_unlock(spinlock_t* lock) {
+    __sync_lock_release(&lock->locked);
+}
+
+// Locks also taken from interrupt context must be held with interrupts off
+#define spin_lock_irqsave(lock) ({              \
+    u32 __flags = local_irq_save();             \
+    spin_lock(lock);                            \
+    __flags;                                    \
+})
+
+#define spin_unlock_irqrestore(lock, flags) do { \
+    spin_unlock(lock);                          \
+    local_irq_restore(flags);                   \
+} while (0)
+
+#endif // SPINLOCK_H
@@ -0,0 +1,37 @@
+# Turns `nm -n build/kernel.nosyms` output into a C symbol table
+# (ksym_count, ksym_addrs[], ksym_names[]) consumed by src/kernel/ksyms.c.
+# Only text symbols are kept; NASM local labels (foo.bar) are skipped.
+
+BEGIN {
+    n = 0
+}
+
+$2 ~ /^[Tt]$/ && $3 !~ /\./ {
+    addr = tolower($1)
+    if (addr == last) {
+        next
+    }
+    last = addr
+    addrs[n] = addr
+    names[n] = $3
+    n++
+}
+
+END {
+    print "// Generated by scripts/ksyms.awk - do not edit"
+    print ""
+    printf "const unsigned int ksym_count = %d;\n\n", n
+    print "const unsigned int ksym_addrs[] = {"
+    for (i = 0; i < n; i++) {
+        printf "    0x%s,\n", addrs[i]
+    }
+    print "    0"
+    print "};"
+    print ""
+    print "const char* const ksym_names[] = {"
+    for (i = 0; i < n; i++) {
+        printf "    \"%s\",\n", names[i]
+    }
+    print "    0"
+    print "};"
+}
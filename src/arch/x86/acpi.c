@@ -0,0 +1,147 @@
+#include "acpi.h"
+#include <kernel/kernel.h>
+#include <kernel/memory.h>
+#include "../../lib/string.h"
+
+#define MADT_LOCAL_APIC         0
+#define MADT_IO_APIC            1
+#define MADT_SOURCE_OVERRIDE    2
+#define MADT_LAPIC_ENABLED      0x1
+#define MADT_PCAT_COMPAT        0x1
+#define ACPI_BDA_EBDA           0x40E
+
+static acpi_info_t acpi_info;
+
+static bool acpi_checksum_ok(const void* table, u32 length) {
+    const u8* bytes = (const u8*)table;
+    u8 sum = 0;
+    for (u32 i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+static acpi_rsdp_t* acpi_scan_rsdp(u32 start, u32 length) {
+    // The RSDP sits on a 16-byte boundary in low memory, identity mapped already
+    for (u32 addr = start; addr < start + length; addr += 16) {
+        acpi_rsdp_t* rsdp = (acpi_rsdp_t*)addr;
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 &&
+            acpi_checksum_ok(rsdp, sizeof(acpi_rsdp_t))) {
+            return rsdp;
+        }
+    }
+    return 0;
+}
+
+static acpi_rsdp_t* acpi_find_rsdp(void) {
+    // The BDA word holds the EBDA segment. Reading it through the mapping
+    // helper keeps gcc from treating it as an offset off a null pointer.
+    const volatile u16* bda_ebda = (const volatile u16*)paging_map_physical(ACPI_BDA_EBDA, sizeof(u16), false);
+    u32 ebda = (u32)*bda_ebda << 4;
+    acpi_rsdp_t* rsdp = 0;
+    
+    if (ebda) {
+        rsdp = acpi_scan_rsdp(ebda, 1024);
+    }
+    if (!rsdp) {
+        rsdp = acpi_scan_rsdp(0xE0000, 0x20000);
+    }
+    return rsdp;
+}
+
+static acpi_sdt_header_t* acpi_map_table(u32 phys_addr) {
+    acpi_sdt_header_t* header = (acpi_sdt_header_t*)paging_map_physical(phys_addr, sizeof(acpi_sdt_header_t), false);
+    paging_map_physical(phys_addr, header->length, false);
+    
+    if (!acpi_checksum_ok(header, header->length)) {
+        return 0;
+    }
+    return header;
+}
+
+static void acpi_parse_madt(acpi_madt_t* madt) {
+    acpi_info.madt_found = true;
+    acpi_info.lapic_address = madt->lapic_address;
+    acpi_info.pcat_compat = (madt->flags & MADT_PCAT_COMPAT) != 0;
+    
+    u32 offset = sizeof(acpi_madt_t);
+    while (offset + sizeof(acpi_madt_entry_t) <= madt->header.length) {
+        acpi_madt_entry_t* entry = (acpi_madt_entry_t*)((u32)madt + offset);
+        u8* data = (u8*)entry;
+        if (entry->length < sizeof(acpi_madt_entry_t)) {
+            break;
+        }
+        
+        switch (entry->type) {
+            case MADT_LOCAL_APIC:
+                // acpi_processor_id, apic_id, flags
+                if ((*(u32*)(data + 4) & MADT_LAPIC_ENABLED) && acpi_info.cpu_count < ACPI_MAX_CPUS) {
+                    acpi_info.cpu_apic_ids[acpi_info.cpu_count++] = data[3];
+                }
+                break;
+            case MADT_IO_APIC:
+                // id, reserved, address, gsi_base
+                if (acpi_info.ioapic_count < ACPI_MAX_IOAPICS) {
+                    acpi_ioapic_t* ioapic = &acpi_info.ioapics[acpi_info.ioapic_count++];
+                    ioapic->id = data[2];
+                    ioapic->address = *(u32*)(data + 4);
+                    ioapic->gsi_base = *(u32*)(data + 8);
+                }
+                break;
+            case MADT_SOURCE_OVERRIDE: {
+                // bus, source irq, gsi, flags
+                u8 irq = data[3];
+                u16 flags = *(u16*)(data + 8);
+                if (irq < ACPI_ISA_IRQS) {
+                    acpi_info.isa_gsi[irq] = *(u32*)(data + 4);
+                    acpi_info.isa_flags[irq] = 0;
+                    if ((flags & 0x3) == 0x3) {
+                        acpi_info.isa_flags[irq] |= ACPI_IRQ_ACTIVE_LOW;
+                    }
+                    if (((flags >> 2) & 0x3) == 0x3) {
+                        acpi_info.isa_flags[irq] |= ACPI_IRQ_LEVEL;
+                    }
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        
+        offset += entry->length;
+    }
+}
+
+void acpi_init(void) {
+    memset(&acpi_info, 0, sizeof(acpi_info));
+    
+    // ISA IRQs map 1:1 onto GSIs, edge triggered, unless overridden
+    for (u32 i = 0; i < ACPI_ISA_IRQS; i++) {
+        acpi_info.isa_gsi[i] = i;
+    }
+    
+    acpi_rsdp_t* rsdp = acpi_find_rsdp();
+    if (!rsdp) {
+        return;
+    }
+    
+    acpi_sdt_header_t* rsdt = acpi_map_table(rsdp->rsdt_address);
+    if (!rsdt || memcmp(rsdt->signature, "RSDT", 4) != 0) {
+        return;
+    }
+    
+    u32 entries = (rsdt->length - sizeof(acpi_sdt_header_t)) / sizeof(u32);
+    u32* tables = (u32*)((u32)rsdt + sizeof(acpi_sdt_header_t));
+    
+    for (u32 i = 0; i < entries; i++) {
+        acpi_sdt_header_t* header = acpi_map_table(tables[i]);
+        if (header && memcmp(header->signature, "APIC", 4) == 0) {
+            acpi_parse_madt((acpi_madt_t*)header);
+            break;
+        }
+    }
+}
+
+const acpi_info_t* acpi_get_info(void) {
+    return &acpi_info;
+}
@@ -0,0 +1,68 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <kernel/kernel.h>
+
+#define ACPI_MAX_CPUS       16
+#define ACPI_MAX_IOAPICS    4
+#define ACPI_ISA_IRQS       16
+
+// MADT interrupt source override flags
+#define ACPI_IRQ_ACTIVE_LOW     0x1
+#define ACPI_IRQ_LEVEL          0x2
+
+typedef struct {
+    char signature[8];
+    u8 checksum;
+    char oem_id[6];
+    u8 revision;
+    u32 rsdt_address;
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char signature[4];
+    u32 length;
+    u8 revision;
+    u8 checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    u32 oem_revision;
+    u32 creator_id;
+    u32 creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+typedef struct {
+    acpi_sdt_header_t header;
+    u32 lapic_address;
+    u32 flags;
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct {
+    u8 type;
+    u8 length;
+} __attribute__((packed)) acpi_madt_entry_t;
+
+typedef struct {
+    u8 id;
+    u32 address;
+    u32 gsi_base;
+} acpi_ioapic_t;
+
+// What the rest of the kernel needs from the MADT
+typedef struct {
+    bool madt_found;
+    bool pcat_compat;
+    u32 lapic_address;
+    u32 cpu_count;
+    u8 cpu_apic_ids[ACPI_MAX_CPUS];
+    u32 ioapic_count;
+    acpi_ioapic_t ioapics[ACPI_MAX_IOAPICS];
+    u32 isa_gsi[ACPI_ISA_IRQS];
+    u8 isa_flags[ACPI_ISA_IRQS];
+} acpi_info_t;
+
+// ACPI functions
+void acpi_init(void);
+const acpi_info_t* acpi_get_info(void);
+
+#endif // ACPI_H
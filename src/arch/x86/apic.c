@@ -0,0 +1,240 @@
+#include "apic.h"
+#include "acpi.h"
+#include <kernel/kernel.h>
+#include <kernel/memory.h>
+#include <kernel/interrupts.h>
+#include <kernel/irqflags.h>
+
+#define IOAPIC_REGSEL       0x00
+#define IOAPIC_WINDOW       0x10
+#define IOAPIC_REG_VERSION  0x01
+#define IOAPIC_REG_REDTBL   0x10
+
+#define IOAPIC_ACTIVE_LOW   (1 << 13)
+#define IOAPIC_LEVEL        (1 << 15)
+#define IOAPIC_MASKED       (1 << 16)
+
+typedef struct {
+    volatile u32* base;
+    u32 gsi_base;
+    u32 gsi_count;
+} ioapic_t;
+
+static volatile u32* lapic_base = 0;
+static bool apic_active = false;
+
+static ioapic_t ioapics[ACPI_MAX_IOAPICS];
+static u32 ioapic_count = 0;
+
+// Redirection entry backing each ISA IRQ, so masking is a single register write
+static ioapic_t* irq_ioapic[IRQ_COUNT];
+static u32 irq_pin[IRQ_COUNT];
+static u32 irq_redirect[IRQ_COUNT];
+
+u32 lapic_read(u32 reg) {
+    return lapic_base[reg / 4];
+}
+
+void lapic_write(u32 reg, u32 value) {
+    lapic_base[reg / 4] = value;
+}
+
+u32 lapic_id(void) {
+    return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+// One-shot mode: the LVT mode bits stay 0, the count fires once and stops
+void lapic_timer_oneshot(u32 count) {
+    lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, APIC_TIMER_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_INIT, count ? count : 1);
+}
+
+void lapic_timer_stop(void) {
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0);
+}
+
+static u32 ioapic_read(ioapic_t* ioapic, u32 reg) {
+    ioapic->base[IOAPIC_REGSEL / 4] = reg;
+    return ioapic->base[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(ioapic_t* ioapic, u32 reg, u32 value) {
+    ioapic->base[IOAPIC_REGSEL / 4] = reg;
+    ioapic->base[IOAPIC_WINDOW / 4] = value;
+}
+
+static ioapic_t* ioapic_for_gsi(u32 gsi) {
+    for (u32 i = 0; i < ioapic_count; i++) {
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].gsi_count) {
+            return &ioapics[i];
+        }
+    }
+    return 0;
+}
+
+void ioapic_mask_irq(u8 irq) {
+    if (irq >= IRQ_COUNT || !irq_ioapic[irq]) {
+        return;
+    }
+    irq_redirect[irq] |= IOAPIC_MASKED;
+    ioapic_write(irq_ioapic[irq], IOAPIC_REG_REDTBL + irq_pin[irq] * 2, irq_redirect[irq]);
+}
+
+void ioapic_unmask_irq(u8 irq) {
+    if (irq >= IRQ_COUNT || !irq_ioapic[irq]) {
+        return;
+    }
+    irq_redirect[irq] &= ~IOAPIC_MASKED;
+    ioapic_write(irq_ioapic[irq], IOAPIC_REG_REDTBL + irq_pin[irq] * 2, irq_redirect[irq]);
+}
+
+void apic_eoi_irq(u8 irq) {
+    (void)irq;
+    lapic_eoi();
+}
+
+static void apic_spurious_handler(struct registers* regs) {
+    // Spurious vectors must not be acknowledged
+    (void)regs;
+}
+
+static void apic_error_handler(struct registers* regs) {
+    (void)regs;
+    lapic_write(LAPIC_REG_ESR, 0);
+    lapic_eoi();
+}
+
+// Per-CPU register setup; every LAPIC sits at the same physical address
+static void lapic_setup(void) {
+    u64 base_msr = rdmsr(IA32_APIC_BASE_MSR);
+    wrmsr(IA32_APIC_BASE_MSR, base_msr | IA32_APIC_BASE_ENABLE);
+    
+    // Legacy PIC stays masked, so LINT0 (ExtINT) is unused; LINT1 carries NMI
+    lapic_write(LAPIC_REG_LVT_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_LVT_LINT1, LAPIC_LVT_NMI);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_LVT_ERROR, APIC_ERROR_VECTOR);
+    lapic_write(LAPIC_REG_ESR, 0);
+    lapic_write(LAPIC_REG_ESR, 0);
+    
+    lapic_write(LAPIC_REG_TPR, 0);
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    lapic_eoi();
+}
+
+static void lapic_init(u32 phys_addr) {
+    lapic_base = (volatile u32*)paging_map_physical(phys_addr, PAGE_SIZE, true);
+    lapic_setup();
+}
+
+void lapic_init_ap(void) {
+    lapic_setup();
+}
+
+static void lapic_wait_icr(void) {
+    while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING) {
+        __asm__ volatile("pause");
+    }
+}
+
+// icr carries the vector and delivery mode; the destination goes in ICR high.
+// Wakeups send IPIs from interrupt context too, and one landing between the
+// two writes would retarget ours, so interrupts stay off for the sequence.
+void lapic_send_ipi(u32 apic_id, u32 icr) {
+    u32 flags = local_irq_save();
+    lapic_wait_icr();
+    lapic_write(LAPIC_REG_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, icr);
+    lapic_wait_icr();
+    local_irq_restore(flags);
+}
+
+void lapic_send_ipi_others(u32 icr) {
+    u32 flags = local_irq_save();
+    lapic_wait_icr();
+    lapic_write(LAPIC_REG_ICR_LOW, icr | LAPIC_ICR_ALL_BUT_SELF);
+    lapic_wait_icr();
+    local_irq_restore(flags);
+}
+
+static void ioapic_init(const acpi_info_t* info) {
+    for (u32 i = 0; i < info->ioapic_count; i++) {
+        ioapic_t* ioapic = &ioapics[ioapic_count++];
+        ioapic->base = (volatile u32*)paging_map_physical(info->ioapics[i].address, PAGE_SIZE, true);
+        ioapic->gsi_base = info->ioapics[i].gsi_base;
+        ioapic->gsi_count = ((ioapic_read(ioapic, IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+        
+        // Start with every pin masked
+        for (u32 pin = 0; pin < ioapic->gsi_count; pin++) {
+            ioapic_write(ioapic, IOAPIC_REG_REDTBL + pin * 2, IOAPIC_MASKED);
+            ioapic_write(ioapic, IOAPIC_REG_REDTBL + pin * 2 + 1, 0);
+        }
+    }
+    
+    // Route ISA IRQs to the same vectors the PIC used, honouring overrides
+    u32 dest = lapic_id();
+    for (u32 irq = 0; irq < IRQ_COUNT; irq++) {
+        u32 gsi = info->isa_gsi[irq];
+        ioapic_t* ioapic = ioapic_for_gsi(gsi);
+        if (!ioapic) {
+            continue;
+        }
+        
+        // A pin claimed by another IRQ's override (IRQ0 -> GSI2) is not ours
+        bool claimed = false;
+        for (u32 other = 0; other < IRQ_COUNT; other++) {
+            if (other != irq && info->isa_gsi[other] == gsi && info->isa_gsi[other] != other) {
+                claimed = true;
+            }
+        }
+        if (claimed) {
+            continue;
+        }
+        
+        u32 redirect = (IRQ_BASE + irq) | IOAPIC_MASKED;
+        if (info->isa_flags[irq] & ACPI_IRQ_ACTIVE_LOW) {
+            redirect |= IOAPIC_ACTIVE_LOW;
+        }
+        if (info->isa_flags[irq] & ACPI_IRQ_LEVEL) {
+            redirect |= IOAPIC_LEVEL;
+        }
+        
+        irq_ioapic[irq] = ioapic;
+        irq_pin[irq] = gsi - ioapic->gsi_base;
+        irq_redirect[irq] = redirect;
+        ioapic_write(ioapic, IOAPIC_REG_REDTBL + irq_pin[irq] * 2 + 1, dest << 24);
+        ioapic_write(ioapic, IOAPIC_REG_REDTBL + irq_pin[irq] * 2, redirect);
+    }
+}
+
+bool apic_init(void) {
+    const acpi_info_t* info = acpi_get_info();
+    u32 eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    
+    // Without a MADT describing an IOAPIC we stay on the 8259
+    if (!(edx & CPUID_EDX_APIC) || !info->madt_found || info->ioapic_count == 0) {
+        return false;
+    }
+    
+    idt_set_gate(APIC_SPURIOUS_VECTOR, isr_stub_table[APIC_SPURIOUS_VECTOR], KERNEL_CODE_SEGMENT, 0x8E);
+    idt_set_gate(APIC_ERROR_VECTOR, isr_stub_table[APIC_ERROR_VECTOR], KERNEL_CODE_SEGMENT, 0x8E);
+    register_interrupt_handler(APIC_SPURIOUS_VECTOR, apic_spurious_handler);
+    register_interrupt_handler(APIC_ERROR_VECTOR, apic_error_handler);
+    
+    lapic_init(info->lapic_address);
+    ioapic_init(info);
+    
+    apic_active = true;
+    return true;
+}
+
+bool apic_enabled(void) {
+    return apic_active;
+}
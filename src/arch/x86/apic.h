@@ -0,0 +1,64 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <kernel/kernel.h>
+
+// Local APIC registers (offsets from the MMIO base)
+#define LAPIC_REG_ID            0x020
+#define LAPIC_REG_VERSION       0x030
+#define LAPIC_REG_TPR           0x080
+#define LAPIC_REG_EOI           0x0B0
+#define LAPIC_REG_SVR           0x0F0
+#define LAPIC_REG_ESR           0x280
+#define LAPIC_REG_ICR_LOW       0x300
+#define LAPIC_REG_ICR_HIGH      0x310
+#define LAPIC_REG_LVT_TIMER     0x320
+#define LAPIC_REG_LVT_LINT0     0x350
+#define LAPIC_REG_LVT_LINT1     0x360
+#define LAPIC_REG_LVT_ERROR     0x370
+#define LAPIC_REG_TIMER_INIT    0x380
+#define LAPIC_REG_TIMER_CURRENT 0x390
+#define LAPIC_REG_TIMER_DIV     0x3E0
+
+#define LAPIC_SVR_ENABLE        0x100
+#define LAPIC_LVT_MASKED        0x10000
+#define LAPIC_LVT_NMI           0x400
+#define LAPIC_TIMER_DIV_16      0x3
+
+// Interrupt command register
+#define LAPIC_ICR_FIXED         0x000
+#define LAPIC_ICR_INIT          0x500
+#define LAPIC_ICR_STARTUP       0x600
+#define LAPIC_ICR_PENDING       0x1000
+#define LAPIC_ICR_ASSERT        0x4000
+#define LAPIC_ICR_LEVEL         0x8000
+#define LAPIC_ICR_ALL_BUT_SELF  0xC0000
+
+#define IA32_APIC_BASE_MSR      0x1B
+#define IA32_APIC_BASE_ENABLE   0x800
+#define CPUID_EDX_APIC          (1 << 9)
+
+// Vectors owned by the local APIC
+#define APIC_TIMER_VECTOR       0xF0
+#define APIC_ERROR_VECTOR       0xFE
+#define APIC_SPURIOUS_VECTOR    0xFF
+
+// APIC functions
+bool apic_init(void);
+bool apic_enabled(void);
+u32 lapic_read(u32 reg);
+void lapic_write(u32 reg, u32 value);
+u32 lapic_id(void);
+void lapic_eoi(void);
+void lapic_timer_oneshot(u32 count);
+void lapic_timer_stop(void);
+void lapic_init_ap(void);
+void lapic_send_ipi(u32 apic_id, u32 icr);
+void lapic_send_ipi_others(u32 icr);
+
+// IOAPIC routing of legacy ISA IRQs
+void ioapic_mask_irq(u8 irq);
+void ioapic_unmask_irq(u8 irq);
+void apic_eoi_irq(u8 irq);
+
+#endif // APIC_H
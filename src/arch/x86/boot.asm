@@ -12,6 +12,13 @@ align 4
     dd FLAGS
     dd CHECKSUM
 
+; TSC at multiboot entry, read by the boot-time profiler
+section .data
+align 8
+global boot_tsc_entry
+boot_tsc_entry:
+    dd 0, 0
+
 ; Reserve stack space
 section .bss
 align 16
@@ -25,6 +32,13 @@ global _start
 extern kernel_main
 
 _start:
+    ; Timestamp entry first; rdtsc clobbers the multiboot magic in eax
+    mov ecx, eax
+    rdtsc
+    mov [boot_tsc_entry], eax
+    mov [boot_tsc_entry + 4], edx
+    mov eax, ecx
+    
     ; Set up stack
     mov esp, stack_top
     
@@ -43,7 +57,6 @@ _start:
 
 ; GDT flush function
 global gdt_flush
-extern gdt_ptr_struct
 
 gdt_flush:
     mov eax, [esp+4]
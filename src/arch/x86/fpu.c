@@ -0,0 +1,220 @@
+#include "fpu.h"
+#include <kernel/kernel.h>
+#include "../../process/process.h"
+#include "../../lib/string.h"
+#include <kernel/interrupts.h>
+
+static bool fxsr_supported = false;
+static bool sse_supported = false;
+
+// Clean FPU image captured right after fninit; new tasks start from it
+static fpu_state_t fpu_initial_state;
+
+// Per CPU: the task whose registers are live in the FPU; everyone else runs
+// with CR0.TS set and takes #NM on first use after a switch
+static process_t* fpu_owner[NR_CPUS];
+static bool kernel_fpu_active[NR_CPUS];
+static bool fpu_lazy = false;
+static u32 fpu_lazy_restores = 0;
+
+static inline u32 read_cr0(void) {
+    u32 cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline void write_cr0(u32 cr0) {
+    __asm__ volatile("mov %0, %%cr0" :: "r"(cr0));
+}
+
+static inline u32 read_cr4(void) {
+    u32 cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+static inline void write_cr4(u32 cr4) {
+    __asm__ volatile("mov %0, %%cr4" :: "r"(cr4));
+}
+
+static void fpu_reset(void) {
+    __asm__ volatile("fninit");
+
+    if (sse_supported) {
+        u32 mxcsr = 0x1F80;  // All SIMD exceptions masked, round to nearest
+        __asm__ volatile("ldmxcsr %0" :: "m"(mxcsr));
+    }
+}
+
+// Control register setup, repeated on every CPU
+static void fpu_setup_cpu(void) {
+    // Native FPU error reporting, WAIT honours TS, no emulation
+    u32 cr0 = read_cr0();
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+
+    // Tell the CPU we save SSE state with fxsave and handle #XM
+    if (fxsr_supported) {
+        u32 cr4 = read_cr4() | CR4_OSFXSR;
+        if (sse_supported) {
+            cr4 |= CR4_OSXMMEXCPT;
+        }
+        write_cr4(cr4);
+    }
+
+    fpu_reset();
+}
+
+void fpu_init(void) {
+    u32 eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+
+    if (!(edx & CPUID_EDX_FPU)) {
+        kernel_panic("No x87 FPU present!");
+    }
+
+    fxsr_supported = (edx & CPUID_EDX_FXSR) != 0;
+    sse_supported = fxsr_supported && (edx & CPUID_EDX_SSE) != 0;
+
+    fpu_setup_cpu();
+    fpu_save(&fpu_initial_state);
+    fpu_restore(&fpu_initial_state);
+}
+
+// Application processors start with no owner and TS set
+void fpu_init_cpu(void) {
+    fpu_setup_cpu();
+    if (fpu_lazy) {
+        write_cr0(read_cr0() | CR0_TS);
+    }
+}
+
+bool fpu_has_sse(void) {
+    return sse_supported;
+}
+
+void fpu_state_init(fpu_state_t* state) {
+    memcpy(state, &fpu_initial_state, sizeof(fpu_state_t));
+}
+
+void fpu_save(fpu_state_t* state) {
+    if (fxsr_supported) {
+        __asm__ volatile("fxsave (%0)" :: "r"(state) : "memory");
+    } else {
+        // fnsave reinitializes the FPU, reload to keep the live state intact
+        __asm__ volatile("fnsave (%0)\n\tfrstor (%0)" :: "r"(state) : "memory");
+    }
+}
+
+void fpu_restore(const fpu_state_t* state) {
+    if (fxsr_supported) {
+        __asm__ volatile("fxrstor (%0)" :: "r"(state) : "memory");
+    } else {
+        __asm__ volatile("frstor (%0)" :: "r"(state) : "memory");
+    }
+}
+
+static inline void clts(void) {
+    __asm__ volatile("clts");
+}
+
+static inline void stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+// #NM: the current task touched the FPU while another task's state is loaded
+static void fpu_nm_handler(struct registers* regs) {
+    (void)regs;
+    process_t* current = process_get_current();
+    process_t** owner = &fpu_owner[cpu_id()];
+    
+    clts();
+    if (*owner == current) {
+        return;
+    }
+    
+    if (*owner) {
+        fpu_save(&(*owner)->fpu_state);
+    }
+    if (current) {
+        fpu_restore(&current->fpu_state);
+    }
+    *owner = current;
+    fpu_lazy_restores++;
+}
+
+void fpu_lazy_init(process_t* owner) {
+    fpu_owner[cpu_id()] = owner;
+    fpu_lazy = true;
+    register_interrupt_handler(7, fpu_nm_handler);
+}
+
+// Called on every switch. A task that used the FPU in this slice has its
+// registers saved now, since it may be stolen by another CPU before it runs
+// again; the load stays lazy, so tasks that never touch the FPU pay nothing.
+void fpu_switch(process_t* prev, process_t* next) {
+    process_t** owner = &fpu_owner[cpu_id()];
+    
+    if (!fpu_lazy) {
+        return;
+    }
+    
+    if (prev && *owner == prev) {
+        fpu_save(&prev->fpu_state);
+        *owner = 0;
+    }
+    (void)next;
+    stts();
+}
+
+void fpu_release(process_t* proc) {
+    process_t** owner = &fpu_owner[cpu_id()];
+    if (*owner == proc) {
+        *owner = 0;
+    }
+}
+
+u32 fpu_lazy_restore_count(void) {
+    return fpu_lazy_restores;
+}
+
+bool kernel_fpu_usable(void) {
+    return !kernel_fpu_active[cpu_id()];
+}
+
+// Preemption stays off until kernel_fpu_end(), so the section stays on one
+// CPU and no other task sees the scratch registers
+void kernel_fpu_begin(void) {
+    preempt_disable();
+    u32 cpu = cpu_id();
+    
+    if (kernel_fpu_active[cpu]) {
+        kernel_panic("kernel_fpu_begin: nested FPU section");
+    }
+    kernel_fpu_active[cpu] = true;
+    
+    // Park the owner's registers in its own fxsave area; it reloads them
+    // through #NM the next time it touches the FPU
+    clts();
+    if (fpu_owner[cpu]) {
+        fpu_save(&fpu_owner[cpu]->fpu_state);
+        fpu_owner[cpu] = 0;
+    }
+    fpu_reset();
+}
+
+void kernel_fpu_end(void) {
+    u32 cpu = cpu_id();
+    
+    if (!kernel_fpu_active[cpu]) {
+        kernel_panic("kernel_fpu_end: no active FPU section");
+    }
+    
+    // Nobody owns the scratch state, so the next user traps and reloads
+    if (fpu_lazy) {
+        stts();
+    }
+    kernel_fpu_active[cpu] = false;
+    preempt_enable();
+}
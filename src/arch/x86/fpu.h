@@ -0,0 +1,49 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <kernel/kernel.h>
+
+#define FPU_STATE_SIZE 512
+
+// CPUID leaf 1 EDX feature bits
+#define CPUID_EDX_FPU   (1 << 0)
+#define CPUID_EDX_FXSR  (1 << 24)
+#define CPUID_EDX_SSE   (1 << 25)
+#define CPUID_EDX_SSE2  (1 << 26)
+
+// Control register bits
+#define CR0_MP          (1 << 1)
+#define CR0_EM          (1 << 2)
+#define CR0_TS          (1 << 3)
+#define CR0_NE          (1 << 5)
+#define CR4_OSFXSR      (1 << 9)
+#define CR4_OSXMMEXCPT  (1 << 10)
+
+// fxsave/fxrstor image (fnsave uses the first 108 bytes on pre-FXSR CPUs)
+typedef struct fpu_state {
+    u8 data[FPU_STATE_SIZE];
+} __attribute__((aligned(16))) fpu_state_t;
+
+// FPU functions
+void fpu_init(void);
+void fpu_init_cpu(void);
+bool fpu_has_sse(void);
+void fpu_state_init(fpu_state_t* state);
+void fpu_save(fpu_state_t* state);
+void fpu_restore(const fpu_state_t* state);
+
+// Lazy switching: CR0.TS is set after every switch and #NM loads the
+// task's registers on first use
+struct process;
+void fpu_lazy_init(struct process* owner);
+void fpu_switch(struct process* prev, struct process* next);
+void fpu_release(struct process* proc);
+u32 fpu_lazy_restore_count(void);
+
+// Bracket kernel code that touches x87/SSE registers. Sections do not nest;
+// check kernel_fpu_usable() first and fall back to scalar code if it fails.
+bool kernel_fpu_usable(void);
+void kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+#endif // FPU_H
@@ -0,0 +1,340 @@
+#include "smp.h"
+#include "apic.h"
+#include "acpi.h"
+#include "fpu.h"
+#include <kernel/kernel.h>
+#include <kernel/memory.h>
+#include <kernel/interrupts.h>
+#include "../../lib/string.h"
+#include "../../drivers/vga.h"
+#include "../../kernel/time.h"
+#include "../../process/process.h"
+#include "../../process/scheduler.h"
+#include "../../process/syscall.h"
+
+// INIT-SIPI-SIPI timing from the MP specification
+#define SMP_INIT_DELAY_NS     (10 * NSEC_PER_MSEC)
+#define SMP_SIPI_DELAY_NS     (200 * NSEC_PER_USEC)
+#define SMP_BOOT_TIMEOUT_NS   (100 * NSEC_PER_MSEC)
+
+// Parameter block at the end of trampoline.asm
+typedef struct {
+    u32 cr3;
+    u32 stack;
+    u32 entry;
+    u32 cpu;
+} smp_trampoline_params_t;
+
+extern u8 trampoline_start[];
+extern u8 trampoline_end[];
+extern u8 trampoline_params[];
+
+static cpu_t cpus[NR_CPUS];
+static u32 num_cpus = 1;
+static bool smp_active = false;
+
+// Rendezvous for smp_stop_others(): the CPUs parked in the sync IPI and the
+// flag that lets them go
+static volatile u32 stop_owner = 0;
+static volatile u32 stop_parked = 0;
+static volatile bool stop_release = false;
+
+// TLB shootdown request, one at a time under tlb_owner; the targets count
+// tlb_pending down as they finish
+static volatile u32 tlb_owner = 0;
+static volatile u32 tlb_pending = 0;
+static u32 tlb_cr3, tlb_start, tlb_end;
+
+cpu_t* smp_cpu(u32 id) {
+    return &cpus[id];
+}
+
+u32 smp_num_cpus(void) {
+    return num_cpus;
+}
+
+bool smp_cpu_online(u32 id) {
+    return id < num_cpus && cpus[id].online;
+}
+
+static void ipi_reschedule_handler(struct registers* regs) {
+    (void)regs;
+    cpu_t* cpu = this_cpu();
+    cpu->need_resched = true;
+    cpu->ipis++;
+    lapic_eoi();
+}
+
+static void ipi_stop_handler(struct registers* regs) {
+    (void)regs;
+    this_cpu()->online = false;
+    while (1) {
+        __asm__ volatile("cli\n\thlt");
+    }
+}
+
+// Spin with interrupts off until the stopping CPU is done, then serialize:
+// the code we return to may have been rewritten under us
+static void ipi_sync_handler(struct registers* regs) {
+    (void)regs;
+    u32 eax, ebx, ecx, edx;
+    
+    this_cpu()->ipis++;
+    lapic_eoi();
+    
+    __sync_fetch_and_add(&stop_parked, 1);
+    while (!stop_release) {
+        __asm__ volatile("pause" ::: "memory");
+    }
+    __sync_fetch_and_sub(&stop_parked, 1);
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+}
+
+void smp_send_reschedule(u32 cpu) {
+    if (smp_active && cpu != cpu_id() && smp_cpu_online(cpu)) {
+        lapic_send_ipi(cpus[cpu].apic_id, LAPIC_ICR_FIXED | IPI_RESCHEDULE_VECTOR);
+    }
+}
+
+// The timer wheel is driven by the BSP's clock event device
+void smp_send_timer_kick(void) {
+    if (smp_active && cpu_id() != 0) {
+        lapic_send_ipi(cpus[0].apic_id, LAPIC_ICR_FIXED | IPI_TIMER_VECTOR);
+    }
+}
+
+void smp_send_stop(void) {
+    if (smp_active) {
+        lapic_send_ipi_others(LAPIC_ICR_FIXED | IPI_STOP_VECTOR);
+    }
+}
+
+// Park every other online CPU in the sync IPI, for changes no CPU may run
+// through, such as patching kernel text. Call with interrupts on, so a CPU
+// stopping us at the same time can still park us; returns with them off.
+u32 smp_stop_others(void) {
+    while (__sync_lock_test_and_set(&stop_owner, 1)) {
+        __asm__ volatile("pause" ::: "memory");
+    }
+    u32 flags = local_irq_save();
+    
+    u32 others = 0;
+    for (u32 cpu = 0; cpu < num_cpus; cpu++) {
+        if (cpu != cpu_id() && cpus[cpu].online) {
+            others++;
+        }
+    }
+    
+    if (smp_active && others) {
+        stop_release = false;
+        lapic_send_ipi_others(LAPIC_ICR_FIXED | IPI_SYNC_VECTOR);
+        while (stop_parked < others) {
+            __asm__ volatile("pause" ::: "memory");
+        }
+    }
+    return flags;
+}
+
+// Let the parked CPUs go and wait until all have left the handler, so the
+// next stop starts from an empty rendezvous
+void smp_resume_others(u32 flags) {
+    stop_release = true;
+    while (stop_parked) {
+        __asm__ volatile("pause" ::: "memory");
+    }
+    __sync_lock_release(&stop_owner);
+    local_irq_restore(flags);
+}
+
+static inline u32 read_cr3(void) {
+    u32 cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    return cr3;
+}
+
+// Every other CPU gets the request; only those with the directory loaded
+// have entries to drop
+static void ipi_tlb_handler(struct registers* regs) {
+    (void)regs;
+    this_cpu()->ipis++;
+    
+    if (read_cr3() == tlb_cr3) {
+        for (u32 addr = tlb_start; addr < tlb_end; addr += PAGE_SIZE) {
+            __asm__ volatile("invlpg (%0)" :: "r"(addr) : "memory");
+        }
+    }
+    __sync_fetch_and_sub(&tlb_pending, 1);
+    lapic_eoi();
+}
+
+// Let interrupts in for one spin of a wait, so a CPU waiting on this one
+// (another shootdown, smp_stop_others()) is not waited on in turn
+static void smp_wait_irqs_on(void) {
+    local_irq_enable();
+    __asm__ volatile("pause" ::: "memory");
+    local_irq_disable();
+}
+
+// Drop [start, end) of dir from the other CPUs' TLBs and wait until they
+// have; the caller flushes its own. The waits take interrupts whatever the
+// caller had, so it must not hold a lock that handlers take.
+void smp_flush_tlb_range(page_directory_t* dir, u32 start, u32 end) {
+    if (!smp_active || start >= end) {
+        return;
+    }
+    
+    // Stay on this CPU, so it is never one of our own targets
+    preempt_disable();
+    u32 flags = local_irq_save();
+    while (__sync_lock_test_and_set(&tlb_owner, 1)) {
+        smp_wait_irqs_on();
+    }
+    
+    u32 others = 0;
+    for (u32 cpu = 0; cpu < num_cpus; cpu++) {
+        if (cpu != cpu_id() && cpus[cpu].online) {
+            others++;
+        }
+    }
+    
+    tlb_cr3 = dir->physicalAddr;
+    tlb_start = start;
+    tlb_end = end;
+    tlb_pending = others;
+    if (others) {
+        lapic_send_ipi_others(LAPIC_ICR_FIXED | IPI_TLB_VECTOR);
+    }
+    while (tlb_pending) {
+        smp_wait_irqs_on();
+    }
+    
+    __sync_lock_release(&tlb_owner);
+    local_irq_restore(flags);
+    preempt_enable();
+}
+
+// First C code on an application processor, still on its boot stack
+static void ap_main(u32 id) {
+    cpu_t* cpu = &cpus[id];
+    
+    gdt_init_cpu(id);
+    idt_load();
+    fpu_init_cpu();
+    lapic_init_ap();
+    syscall_init_cpu();
+    process_init_cpu(cpu->boot_stack);
+    
+    cpu->online = true;
+    local_irq_enable();
+    cpu_idle();
+}
+
+static bool smp_boot_cpu(u32 id, u32 apic_id) {
+    cpu_t* cpu = &cpus[id];
+    smp_trampoline_params_t* params = (smp_trampoline_params_t*)
+        (SMP_TRAMPOLINE_BASE + (trampoline_params - trampoline_start));
+    
+    cpu->apic_id = apic_id;
+    cpu->online = false;
+    cpu->boot_stack = (u32)kmalloc(KERNEL_STACK_SIZE) + KERNEL_STACK_SIZE;
+    
+    params->cr3 = read_cr3();
+    params->stack = cpu->boot_stack;
+    params->entry = (u32)ap_main;
+    params->cpu = id;
+    
+    lapic_send_ipi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+    ndelay(SMP_INIT_DELAY_NS);
+    
+    for (u32 i = 0; i < 2 && !cpu->online; i++) {
+        lapic_send_ipi(apic_id, LAPIC_ICR_STARTUP | (SMP_TRAMPOLINE_BASE >> 12));
+        ndelay(SMP_SIPI_DELAY_NS);
+    }
+    
+    u64 deadline = time_ns() + SMP_BOOT_TIMEOUT_NS;
+    while (!cpu->online && time_ns() < deadline) {
+        __asm__ volatile("pause");
+    }
+    return cpu->online;
+}
+
+// Start every processor the MADT lists. APs come up one at a time since
+// they share the trampoline parameter block.
+void smp_init(void) {
+    const acpi_info_t* info = acpi_get_info();
+    cpu_t* bsp = &cpus[0];
+    
+    bsp->apic_id = apic_enabled() ? lapic_id() : 0;
+    bsp->online = true;
+    num_cpus = 1;
+    
+    if (!apic_enabled() || info->cpu_count < 2) {
+        return;
+    }
+    
+    idt_set_gate(IPI_RESCHEDULE_VECTOR, isr_stub_table[IPI_RESCHEDULE_VECTOR], KERNEL_CODE_SEGMENT, 0x8E);
+    idt_set_gate(IPI_TIMER_VECTOR, isr_stub_table[IPI_TIMER_VECTOR], KERNEL_CODE_SEGMENT, 0x8E);
+    idt_set_gate(IPI_STOP_VECTOR, isr_stub_table[IPI_STOP_VECTOR], KERNEL_CODE_SEGMENT, 0x8E);
+    idt_set_gate(IPI_SYNC_VECTOR, isr_stub_table[IPI_SYNC_VECTOR], KERNEL_CODE_SEGMENT, 0x8E);
+    idt_set_gate(IPI_TLB_VECTOR, isr_stub_table[IPI_TLB_VECTOR], KERNEL_CODE_SEGMENT, 0x8E);
+    register_interrupt_handler(IPI_RESCHEDULE_VECTOR, ipi_reschedule_handler);
+    register_interrupt_handler(IPI_STOP_VECTOR, ipi_stop_handler);
+    register_interrupt_handler(IPI_SYNC_VECTOR, ipi_sync_handler);
+    register_interrupt_handler(IPI_TLB_VECTOR, ipi_tlb_handler);
+    
+    memcpy((void*)SMP_TRAMPOLINE_BASE, trampoline_start, trampoline_end - trampoline_start);
+    smp_active = true;
+    
+    for (u32 i = 0; i < info->cpu_count && num_cpus < NR_CPUS; i++) {
+        u32 apic_id = info->cpu_apic_ids[i];
+        if (apic_id == bsp->apic_id) {
+            continue;
+        }
+        
+        if (smp_boot_cpu(num_cpus, apic_id)) {
+            num_cpus++;
+        } else {
+            char buf[16];
+            vga_writestring("SMP: no response from APIC ID ");
+            utoa(apic_id, buf, 10);
+            vga_writestring(buf);
+            vga_writestring("\n");
+        }
+    }
+}
+
+static void smp_print_column(u32 value, u32 width) {
+    char buf[16];
+    utoa(value, buf, 10);
+    for (u32 pad = strlen(buf); pad < width; pad++) {
+        vga_putchar(' ');
+    }
+    vga_writestring(buf);
+}
+
+void smp_print_info(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\nCPU  APIC  Current  Queued  Switches  Steals    IPIs\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    
+    for (u32 id = 0; id < num_cpus; id++) {
+        cpu_t* cpu = &cpus[id];
+        if (!cpu->online) {
+            continue;
+        }
+        
+        smp_print_column(id, 3);
+        smp_print_column(cpu->apic_id, 6);
+        if (cpu->current == cpu->idle) {
+            vga_writestring("     idle");
+        } else {
+            smp_print_column(cpu->current->pid, 9);
+        }
+        smp_print_column(sched_cpu_nr_running(id), 8);
+        smp_print_column(process_ctxsw_count(id), 10);
+        smp_print_column(sched_cpu_steals(id), 8);
+        smp_print_column(cpu->ipis, 8);
+        vga_writestring("\n");
+    }
+    vga_writestring("\n");
+}
@@ -0,0 +1,64 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <kernel/kernel.h>
+
+// Real-mode entry for the application processors; the SIPI vector is the
+// page number, so this must be page aligned and below 1 MiB
+#define SMP_TRAMPOLINE_BASE 0x8000
+
+// Inter-processor interrupt vectors, next to the LAPIC timer
+#define IPI_RESCHEDULE_VECTOR 0xF1
+#define IPI_TIMER_VECTOR      0xF2
+#define IPI_STOP_VECTOR       0xF3
+#define IPI_SYNC_VECTOR       0xF4
+#define IPI_TLB_VECTOR        0xF5
+
+// Per-CPU area, reached through GS. The first three fields sit at the
+// PERCPU_*_OFFSET offsets from kernel.h; keep them in sync.
+typedef struct cpu {
+    struct cpu* self;
+    u32 id;
+    struct process* current;
+    u32 apic_id;
+    volatile bool online;
+    struct process* idle;
+    u32 boot_stack;         // Top of the stack the AP started on
+    u32 ipis;               // IPIs received
+    
+    // Preemption state. need_resched is set by the slice tick, by a wakeup
+    // of a more urgent task and by the reschedule IPI; it is acted on when
+    // preempt_count is zero.
+    volatile bool need_resched;
+    volatile u32 preempt_count;
+    u8 curr_prio;           // Priority of the running task
+    u64 curr_deadline;      // Its absolute deadline, 0 unless a deadline task
+    u64 slice_end;          // time_ns() at which its slice or budget runs out
+} cpu_t;
+
+_Static_assert(__builtin_offsetof(cpu_t, self) == PERCPU_SELF_OFFSET, "cpu_t.self");
+_Static_assert(__builtin_offsetof(cpu_t, id) == PERCPU_ID_OFFSET, "cpu_t.id");
+_Static_assert(__builtin_offsetof(cpu_t, current) == PERCPU_CURRENT_OFFSET, "cpu_t.current");
+
+static inline NOTRACE cpu_t* this_cpu(void) {
+    cpu_t* cpu;
+    __asm__ volatile("movl %%gs:%c1, %0" : "=r"(cpu) : "i"(PERCPU_SELF_OFFSET));
+    return cpu;
+}
+
+struct page_directory;
+
+// SMP functions
+cpu_t* smp_cpu(u32 id);
+void smp_init(void);
+u32 smp_num_cpus(void);
+bool smp_cpu_online(u32 id);
+void smp_send_reschedule(u32 cpu);
+void smp_send_timer_kick(void);
+void smp_send_stop(void);
+u32 smp_stop_others(void);
+void smp_resume_others(u32 flags);
+void smp_flush_tlb_range(struct page_directory* dir, u32 start, u32 end);
+void smp_print_info(void);
+
+#endif // SMP_H
@@ -0,0 +1,40 @@
+; Kernel context switch
+;
+; switch_to(u32* prev_esp, u32 next_esp) saves the callee-saved registers on
+; the outgoing kernel stack, parks its stack pointer in *prev_esp and resumes
+; whatever frame next_esp points at. Everything else is caller-saved under
+; cdecl, so this is the whole register state of a task inside the kernel.
+;
+; A new task's stack is seeded with the same four registers (ebx holding
+; its entry point) and process_trampoline as the return address.
+
+[GLOBAL switch_to]
+[GLOBAL process_trampoline]
+[EXTERN process_start]
+[EXTERN process_exit]
+
+section .text
+
+switch_to:
+    mov eax, [esp + 4]              ; prev_esp
+    mov edx, [esp + 8]              ; next_esp
+
+    push ebp
+    push ebx
+    push esi
+    push edi
+
+    mov [eax], esp
+    mov esp, edx
+
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+
+; First return of a freshly created task
+process_trampoline:
+    call process_start              ; Finish the switch, enable interrupts
+    call ebx                        ; Entry point
+    call process_exit               ; Does not return
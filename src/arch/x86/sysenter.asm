@@ -0,0 +1,60 @@
+; SYSENTER entry
+;
+; User ABI: eax = system call number, ebx/ecx/edx = arguments, esi = return
+; EIP, ebp = user ESP. SYSEXIT takes the return EIP/ESP from edx/ecx, so
+; those two are clobbered on return.
+;
+; The stub builds the same frame as interrupt_common_stub so the C side
+; sees an ordinary struct registers with int_no 0x80.
+
+[GLOBAL sysenter_entry]
+[EXTERN sysenter_dispatch]
+
+USER_CODE_SELECTOR equ 0x1B
+USER_DATA_SELECTOR equ 0x23
+SYSCALL_VECTOR     equ 0x80
+EFLAGS_IF          equ 0x200
+PERCPU_SELECTOR    equ 0x30
+
+section .text
+
+sysenter_entry:
+    ; Interrupt frame tail: ss, useresp, eflags, cs, eip
+    push dword USER_DATA_SELECTOR
+    push ebp
+    pushfd
+    or dword [esp], EFLAGS_IF       ; SYSENTER cleared IF, user code runs with it set
+    push dword USER_CODE_SELECTOR
+    push esi
+
+    push dword 0                    ; err_code
+    push dword SYSCALL_VECTOR       ; int_no
+    pusha
+
+    ; User data segments are flat and DPL 3, which ring 0 can use as is,
+    ; so only gs is switched to this CPU's per-CPU segment
+    mov eax, ds
+    push eax
+    mov ax, PERCPU_SELECTOR
+    mov gs, ax
+
+    push esp
+    call sysenter_dispatch
+    add esp, 4
+
+    pop eax                         ; ds
+    mov gs, ax
+    popa
+    add esp, 8                      ; int_no, err_code
+
+    mov edx, [esp]                  ; Return EIP
+    mov ecx, [esp + 12]             ; User ESP
+    add esp, 8                      ; eip, cs
+
+    ; Restore the user's flags with IF still clear, sti then covers sysexit
+    and dword [esp], ~EFLAGS_IF
+    popfd
+    add esp, 8                      ; useresp, ss
+
+    sti
+    sysexit
@@ -0,0 +1,76 @@
+; Application processor trampoline
+;
+; smp_init() copies trampoline_start..trampoline_end to SMP_TRAMPOLINE_BASE
+; and points the SIPI at it. The AP arrives in real mode at that address,
+; switches to protected mode on a throwaway flat GDT, turns on paging with
+; the BSP's page directory (the low 4 MiB are identity mapped) and calls
+; the C entry with its CPU number on a stack the BSP allocated.
+
+[GLOBAL trampoline_start]
+[GLOBAL trampoline_end]
+[GLOBAL trampoline_params]
+
+TRAMPOLINE_BASE equ 0x8000
+CR0_PE          equ 0x1
+CR0_PG          equ 0x80000000
+
+; Address of a trampoline label once copied into place
+%define TRAMP(label) (TRAMPOLINE_BASE + (label) - trampoline_start)
+
+section .text
+
+[BITS 16]
+trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    lgdt [TRAMP(trampoline_gdtr)]
+    mov eax, cr0
+    or eax, CR0_PE
+    mov cr0, eax
+    jmp dword 0x08:TRAMP(trampoline_protected)
+
+[BITS 32]
+trampoline_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    mov eax, [TRAMP(tp_cr3)]
+    mov cr3, eax
+    mov eax, cr0
+    or eax, CR0_PG
+    mov cr0, eax
+
+    mov esp, [TRAMP(tp_stack)]
+    push dword [TRAMP(tp_cpu)]
+    mov eax, [TRAMP(tp_entry)]
+    call eax
+
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+align 8
+trampoline_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF           ; Flat 32-bit code
+    dq 0x00CF92000000FFFF           ; Flat 32-bit data
+trampoline_gdtr:
+    dw 3 * 8 - 1
+    dd TRAMP(trampoline_gdt)
+
+; Filled in by smp_boot_cpu(), laid out like smp_trampoline_params_t
+align 4
+trampoline_params:
+tp_cr3:   dd 0
+tp_stack: dd 0
+tp_entry: dd 0
+tp_cpu:   dd 0
+trampoline_end:
@@ -1,3 +1,31 @@
+#include <kernel/kernel.h>
+#include <kernel/interrupts.h>
+#include "keyboard.h"
+#include "../interrupts/softirq.h"
+#include "../process/wait.h"
+#include "../arch/x86/smp.h"
+
+static char keyboard_buffer[KEYBOARD_BUFFER_SIZE];
+static volatile u32 buffer_read = 0;
+static volatile u32 buffer_write = 0;
+static bool shift_pressed = false;
+static bool ctrl_pressed = false;
+
+// Raw scancodes queued by the top half for the decode tasklet
+static u8 scancode_ring[KEYBOARD_SCANCODE_RING];
+static volatile u32 scancode_read = 0;
+static volatile u32 scancode_write = 0;
+static tasklet_t keyboard_tasklet;
+
+// Readers blocked until the tasklet decodes a character
+static wait_queue_head_t keyboard_wait = WAIT_QUEUE_HEAD_INIT;
+
+static const char scancode_to_ascii[] = {
+    0, 0, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
+    '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
+    0, 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`',
+    0, '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0,
+    '*', 0, ' '
 };
 
 static const char scancode_to_ascii_shift[] = {
@@ -8,11 +36,7 @@ static const char scancode_to_ascii_shift[] = {
     '*', 0, ' '
 };
 
-void keyboard_handler(struct registers* regs) {
-    (void)regs;
-    
-    u8 scancode = inb(0x60);
-    
+static void keyboard_process_scancode(u8 scancode) {
     // Handle special keys
     if (scancode == 0x2A || scancode == 0x36) {  // Shift pressed
         shift_pressed = true;
@@ -53,7 +77,38 @@ void keyboard_handler(struct registers* regs) {
     }
 }
 
+// Bottom half: decode everything the top half queued since the last run
+static void keyboard_decode(u32 data) {
+    (void)data;
+    
+    while (scancode_read != scancode_write) {
+        u8 scancode = scancode_ring[scancode_read];
+        scancode_read = (scancode_read + 1) % KEYBOARD_SCANCODE_RING;
+        keyboard_process_scancode(scancode);
+    }
+    
+    if (keyboard_has_input()) {
+        wake_up(&keyboard_wait);
+    }
+}
+
+// Top half: drain the controller and hand the scancode to the tasklet
+void keyboard_handler(struct registers* regs) {
+    (void)regs;
+    
+    u8 scancode = inb(0x60);
+    
+    u32 next_write = (scancode_write + 1) % KEYBOARD_SCANCODE_RING;
+    if (next_write != scancode_read) {
+        scancode_ring[scancode_write] = scancode;
+        scancode_write = next_write;
+    }
+    
+    tasklet_schedule(&keyboard_tasklet);
+}
+
 void keyboard_init(void) {
+    tasklet_init(&keyboard_tasklet, keyboard_decode, 0);
     register_interrupt_handler(33, keyboard_handler);
 }
 
@@ -61,8 +116,33 @@ bool keyboard_has_input(void) {
     return buffer_read != buffer_write;
 }
 
+// Only a real task can block; anything else (idle, interrupt context)
+// falls back to halting until the next interrupt
+static bool keyboard_can_block(void) {
+    process_t* task = process_get_current();
+    return task && task != this_cpu()->idle && !in_interrupt() && !preempt_count();
+}
+
+// Returns true once input is available, false if ns passed without any
+bool keyboard_wait_timeout(u64 ns) {
+    if (keyboard_can_block()) {
+        return wait_event_timeout(keyboard_wait, keyboard_has_input(), ns);
+    }
+    
+    u64 deadline = time_ns() + ns;
+    while (!keyboard_has_input() && time_ns() < deadline) {
+        softirq_run_deferred();
+        __asm__ volatile("hlt");
+    }
+    return keyboard_has_input();
+}
+
 char keyboard_getchar(void) {
+    if (keyboard_can_block()) {
+        wait_event(keyboard_wait, keyboard_has_input());
+    }
     while (!keyboard_has_input()) {
+        softirq_run_deferred();
         __asm__ volatile("hlt");
     }
     
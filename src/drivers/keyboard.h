@@ -4,11 +4,13 @@
 #include "kernel.h"
 
 #define KEYBOARD_BUFFER_SIZE 256
+#define KEYBOARD_SCANCODE_RING 64
 
 // Keyboard functions
 void keyboard_init(void);
 char keyboard_getchar(void);
 bool keyboard_has_input(void);
+bool keyboard_wait_timeout(u64 ns);
 void keyboard_handler(struct registers* regs);
 
 #endif // KEYBOARD_H
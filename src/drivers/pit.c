@@ -0,0 +1,35 @@
+#include "pit.h"
+#include <kernel/kernel.h>
+
+// Channel 0 in mode 0 raises IRQ 0 once when the count reaches zero
+void pit_oneshot(u16 count) {
+    if (count == 0) {
+        count = 1;
+    }
+    
+    outb(PIT_COMMAND, 0x30);  // Channel 0, lobyte/hibyte, mode 0
+    outb(PIT_CHANNEL0, count & 0xFF);
+    outb(PIT_CHANNEL0, count >> 8);
+}
+
+void pit_stop(void) {
+    // Reloading the mode without a count leaves OUT low and the counter idle
+    outb(PIT_COMMAND, 0x30);
+}
+
+// Busy-wait on channel 2, which is gated by port 0x61 and never raises an IRQ
+void pit_wait(u16 count) {
+    u8 gate = inb(PIT_GATE_PORT);
+    outb(PIT_GATE_PORT, (gate & ~0x02) | 0x01);  // Gate on, speaker off
+    
+    outb(PIT_COMMAND, 0xB0);  // Channel 2, lobyte/hibyte, mode 0
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, count >> 8);
+    
+    // OUT2 goes high at terminal count
+    while (!(inb(PIT_GATE_PORT) & 0x20)) {
+        __asm__ volatile("pause");
+    }
+    
+    outb(PIT_GATE_PORT, gate);
+}
@@ -0,0 +1,22 @@
+#ifndef PIT_H
+#define PIT_H
+
+#include <kernel/kernel.h>
+
+#define PIT_FREQUENCY   1193182
+#define PIT_CHANNEL0    0x40
+#define PIT_CHANNEL2    0x42
+#define PIT_COMMAND     0x43
+#define PIT_GATE_PORT   0x61
+
+#define PIT_IRQ         0
+
+// Longest one-shot delay the 16-bit counter can express
+#define PIT_MAX_COUNT   0xFFFF
+
+// PIT functions
+void pit_oneshot(u16 count);
+void pit_stop(void);
+void pit_wait(u16 count);
+
+#endif // PIT_H
@@ -0,0 +1,49 @@
+#include "serial.h"
+#include <kernel/kernel.h>
+
+static bool serial_present = false;
+
+void serial_init(void) {
+    outb(SERIAL_COM1 + 1, 0x00);  // Disable interrupts
+    outb(SERIAL_COM1 + 3, 0x80);  // Enable DLAB to set the divisor
+    outb(SERIAL_COM1 + 0, 0x01);  // 115200 baud
+    outb(SERIAL_COM1 + 1, 0x00);
+    outb(SERIAL_COM1 + 3, 0x03);  // 8 bits, no parity, one stop bit
+    outb(SERIAL_COM1 + 2, 0xC7);  // Enable and clear FIFOs, 14-byte threshold
+    outb(SERIAL_COM1 + 4, 0x0B);  // DTR, RTS, OUT2
+    
+    // Loopback self-test tells us whether a UART is really there
+    outb(SERIAL_COM1 + 4, 0x1E);
+    outb(SERIAL_COM1 + 0, 0xAE);
+    if (inb(SERIAL_COM1 + 0) != 0xAE) {
+        serial_present = false;
+        return;
+    }
+    
+    outb(SERIAL_COM1 + 4, 0x0F);
+    serial_present = true;
+}
+
+bool serial_is_ready(void) {
+    return serial_present;
+}
+
+void serial_putchar(char c) {
+    if (!serial_present) {
+        return;
+    }
+    
+    if (c == '\n') {
+        serial_putchar('\r');
+    }
+    
+    // Wait for the transmit holding register to empty
+    while ((inb(SERIAL_COM1 + 5) & 0x20) == 0);
+    outb(SERIAL_COM1, (u8)c);
+}
+
+void serial_writestring(const char* str) {
+    while (*str) {
+        serial_putchar(*str++);
+    }
+}
@@ -0,0 +1,14 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <kernel/kernel.h>
+
+#define SERIAL_COM1 0x3F8
+
+// Serial port functions
+void serial_init(void);
+bool serial_is_ready(void);
+void serial_putchar(char c);
+void serial_writestring(const char* str);
+
+#endif // SERIAL_H
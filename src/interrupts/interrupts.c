@@ -1,13 +1,44 @@
 #include <kernel/interrupts.h>
 #include <kernel/kernel.h>
+#include <kernel/irqflags.h>
 #include "../drivers/vga.h"
 #include "../lib/string.h"
+#include "../lib/bitops.h"
+#include "../lib/div64.h"
+#include "../kernel/time.h"
+#include "../trace/tracepoint.h"
+#include "../arch/x86/apic.h"
+#include "../arch/x86/smp.h"
+#include "../process/process.h"
+#include "pic.h"
+#include "softirq.h"
+
+#define barrier() __asm__ volatile("" ::: "memory")
 
 struct idt_entry idt_entries[256];
 struct idt_ptr idt_ptr_struct;
 
 static isr_t interrupt_handlers[256];
 
+// Each CPU only ever updates its own row, so no counter needs a locked RMW
+typedef struct {
+    irq_stat_t stat;
+    u32 seq;                // Odd while the owning CPU updates stat.cycles
+} irq_stat_cpu_t;
+
+static irq_stat_cpu_t irq_stats[NR_CPUS][256];
+static u64 irqstat_since_ns = 0;
+
+static const irq_chip_t pic_chip = {
+    "8259 PIC", pic_mask, pic_unmask, pic_eoi, pic_is_spurious
+};
+
+static const irq_chip_t apic_chip = {
+    "IOAPIC/LAPIC", ioapic_mask_irq, ioapic_unmask_irq, apic_eoi_irq, 0
+};
+
+static const irq_chip_t* irq_chip = 0;
+
 static const char* exception_messages[] = {
     "Division By Zero",
     "Debug",
@@ -28,7 +59,7 @@ static const char* exception_messages[] = {
     "Coprocessor Fault",
     "Alignment Check",
     "Machine Check",
-    "Reserved",
+    "SIMD Floating-Point Exception",
     "Reserved",
     "Reserved",
     "Reserved",
@@ -57,97 +88,144 @@ void idt_init(void) {
     
     memset(&idt_entries, 0, sizeof(struct idt_entry) * 256);
     memset(&interrupt_handlers, 0, sizeof(isr_t) * 256);
+    memset(&irq_stats, 0, sizeof(irq_stats));
     
-    // Remap PIC
-    outb(0x20, 0x11);
-    outb(0xA0, 0x11);
-    outb(0x21, 0x20);
-    outb(0xA1, 0x28);
-    outb(0x21, 0x04);
-    outb(0xA1, 0x02);
-    outb(0x21, 0x01);
-    outb(0xA1, 0x01);
-    outb(0x21, 0x0);
-    outb(0xA1, 0x0);
-    
-    // Install ISRs (exceptions)
-    idt_set_gate(0, (u32)isr0, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(1, (u32)isr1, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(2, (u32)isr2, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(3, (u32)isr3, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(4, (u32)isr4, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(5, (u32)isr5, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(6, (u32)isr6, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(7, (u32)isr7, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(8, (u32)isr8, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(9, (u32)isr9, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(10, (u32)isr10, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(11, (u32)isr11, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(12, (u32)isr12, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(13, (u32)isr13, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(14, (u32)isr14, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(15, (u32)isr15, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(16, (u32)isr16, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(17, (u32)isr17, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(18, (u32)isr18, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(19, (u32)isr19, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(20, (u32)isr20, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(21, (u32)isr21, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(22, (u32)isr22, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(23, (u32)isr23, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(24, (u32)isr24, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(25, (u32)isr25, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(26, (u32)isr26, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(27, (u32)isr27, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(28, (u32)isr28, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(29, (u32)isr29, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(30, (u32)isr30, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(31, (u32)isr31, KERNEL_CODE_SEGMENT, 0x8E);
-    
-    // Install IRQs
-    idt_set_gate(32, (u32)irq0, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(33, (u32)irq1, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(34, (u32)irq2, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(35, (u32)irq3, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(36, (u32)irq4, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(37, (u32)irq5, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(38, (u32)irq6, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(39, (u32)irq7, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(40, (u32)irq8, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(41, (u32)irq9, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(42, (u32)irq10, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(43, (u32)irq11, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(44, (u32)irq12, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(45, (u32)irq13, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(46, (u32)irq14, KERNEL_CODE_SEGMENT, 0x8E);
-    idt_set_gate(47, (u32)irq15, KERNEL_CODE_SEGMENT, 0x8E);
+    // Install exception and IRQ gates from the stub table
+    for (u32 i = 0; i < IRQ_BASE + IRQ_COUNT; i++) {
+        idt_set_gate(i, isr_stub_table[i], KERNEL_CODE_SEGMENT, 0x8E);
+    }
     
     idt_flush((u32)&idt_ptr_struct);
+    
+    // Remap the PIC off the exception vectors even if the APIC takes over
+    pic_init(IRQ_BASE);
+    irq_chip = &pic_chip;
+    
+    if (apic_init()) {
+        pic_disable();
+        irq_chip = &apic_chip;
+    }
+}
+
+// Application processors share the BSP's table
+void idt_load(void) {
+    idt_flush((u32)&idt_ptr_struct);
 }
 
 void register_interrupt_handler(u8 n, isr_t handler) {
     interrupt_handlers[n] = handler;
+    
+    // Only lines with a handler are left unmasked
+    if (irq_chip && n >= IRQ_BASE && n < IRQ_BASE + IRQ_COUNT) {
+        if (handler) {
+            irq_chip->unmask(n - IRQ_BASE);
+        } else {
+            irq_chip->mask(n - IRQ_BASE);
+        }
+    }
+}
+
+const char* irq_chip_name(void) {
+    return irq_chip ? irq_chip->name : "none";
+}
+
+void interrupt_dispatch(struct registers* regs) {
+    // The gate cleared IF; the masked section starts where the CPU was interrupted
+    bool irqs_were_on = (regs->eflags & EFLAGS_IF) != 0;
+    bool from_user = (regs->cs & 0x3) != 0;
+    if (irqs_were_on) {
+        trace_hardirqs_off(regs->eip);
+    }
+    if (from_user) {
+        acct_user_exit();
+    }
+    
+    if (regs->int_no >= IRQ_BASE && regs->int_no < IRQ_BASE + IRQ_COUNT) {
+        irq_enter();
+        irq_handler(regs);
+        irq_exit();
+    } else if (regs->int_no >= LOCAL_IRQ_BASE) {
+        irq_enter();
+        isr_handler(regs);
+        irq_exit();
+    } else {
+        isr_handler(regs);
+    }
+    
+    // Preempt on the way out: always when returning to user mode, and into
+    // kernel code that ran with interrupts on outside any preempt_disable()
+    if (need_resched() && !in_interrupt() &&
+        (from_user || (irqs_were_on && preempt_count() == 0))) {
+        process_preempt();
+    }
+    
+    if (from_user) {
+        acct_user_enter();
+    }
+    
+    // iret restores IF from the saved frame
+    if (irqs_were_on) {
+        trace_hardirqs_on(_THIS_IP_);
+    }
+}
+
+// Run a handler and account its cost; kept small since it is on every interrupt
+static inline void irqstat_run(isr_t handler, struct registers* regs) {
+    irq_stat_cpu_t* pcpu = &irq_stats[cpu_id()][regs->int_no];
+    irq_stat_t* stat = &pcpu->stat;
+    u64 start = rdtsc();
+    
+    handler(regs);
+    
+    u64 delta = rdtsc() - start;
+    u32 cycles = delta > 0xFFFFFFFF ? 0xFFFFFFFF : (u32)delta;
+    u32 bucket = fls(cycles);
+    
+    stat->handled++;
+    pcpu->seq++;
+    barrier();
+    stat->cycles += cycles;
+    barrier();
+    pcpu->seq++;
+    stat->histogram[bucket < IRQSTAT_BUCKETS ? bucket : IRQSTAT_BUCKETS - 1]++;
+    if (cycles > stat->max_cycles) {
+        stat->max_cycles = cycles;
+    }
 }
 
-void isr_handler(struct registers regs) {
-    if (interrupt_handlers[regs.int_no] != 0) {
-        isr_t handler = interrupt_handlers[regs.int_no];
-        handler(&regs);
+void isr_handler(struct registers* regs) {
+    TRACE_EVENT(irq_entry, regs->int_no, regs->eip);
+    
+    if (regs->int_no == APIC_SPURIOUS_VECTOR) {
+        irq_stats[cpu_id()][regs->int_no].stat.spurious++;
+    }
+    
+    if (interrupt_handlers[regs->int_no] != 0) {
+        irqstat_run(interrupt_handlers[regs->int_no], regs);
     } else {
+        irq_stats[cpu_id()][regs->int_no].stat.unhandled++;
+        
         vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
         vga_writestring("\n!!! EXCEPTION: ");
-        vga_writestring(exception_messages[regs.int_no]);
+        if (regs->int_no < 32) {
+            vga_writestring(exception_messages[regs->int_no]);
+        } else {
+            vga_writestring("Unhandled Interrupt");
+        }
         vga_writestring(" !!!\n");
         
         char buf[32];
-        vga_writestring("Error Code: 0x");
-        utoa(regs.err_code, buf, 16);
+        vga_writestring("Vector: ");
+        utoa(regs->int_no, buf, 10);
+        vga_writestring(buf);
+        vga_writestring("\nError Code: 0x");
+        utoa(regs->err_code, buf, 16);
         vga_writestring(buf);
         vga_writestring("\nEIP: 0x");
-        utoa(regs.eip, buf, 16);
+        utoa(regs->eip, buf, 16);
         vga_writestring(buf);
         vga_writestring("\nCS: 0x");
-        utoa(regs.cs, buf, 16);
+        utoa(regs->cs, buf, 16);
         vga_writestring(buf);
         vga_writestring("\n");
         
@@ -155,15 +233,140 @@ void isr_handler(struct registers regs) {
     }
 }
 
-void irq_handler(struct registers regs) {
-    // Send EOI to PICs
-    if (regs.int_no >= 40) {
-        outb(0xA0, 0x20);  // Send EOI to slave
+void irq_handler(struct registers* regs) {
+    TRACE_EVENT(irq_entry, regs->int_no, regs->eip);
+    
+    u8 irq = regs->int_no - IRQ_BASE;
+    if (irq_chip->is_spurious && irq_chip->is_spurious(irq)) {
+        irq_stats[cpu_id()][regs->int_no].stat.spurious++;
+        return;
     }
-    outb(0x20, 0x20);  // Send EOI to master
+    irq_chip->eoi(irq);
     
-    if (interrupt_handlers[regs.int_no] != 0) {
-        isr_t handler = interrupt_handlers[regs.int_no];
-        handler(&regs);
+    if (interrupt_handlers[regs->int_no] != 0) {
+        irqstat_run(interrupt_handlers[regs->int_no], regs);
+    } else {
+        irq_stats[cpu_id()][regs->int_no].stat.unhandled++;
+    }
+}
+
+// A 64-bit load is two 32-bit ones on i386; retry if the owner was mid-update
+static u64 irqstat_read_cycles(const volatile irq_stat_cpu_t* pcpu) {
+    u32 seq;
+    u64 cycles;
+    do {
+        seq = pcpu->seq;
+        barrier();
+        cycles = pcpu->stat.cycles;
+        barrier();
+    } while ((seq & 1) || seq != pcpu->seq);
+    return cycles;
+}
+
+void irqstat_get(u8 vector, irq_stat_t* sum) {
+    memset(sum, 0, sizeof(*sum));
+    for (u32 cpu = 0; cpu < NR_CPUS; cpu++) {
+        const irq_stat_t* stat = &irq_stats[cpu][vector].stat;
+        sum->handled += stat->handled;
+        sum->unhandled += stat->unhandled;
+        sum->spurious += stat->spurious;
+        sum->cycles += irqstat_read_cycles(&irq_stats[cpu][vector]);
+        if (stat->max_cycles > sum->max_cycles) {
+            sum->max_cycles = stat->max_cycles;
+        }
+        for (u32 i = 0; i < IRQSTAT_BUCKETS; i++) {
+            sum->histogram[i] += stat->histogram[i];
+        }
+    }
+}
+
+void irqstat_reset(void) {
+    u32 flags = local_irq_save();
+    memset(&irq_stats, 0, sizeof(irq_stats));
+    irqstat_since_ns = time_ns();
+    local_irq_restore(flags);
+}
+
+static void irqstat_print_column(u32 value, u32 width) {
+    char buf[32];
+    utoa(value, buf, 10);
+    for (u32 pad = strlen(buf); pad < width; pad++) {
+        vga_putchar(' ');
+    }
+    vga_writestring(buf);
+}
+
+static const char* irqstat_vector_name(u32 vector, char* buf) {
+    if (vector < 32) {
+        return exception_messages[vector];
+    } else if (vector < IRQ_BASE + IRQ_COUNT) {
+        strcpy(buf, "IRQ");
+        utoa(vector - IRQ_BASE, buf + 3, 10);
+        return buf;
+    } else if (vector == APIC_TIMER_VECTOR) {
+        return "LAPIC timer";
+    } else if (vector == APIC_ERROR_VECTOR) {
+        return "LAPIC error";
+    } else if (vector == APIC_SPURIOUS_VECTOR) {
+        return "LAPIC spurious";
+    } else if (vector == 0x80) {
+        return "syscall";
+    }
+    return "";
+}
+
+void irqstat_print(void) {
+    char buf[32];
+    u32 elapsed_ms = (u32)div_u64(time_ns() - irqstat_since_ns, NSEC_PER_MSEC);
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\nVec     Count   Rate/s  Spur  Unhd  AvgCyc   MaxCyc  Source\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    
+    for (u32 vector = 0; vector < 256; vector++) {
+        irq_stat_t sum;
+        irq_stat_t* stat = &sum;
+        irqstat_get(vector, stat);
+        if (!stat->handled && !stat->spurious && !stat->unhandled) {
+            continue;
+        }
+        
+        u32 rate = elapsed_ms ? (u32)div_u64((u64)stat->handled * 1000, elapsed_ms) : 0;
+        u32 avg = stat->handled ? (u32)div_u64(stat->cycles, stat->handled) : 0;
+        
+        irqstat_print_column(vector, 3);
+        irqstat_print_column(stat->handled, 10);
+        irqstat_print_column(rate, 9);
+        irqstat_print_column(stat->spurious, 6);
+        irqstat_print_column(stat->unhandled, 6);
+        irqstat_print_column(avg, 8);
+        irqstat_print_column(stat->max_cycles, 9);
+        vga_writestring("  ");
+        vga_writestring(irqstat_vector_name(vector, buf));
+        vga_writestring("\n");
+    }
+    vga_writestring("\n");
+}
+
+void irqstat_print_histogram(u8 vector) {
+    irq_stat_t sum;
+    irq_stat_t* stat = &sum;
+    irqstat_get(vector, stat);
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\nHandler cycles   Count\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    
+    for (u32 i = 0; i < IRQSTAT_BUCKETS; i++) {
+        if (!stat->histogram[i]) {
+            continue;
+        }
+        
+        // Bucket i holds [2^(i-1), 2^i); the last one is open ended
+        vga_writestring(i == IRQSTAT_BUCKETS - 1 ? ">=" : "< ");
+        irqstat_print_column(i == IRQSTAT_BUCKETS - 1 ? 1U << (i - 1) : 1U << i, 12);
+        irqstat_print_column(stat->histogram[i], 8);
+        vga_writestring("\n");
     }
+    vga_writestring("\n");
 }
@@ -1,183 +1,87 @@
 ; ISR and IRQ stubs
-[GLOBAL isr0]
-[GLOBAL isr1]
-[GLOBAL isr2]
-[GLOBAL isr3]
-[GLOBAL isr4]
-[GLOBAL isr5]
-[GLOBAL isr6]
-[GLOBAL isr7]
-[GLOBAL isr8]
-[GLOBAL isr9]
-[GLOBAL isr10]
-[GLOBAL isr11]
-[GLOBAL isr12]
-[GLOBAL isr13]
-[GLOBAL isr14]
-[GLOBAL isr15]
-[GLOBAL isr16]
-[GLOBAL isr17]
-[GLOBAL isr18]
-[GLOBAL isr19]
-[GLOBAL isr20]
-[GLOBAL isr21]
-[GLOBAL isr22]
-[GLOBAL isr23]
-[GLOBAL isr24]
-[GLOBAL isr25]
-[GLOBAL isr26]
-[GLOBAL isr27]
-[GLOBAL isr28]
-[GLOBAL isr29]
-[GLOBAL isr30]
-[GLOBAL isr31]
+;
+; One stub per vector is generated below and isr_stub_table holds their
+; addresses, so idt_init() installs gates in a loop. Vectors without a CPU
+; error code push a dummy 0 so every frame matches struct registers.
 
-[GLOBAL irq0]
-[GLOBAL irq1]
-[GLOBAL irq2]
-[GLOBAL irq3]
-[GLOBAL irq4]
-[GLOBAL irq5]
-[GLOBAL irq6]
-[GLOBAL irq7]
-[GLOBAL irq8]
-[GLOBAL irq9]
-[GLOBAL irq10]
-[GLOBAL irq11]
-[GLOBAL irq12]
-[GLOBAL irq13]
-[GLOBAL irq14]
-[GLOBAL irq15]
+[GLOBAL isr_stub_table]
+[EXTERN interrupt_dispatch]
 
-[EXTERN isr_handler]
-[EXTERN irq_handler]
+KERNEL_DATA_SELECTOR equ 0x10
+PERCPU_SELECTOR      equ 0x30
 
-; ISR stub macro - no error code
-%macro ISR_NOERRCODE 1
-isr%1:
-    cli
-    push byte 0
-    push byte %1
-    jmp isr_common_stub
-%endmacro
-
-; ISR stub macro - with error code
-%macro ISR_ERRCODE 1
-isr%1:
-    cli
-    push byte %1
-    jmp isr_common_stub
-%endmacro
+section .text
 
-; IRQ stub macro
-%macro IRQ 2
-irq%1:
-    cli
+; Per-vector stubs
+%assign vec 0
+%rep 256
+isr_stub_%+vec:
+%if vec == 8 || (vec >= 10 && vec <= 14) || vec == 17
+%elif vec < 128
     push byte 0
-    push byte %2
-    jmp irq_common_stub
-%endmacro
-
-; CPU exceptions
-ISR_NOERRCODE 0
-ISR_NOERRCODE 1
-ISR_NOERRCODE 2
-ISR_NOERRCODE 3
-ISR_NOERRCODE 4
-ISR_NOERRCODE 5
-ISR_NOERRCODE 6
-ISR_NOERRCODE 7
-ISR_ERRCODE   8
-ISR_NOERRCODE 9
-ISR_ERRCODE   10
-ISR_ERRCODE   11
-ISR_ERRCODE   12
-ISR_ERRCODE   13
-ISR_ERRCODE   14
-ISR_NOERRCODE 15
-ISR_NOERRCODE 16
-ISR_ERRCODE   17
-ISR_NOERRCODE 18
-ISR_NOERRCODE 19
-ISR_NOERRCODE 20
-ISR_NOERRCODE 21
-ISR_NOERRCODE 22
-ISR_NOERRCODE 23
-ISR_NOERRCODE 24
-ISR_NOERRCODE 25
-ISR_NOERRCODE 26
-ISR_NOERRCODE 27
-ISR_NOERRCODE 28
-ISR_NOERRCODE 29
-ISR_NOERRCODE 30
-ISR_NOERRCODE 31
+%else
+    push dword 0
+%endif
+%if vec < 128
+    push byte vec
+%else
+    push dword vec
+%endif
+    jmp interrupt_common_stub
+%assign vec vec + 1
+%endrep
 
-; IRQs
-IRQ 0, 32
-IRQ 1, 33
-IRQ 2, 34
-IRQ 3, 35
-IRQ 4, 36
-IRQ 5, 37
-IRQ 6, 38
-IRQ 7, 39
-IRQ 8, 40
-IRQ 9, 41
-IRQ 10, 42
-IRQ 11, 43
-IRQ 12, 44
-IRQ 13, 45
-IRQ 14, 46
-IRQ 15, 47
-
-; Common ISR stub
-isr_common_stub:
+; Common stub
+; Interrupt gates already clear IF and iret restores it, so no cli/sti here.
+interrupt_common_stub:
     pusha
-    
-    mov ax, ds
+
+    ; ds is always saved so the frame keeps the struct registers layout
+    mov eax, ds
     push eax
-    
-    mov ax, 0x10
+
+    ; Entries from ring 0 already run on kernel segments (cs at [esp + 48])
+    test dword [esp + 48], 0x3
+    jz .kernel_entry
+
+    mov ax, KERNEL_DATA_SELECTOR
     mov ds, ax
     mov es, ax
     mov fs, ax
+    mov ax, PERCPU_SELECTOR         ; gs points at this CPU's cpu_t
     mov gs, ax
-    
-    call isr_handler
-    
+
+    push esp
+    call interrupt_dispatch
+    add esp, 4
+
     pop eax
     mov ds, ax
     mov es, ax
     mov fs, ax
     mov gs, ax
-    
+
     popa
     add esp, 8
-    sti
     iret
 
-; Common IRQ stub
-irq_common_stub:
-    pusha
-    
-    mov ax, ds
-    push eax
-    
-    mov ax, 0x10
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
-    
-    call irq_handler
-    
-    pop eax
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
-    
+.kernel_entry:
+    push esp
+    call interrupt_dispatch
+    add esp, 4
+
+    add esp, 4
     popa
     add esp, 8
-    sti
     iret
+
+section .rodata
+align 4
+
+; Stub addresses indexed by vector
+isr_stub_table:
+%assign vec 0
+%rep 256
+    dd isr_stub_%+vec
+%assign vec vec + 1
+%endrep
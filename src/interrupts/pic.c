@@ -0,0 +1,90 @@
+#include "pic.h"
+#include <kernel/kernel.h>
+
+#define PIC_READ_ISR 0x0B
+
+// Cached masks avoid a port read on every mask/unmask
+static u8 pic1_mask = 0xFF;
+static u8 pic2_mask = 0xFF;
+
+void pic_init(u8 vector_base) {
+    // Remap PIC
+    outb(PIC1_COMMAND, 0x11);
+    io_wait();
+    outb(PIC2_COMMAND, 0x11);
+    io_wait();
+    outb(PIC1_DATA, vector_base);
+    io_wait();
+    outb(PIC2_DATA, vector_base + 8);
+    io_wait();
+    outb(PIC1_DATA, 0x04);
+    io_wait();
+    outb(PIC2_DATA, 0x02);
+    io_wait();
+    outb(PIC1_DATA, 0x01);
+    io_wait();
+    outb(PIC2_DATA, 0x01);
+    io_wait();
+    
+    // Lines stay masked until a handler is registered for them
+    pic1_mask = 0xFF;
+    pic2_mask = 0xFF;
+    outb(PIC1_DATA, pic1_mask);
+    outb(PIC2_DATA, pic2_mask);
+}
+
+void pic_disable(void) {
+    pic1_mask = 0xFF;
+    pic2_mask = 0xFF;
+    outb(PIC1_DATA, pic1_mask);
+    outb(PIC2_DATA, pic2_mask);
+}
+
+void pic_mask(u8 irq) {
+    if (irq < 8) {
+        pic1_mask |= (1 << irq);
+        outb(PIC1_DATA, pic1_mask);
+    } else {
+        pic2_mask |= (1 << (irq - 8));
+        outb(PIC2_DATA, pic2_mask);
+    }
+}
+
+void pic_unmask(u8 irq) {
+    if (irq < 8) {
+        pic1_mask &= ~(1 << irq);
+        outb(PIC1_DATA, pic1_mask);
+    } else {
+        pic2_mask &= ~(1 << (irq - 8));
+        outb(PIC2_DATA, pic2_mask);
+        
+        // Slave lines only reach the CPU through the cascade
+        pic1_mask &= ~(1 << PIC_CASCADE_IRQ);
+        outb(PIC1_DATA, pic1_mask);
+    }
+}
+
+void pic_eoi(u8 irq) {
+    if (irq >= 8) {
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+bool pic_is_spurious(u8 irq) {
+    // IRQ 7/15 fire spuriously when a line drops before the CPU acks it;
+    // the in-service bit tells a real interrupt from a spurious one
+    if (irq == 7) {
+        outb(PIC1_COMMAND, PIC_READ_ISR);
+        return (inb(PIC1_COMMAND) & 0x80) == 0;
+    }
+    if (irq == 15) {
+        outb(PIC2_COMMAND, PIC_READ_ISR);
+        if ((inb(PIC2_COMMAND) & 0x80) == 0) {
+            // The master still saw the cascade line and needs its EOI
+            outb(PIC1_COMMAND, PIC_EOI);
+            return true;
+        }
+    }
+    return false;
+}
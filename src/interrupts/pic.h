@@ -0,0 +1,21 @@
+#ifndef PIC_H
+#define PIC_H
+
+#include <kernel/kernel.h>
+
+#define PIC1_COMMAND    0x20
+#define PIC1_DATA       0x21
+#define PIC2_COMMAND    0xA0
+#define PIC2_DATA       0xA1
+#define PIC_EOI         0x20
+#define PIC_CASCADE_IRQ 2
+
+// 8259 PIC functions
+void pic_init(u8 vector_base);
+void pic_disable(void);
+void pic_mask(u8 irq);
+void pic_unmask(u8 irq);
+void pic_eoi(u8 irq);
+bool pic_is_spurious(u8 irq);
+
+#endif // PIC_H
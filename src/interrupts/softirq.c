@@ -0,0 +1,250 @@
+#include "softirq.h"
+#include <kernel/kernel.h>
+#include <kernel/irqflags.h>
+#include "../process/kthread.h"
+#include "../process/wait.h"
+#include "../lib/string.h"
+
+typedef struct {
+    tasklet_t* head;
+    tasklet_t** tail;
+} tasklet_list_t;
+
+// Pending work and nesting are per CPU: a softirq runs on the CPU that
+// raised it, and tasklets stay on the list of the CPU that scheduled them
+typedef struct {
+    volatile u32 pending;
+    volatile u32 hardirq_depth;
+    volatile bool running;
+    // Set when the restart budget ran out; ksoftirqd drains it as an
+    // ordinary task, so a flood of raises competes with everything else
+    volatile bool deferred;
+    struct process* ksoftirqd;
+    tasklet_list_t tasklet_vec;
+    tasklet_list_t tasklet_hi_vec;
+} softirq_cpu_t;
+
+static softirq_handler_t softirq_handlers[NR_SOFTIRQS];
+static softirq_cpu_t softirq_cpus[NR_CPUS];
+
+static void tasklet_list_init(tasklet_list_t* list) {
+    list->head = 0;
+    list->tail = &list->head;
+}
+
+static void tasklet_action(tasklet_list_t* list) {
+    // Detach the whole list so newly scheduled tasklets wait for the next pass
+    u32 flags = local_irq_save();
+    tasklet_t* t = list->head;
+    tasklet_list_init(list);
+    local_irq_restore(flags);
+    
+    while (t) {
+        tasklet_t* next = t->next;
+        
+        // Still running on another CPU: put it back for the next pass
+        if (__sync_fetch_and_or(&t->state, TASKLET_RUNNING) & TASKLET_RUNNING) {
+            flags = local_irq_save();
+            t->next = 0;
+            *list->tail = t;
+            list->tail = &t->next;
+            local_irq_restore(flags);
+            t = next;
+            continue;
+        }
+        
+        __sync_fetch_and_and(&t->state, ~TASKLET_SCHEDULED);
+        t->func(t->data);
+        __sync_fetch_and_and(&t->state, ~TASKLET_RUNNING);
+        
+        t = next;
+    }
+}
+
+static void tasklet_softirq(void) {
+    softirq_cpu_t* sc = &softirq_cpus[cpu_id()];
+    tasklet_action(&sc->tasklet_vec);
+    if (sc->tasklet_vec.head) {
+        sc->pending |= (1 << SOFTIRQ_TASKLET);
+    }
+}
+
+static void tasklet_hi_softirq(void) {
+    softirq_cpu_t* sc = &softirq_cpus[cpu_id()];
+    tasklet_action(&sc->tasklet_hi_vec);
+    if (sc->tasklet_hi_vec.head) {
+        sc->pending |= (1 << SOFTIRQ_HI);
+    }
+}
+
+void softirq_init(void) {
+    for (u32 i = 0; i < NR_SOFTIRQS; i++) {
+        softirq_handlers[i] = 0;
+    }
+    for (u32 cpu = 0; cpu < NR_CPUS; cpu++) {
+        softirq_cpu_t* sc = &softirq_cpus[cpu];
+        sc->pending = 0;
+        sc->hardirq_depth = 0;
+        sc->running = false;
+        sc->deferred = false;
+        tasklet_list_init(&sc->tasklet_vec);
+        tasklet_list_init(&sc->tasklet_hi_vec);
+    }
+    
+    open_softirq(SOFTIRQ_HI, tasklet_hi_softirq);
+    open_softirq(SOFTIRQ_TASKLET, tasklet_softirq);
+}
+
+void open_softirq(u32 nr, softirq_handler_t handler) {
+    if (nr < NR_SOFTIRQS) {
+        softirq_handlers[nr] = handler;
+    }
+}
+
+void raise_softirq(u32 nr) {
+    u32 flags = local_irq_save();
+    softirq_cpus[cpu_id()].pending |= (1 << nr);
+    local_irq_restore(flags);
+}
+
+bool softirq_pending(void) {
+    return softirq_cpus[cpu_id()].pending != 0;
+}
+
+// Runs with interrupts disabled on entry and exit, enabled while handlers run.
+// Handlers do not migrate: only process_schedule() moves a task between CPUs.
+static void do_softirq(softirq_cpu_t* sc) {
+    u32 restart = SOFTIRQ_MAX_RESTART;
+    
+    sc->running = true;
+    
+    do {
+        u32 pending = sc->pending;
+        sc->pending = 0;
+        
+        local_irq_enable();
+        for (u32 nr = 0; pending; nr++, pending >>= 1) {
+            if ((pending & 1) && softirq_handlers[nr]) {
+                softirq_handlers[nr]();
+            }
+        }
+        local_irq_disable();
+    } while (sc->pending && --restart);
+    
+    sc->running = false;
+    
+    // A steady stream of raises must not starve the interrupted context
+    if (sc->pending) {
+        sc->deferred = true;
+        if (sc->ksoftirqd) {
+            wake_up_process(sc->ksoftirqd);
+        }
+    }
+}
+
+void softirq_run_deferred(void) {
+    u32 flags = local_irq_save();
+    softirq_cpu_t* sc = &softirq_cpus[cpu_id()];
+    
+    if (sc->deferred) {
+        sc->deferred = false;
+        if (!sc->running && sc->hardirq_depth == 0 && sc->pending) {
+            do_softirq(sc);
+        }
+    }
+    local_irq_restore(flags);
+}
+
+void irq_enter(void) {
+    softirq_cpus[cpu_id()].hardirq_depth++;
+}
+
+void irq_exit(void) {
+    softirq_cpu_t* sc = &softirq_cpus[cpu_id()];
+    
+    sc->hardirq_depth--;
+    
+    // Only the outermost interrupt drains, and never from inside a drain
+    if (sc->hardirq_depth == 0 && !sc->running && !sc->deferred && sc->pending) {
+        do_softirq(sc);
+    }
+}
+
+// One per CPU, bound to it, since pending state is per CPU
+static void ksoftirqd(void* data) {
+    softirq_cpu_t* sc = &softirq_cpus[(u32)data];
+    process_t* self = process_get_current();
+    
+    while (1) {
+        set_current_state(self, PROCESS_STATE_BLOCKED);
+        if (!sc->deferred) {
+            process_schedule();
+        }
+        set_current_state(self, PROCESS_STATE_RUNNING);
+        
+        softirq_run_deferred();
+        cond_resched();
+    }
+}
+
+// Needs the scheduler; until then softirq_run_deferred() callers drain
+void softirq_init_threads(void) {
+    char name[PROCESS_NAME_LEN];
+    char id[8];
+    
+    for (u32 cpu = 0; cpu < smp_num_cpus(); cpu++) {
+        if (!smp_cpu_online(cpu)) {
+            continue;
+        }
+        
+        strcpy(name, "ksoftirqd/");
+        utoa(cpu, id, 10);
+        strcat(name, id);
+        
+        process_t* task = kthread_create(ksoftirqd, (void*)cpu, name);
+        if (task) {
+            kthread_bind(task, cpu);
+            softirq_cpus[cpu].ksoftirqd = task;
+            kthread_start(task);
+        }
+    }
+}
+
+bool in_interrupt(void) {
+    u32 flags = local_irq_save();
+    softirq_cpu_t* sc = &softirq_cpus[cpu_id()];
+    bool ret = sc->hardirq_depth > 0 || sc->running;
+    local_irq_restore(flags);
+    return ret;
+}
+
+void tasklet_init(tasklet_t* t, void (*func)(u32 data), u32 data) {
+    t->next = 0;
+    t->func = func;
+    t->data = data;
+    t->state = 0;
+}
+
+static void tasklet_enqueue(bool hi, tasklet_t* t, u32 nr) {
+    u32 flags = local_irq_save();
+    softirq_cpu_t* sc = &softirq_cpus[cpu_id()];
+    tasklet_list_t* list = hi ? &sc->tasklet_hi_vec : &sc->tasklet_vec;
+    
+    // A tasklet is queued at most once, on one CPU, until it starts running
+    if (!(__sync_fetch_and_or(&t->state, TASKLET_SCHEDULED) & TASKLET_SCHEDULED)) {
+        t->next = 0;
+        *list->tail = t;
+        list->tail = &t->next;
+        sc->pending |= (1 << nr);
+    }
+    
+    local_irq_restore(flags);
+}
+
+void tasklet_schedule(tasklet_t* t) {
+    tasklet_enqueue(false, t, SOFTIRQ_TASKLET);
+}
+
+void tasklet_hi_schedule(tasklet_t* t) {
+    tasklet_enqueue(true, t, SOFTIRQ_HI);
+}
@@ -0,0 +1,45 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <kernel/kernel.h>
+
+// Softirq vectors, lower numbers run first
+#define SOFTIRQ_HI          0
+#define SOFTIRQ_TIMER       1
+#define SOFTIRQ_TASKLET     2
+#define NR_SOFTIRQS         3
+
+// Passes over the pending mask before leftover work is deferred
+#define SOFTIRQ_MAX_RESTART 10
+
+#define TASKLET_SCHEDULED   0x1
+#define TASKLET_RUNNING     0x2
+
+typedef void (*softirq_handler_t)(void);
+
+typedef struct tasklet {
+    struct tasklet* next;
+    void (*func)(u32 data);
+    u32 data;
+    volatile u32 state;
+} tasklet_t;
+
+// Softirq functions
+void softirq_init(void);
+void softirq_init_threads(void);
+void open_softirq(u32 nr, softirq_handler_t handler);
+void raise_softirq(u32 nr);
+bool softirq_pending(void);
+void softirq_run_deferred(void);
+
+// Hard interrupt bracketing, called around IRQ handlers
+void irq_enter(void);
+void irq_exit(void);
+bool in_interrupt(void);
+
+// Tasklet functions
+void tasklet_init(tasklet_t* t, void (*func)(u32 data), u32 data);
+void tasklet_schedule(tasklet_t* t);
+void tasklet_hi_schedule(tasklet_t* t);
+
+#endif // SOFTIRQ_H
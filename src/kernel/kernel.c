@@ -2,16 +2,36 @@
 #include "../drivers/vga.h"
 #include "../mm/memory.h"
 #include "../interrupts/interrupts.h"
+#include "../interrupts/softirq.h"
 #include "../drivers/keyboard.h"
 #include "../security/security.h"
 #include "../process/process.h"
 #include "../process/syscall.h"
+#include "../process/pid.h"
+#include "../process/scheduler.h"
+#include "../process/acct.h"
+#include <kernel/slab.h>
 #include "../lib/string.h"
+#include "../lib/div64.h"
 #include "../security/audit.h"
+#include "../arch/x86/fpu.h"
+#include "../arch/x86/acpi.h"
+#include "../arch/x86/smp.h"
+#include "../trace/profile.h"
+#include "../trace/ftrace.h"
+#include "../trace/tracepoint.h"
+#include "../trace/boottime.h"
+#include "../trace/irqsoff.h"
+#include "../drivers/serial.h"
+#include "time.h"
+#include "timer.h"
+#include "vdso.h"
+#include "workqueue.h"
 
-struct gdt_entry gdt_entries[6];
-struct gdt_ptr gdt_ptr_struct;
-struct tss_entry tss;
+// Every CPU gets its own GDT so the TSS and per-CPU segments can differ
+struct gdt_entry gdt_entries[NR_CPUS][GDT_ENTRIES];
+struct gdt_ptr gdt_ptrs[NR_CPUS];
+struct tss_entry tss[NR_CPUS];
 
 void kernel_panic(const char* message) {
     __asm__ volatile("cli");
@@ -20,55 +40,82 @@ void kernel_panic(const char* message) {
     vga_writestring(message);
     vga_writestring("\n\nSystem halted.");
     
+    // Park the other processors too
+    smp_send_stop();
+    
     while (1) {
         __asm__ volatile("hlt");
     }
 }
 
-void gdt_set_gate(int num, u32 base, u32 limit, u8 access, u8 gran) {
-    gdt_entries[num].base_low = (base & 0xFFFF);
-    gdt_entries[num].base_middle = (base >> 16) & 0xFF;
-    gdt_entries[num].base_high = (base >> 24) & 0xFF;
+void gdt_set_gate(u32 cpu, int num, u32 base, u32 limit, u8 access, u8 gran) {
+    struct gdt_entry* entry = &gdt_entries[cpu][num];
+    
+    entry->base_low = (base & 0xFFFF);
+    entry->base_middle = (base >> 16) & 0xFF;
+    entry->base_high = (base >> 24) & 0xFF;
     
-    gdt_entries[num].limit_low = (limit & 0xFFFF);
-    gdt_entries[num].granularity = (limit >> 16) & 0x0F;
-    gdt_entries[num].granularity |= gran & 0xF0;
-    gdt_entries[num].access = access;
+    entry->limit_low = (limit & 0xFFFF);
+    entry->granularity = (limit >> 16) & 0x0F;
+    entry->granularity |= gran & 0xF0;
+    entry->access = access;
 }
 
-void tss_init(u32 idx, u32 ss0, u32 esp0) {
-    u32 base = (u32)&tss;
-    u32 limit = base + sizeof(tss);
+void tss_init(u32 cpu, u32 idx, u32 ss0, u32 esp0) {
+    u32 base = (u32)&tss[cpu];
+    u32 limit = base + sizeof(struct tss_entry);
     
-    gdt_set_gate(idx, base, limit, 0xE9, 0x00);
+    gdt_set_gate(cpu, idx, base, limit, 0xE9, 0x00);
     
-    memset(&tss, 0, sizeof(tss));
-    tss.ss0 = ss0;
-    tss.esp0 = esp0;
-    tss.cs = KERNEL_CODE_SEGMENT | 0x3;
-    tss.ss = tss.ds = tss.es = tss.fs = tss.gs = KERNEL_DATA_SEGMENT | 0x3;
+    memset(&tss[cpu], 0, sizeof(struct tss_entry));
+    tss[cpu].ss0 = ss0;
+    tss[cpu].esp0 = esp0;
+    tss[cpu].cs = KERNEL_CODE_SEGMENT | 0x3;
+    tss[cpu].ss = tss[cpu].ds = tss[cpu].es = tss[cpu].fs = tss[cpu].gs = KERNEL_DATA_SEGMENT | 0x3;
 }
 
 void tss_set_kernel_stack(u32 ss, u32 esp) {
-    tss.ss0 = ss;
-    tss.esp0 = esp;
+    u32 cpu = cpu_id();
+    tss[cpu].ss0 = ss;
+    tss[cpu].esp0 = esp;
+    
+    // SYSENTER takes its stack from an MSR instead of the TSS
+    sysenter_set_stack(esp);
 }
 
-void gdt_init(void) {
-    gdt_ptr_struct.limit = (sizeof(struct gdt_entry) * 6) - 1;
-    gdt_ptr_struct.base = (u32)&gdt_entries;
+u32 tss_get_kernel_stack(void) {
+    return tss[cpu_id()].esp0;
+}
+
+void gdt_init_cpu(u32 cpu) {
+    gdt_ptrs[cpu].limit = (sizeof(struct gdt_entry) * GDT_ENTRIES) - 1;
+    gdt_ptrs[cpu].base = (u32)&gdt_entries[cpu];
     
-    gdt_set_gate(0, 0, 0, 0, 0);
-    gdt_set_gate(1, 0, 0xFFFFFFFF, 0x9A, 0xCF);
-    gdt_set_gate(2, 0, 0xFFFFFFFF, 0x92, 0xCF);
-    gdt_set_gate(3, 0, 0xFFFFFFFF, 0xFA, 0xCF);
-    gdt_set_gate(4, 0, 0xFFFFFFFF, 0xF2, 0xCF);
+    gdt_set_gate(cpu, 0, 0, 0, 0, 0);
+    gdt_set_gate(cpu, 1, 0, 0xFFFFFFFF, 0x9A, 0xCF);
+    gdt_set_gate(cpu, 2, 0, 0xFFFFFFFF, 0x92, 0xCF);
+    gdt_set_gate(cpu, 3, 0, 0xFFFFFFFF, 0xFA, 0xCF);
+    gdt_set_gate(cpu, 4, 0, 0xFFFFFFFF, 0xF2, 0xCF);
     
 
-    tss_init(5, KERNEL_DATA_SEGMENT, 0x0);
+    tss_init(cpu, 5, KERNEL_DATA_SEGMENT, 0x0);
+    
+    // Byte-granular data segment over this CPU's cpu_t
+    cpu_t* percpu = smp_cpu(cpu);
+    percpu->self = percpu;
+    percpu->id = cpu;
+    gdt_set_gate(cpu, 6, (u32)percpu, sizeof(cpu_t) - 1, 0x92, 0x40);
     
-    gdt_flush((u32)&gdt_ptr_struct);
+    // Never loaded; ring 3 reads the CPU number from its limit with lsl
+    gdt_set_gate(cpu, 7, 0, cpu, 0xF2, 0x40);
+    
+    gdt_flush((u32)&gdt_ptrs[cpu]);
     tss_flush();
+    __asm__ volatile("mov %0, %%gs" :: "r"((u32)PERCPU_SEGMENT));
+}
+
+void gdt_init(void) {
+    gdt_init_cpu(0);
 }
 
 void print_welcome(void) {
@@ -103,6 +150,23 @@ void shell_command(const char* cmd) {
         vga_writestring("  info    - Display system information\n");
         vga_writestring("  test    - Run security tests\n");
         vga_writestring("  audit   - Display security audit log\n");
+        vga_writestring("  profile <sec> [bt] - Sample the kernel and show hot spots\n");
+        vga_writestring("  ftrace on|off|dump [n]|stats|filter <fn>|filter clear\n");
+        vga_writestring("  boottime - Show time spent in each boot stage\n");
+        vga_writestring("  uptime  - Show the monotonic clock and timer state\n");
+        vga_writestring("  sleep <ms> - Sleep on a wheel timer\n");
+        vga_writestring("  trace list|on <tp>|off <tp>|show [n]|clear - Static tracepoints\n");
+        vga_writestring("  irqsoff [reset] - Worst interrupts-off section and histogram\n");
+        vga_writestring("  irqstat [reset|<vec>] - Per-vector counts and handler cycles\n");
+        vga_writestring("  sysstat [reset|<nr>] - Per-syscall calls, errors and cycles\n");
+        vga_writestring("  ctxsw [reset|bench <n>] - Context switch cost and lazy FPU loads\n");
+        vga_writestring("  pidmax [n] - Show or set the PID and task limit\n");
+        vga_writestring("  slabinfo - Object cache usage\n");
+        vga_writestring("  smp     - Online CPUs, run queues and steals\n");
+        vga_writestring("  slice [<prio> <ms>] - Show or set timeslices\n");
+        vga_writestring("  workqueue - Worker pool size and queued work\n");
+        vga_writestring("  top [sec] - Per-task CPU time, switches, syscalls and memory\n");
+        vga_writestring("  dl [run <rt> <dl> <period> [<work>]|stop] - Deadline tasks (ms)\n");
         vga_writestring("  reboot  - Reboot the system\n\n");
     } else if (strcmp(cmd, "clear") == 0) {
         vga_clear();
@@ -115,7 +179,13 @@ void shell_command(const char* cmd) {
         vga_writestring("  Architecture: x86 (32-bit)\n");
         vga_writestring("  Memory Protection: Enabled\n");
         vga_writestring("  Paging: Enabled\n");
-        vga_writestring("  Interrupts: Enabled\n\n");
+        vga_writestring("  Interrupts: Enabled (");
+        vga_writestring(irq_chip_name());
+        vga_writestring(")\n");
+        vga_writestring("  System calls: ");
+        vga_writestring(sysenter_enabled() ? "SYSENTER, int 0x80 fallback\n" : "int 0x80\n");
+        vga_writestring("  FPU: x87");
+        vga_writestring(fpu_has_sse() ? " + SSE\n\n" : "\n\n");
     } else if (strcmp(cmd, "test") == 0) {
         vga_set_color(VGA_COLOR_LIGHT_YELLOW, VGA_COLOR_BLACK);
         vga_writestring("\nRunning security tests...\n");
@@ -144,6 +214,239 @@ void shell_command(const char* cmd) {
         vga_writestring("\nAll tests passed!\n\n");
     } else if (strcmp(cmd, "audit") == 0) {
         audit_print_log();
+    } else if (strncmp(cmd, "profile", 7) == 0 && (cmd[7] == ' ' || cmd[7] == '\0')) {
+        const char* arg = cmd + 7;
+        while (*arg == ' ') arg++;
+        
+        int seconds = atoi(arg);
+        if (seconds <= 0) {
+            seconds = 5;
+        }
+        while (*arg >= '0' && *arg <= '9') arg++;
+        while (*arg == ' ') arg++;
+        
+        vga_writestring("\nProfiling, press any key to stop early...\n");
+        profile_run((u32)seconds, strcmp(arg, "bt") == 0);
+    } else if (strncmp(cmd, "ftrace", 6) == 0 && (cmd[6] == ' ' || cmd[6] == '\0')) {
+        const char* arg = cmd + 6;
+        while (*arg == ' ') arg++;
+        
+        if (!ftrace_available()) {
+            vga_writestring("Function tracing not built in, rebuild with 'make FTRACE=1'.\n");
+        } else if (strcmp(arg, "on") == 0) {
+            ftrace_start();
+        } else if (strcmp(arg, "off") == 0) {
+            ftrace_stop();
+        } else if (strncmp(arg, "dump", 4) == 0) {
+            int count = atoi(arg + 4);
+            ftrace_dump(count > 0 ? (u32)count : 40);
+        } else if (strcmp(arg, "stats") == 0) {
+            ftrace_print_stats();
+        } else if (strcmp(arg, "filter clear") == 0) {
+            ftrace_filter_clear();
+        } else if (strncmp(arg, "filter ", 7) == 0) {
+            if (!ftrace_filter_add(arg + 7)) {
+                vga_writestring("Unknown function or filter list full.\n");
+            }
+        } else {
+            vga_writestring("Usage: ftrace on|off|dump [n]|stats|filter <fn>|filter clear\n");
+        }
+    } else if (strncmp(cmd, "trace", 5) == 0 && (cmd[5] == ' ' || cmd[5] == '\0')) {
+        const char* arg = cmd + 5;
+        while (*arg == ' ') arg++;
+        
+        if (strcmp(arg, "list") == 0 || *arg == '\0') {
+            tracepoint_list();
+        } else if (strncmp(arg, "on ", 3) == 0 || strncmp(arg, "off ", 4) == 0) {
+            bool enable = arg[1] == 'n';
+            const char* name = arg + (enable ? 3 : 4);
+            tracepoint_t* tp = tracepoint_find(name);
+            if (strcmp(name, "all") == 0) {
+                tracepoint_enable_all(enable);
+            } else if (tp) {
+                tracepoint_enable(tp, enable);
+            } else {
+                vga_writestring("Unknown tracepoint.\n");
+            }
+        } else if (strncmp(arg, "show", 4) == 0) {
+            int count = atoi(arg + 4);
+            tracepoint_show(count > 0 ? (u32)count : 20);
+        } else if (strcmp(arg, "clear") == 0) {
+            tracepoint_clear();
+        } else {
+            vga_writestring("Usage: trace list|on <tp|all>|off <tp|all>|show [n]|clear\n");
+        }
+    } else if (strncmp(cmd, "irqsoff", 7) == 0 && (cmd[7] == ' ' || cmd[7] == '\0')) {
+        const char* arg = cmd + 7;
+        while (*arg == ' ') arg++;
+        
+        if (!irqsoff_available()) {
+            vga_writestring("Interrupts-off tracing not built in, rebuild with 'make IRQSOFF=1'.\n");
+        } else if (strcmp(arg, "reset") == 0) {
+            irqsoff_reset();
+        } else if (*arg == '\0') {
+            irqsoff_report();
+        } else {
+            vga_writestring("Usage: irqsoff [reset]\n");
+        }
+    } else if (strncmp(cmd, "irqstat", 7) == 0 && (cmd[7] == ' ' || cmd[7] == '\0')) {
+        const char* arg = cmd + 7;
+        while (*arg == ' ') arg++;
+        
+        if (*arg == '\0') {
+            irqstat_print();
+        } else if (strcmp(arg, "reset") == 0) {
+            irqstat_reset();
+        } else if (*arg >= '0' && *arg <= '9' && atoi(arg) < 256) {
+            irqstat_print_histogram((u8)atoi(arg));
+        } else {
+            vga_writestring("Usage: irqstat [reset|<vector>]\n");
+        }
+    } else if (strncmp(cmd, "sysstat", 7) == 0 && (cmd[7] == ' ' || cmd[7] == '\0')) {
+        const char* arg = cmd + 7;
+        while (*arg == ' ') arg++;
+        
+        if (*arg == '\0') {
+            syscall_print_stats();
+        } else if (strcmp(arg, "reset") == 0) {
+            syscall_stats_reset();
+        } else if (*arg >= '0' && *arg <= '9') {
+            syscall_print_histogram((u32)atoi(arg));
+        } else {
+            vga_writestring("Usage: sysstat [reset|<nr>]\n");
+        }
+    } else if (strncmp(cmd, "ctxsw", 5) == 0 && (cmd[5] == ' ' || cmd[5] == '\0')) {
+        const char* arg = cmd + 5;
+        while (*arg == ' ') arg++;
+        
+        if (*arg == '\0') {
+            process_ctxsw_report();
+        } else if (strcmp(arg, "reset") == 0) {
+            process_ctxsw_reset();
+        } else if (strncmp(arg, "bench", 5) == 0) {
+            int rounds = atoi(arg + 5);
+            process_ctxsw_bench(rounds > 0 ? (u32)rounds : 10000);
+        } else {
+            vga_writestring("Usage: ctxsw [reset|bench <n>]\n");
+        }
+    } else if (strncmp(cmd, "pidmax", 6) == 0 && (cmd[6] == ' ' || cmd[6] == '\0')) {
+        const char* arg = cmd + 6;
+        while (*arg == ' ') arg++;
+        
+        char buf[16];
+        if (*arg >= '0' && *arg <= '9') {
+            if (!pid_set_max((u32)atoi(arg))) {
+                vga_writestring("pid_max must be 2..32768 and above every PID in use.\n");
+            }
+        } else if (*arg != '\0') {
+            vga_writestring("Usage: pidmax [n]\n");
+        }
+        vga_writestring("pid_max: ");
+        utoa(pid_get_max(), buf, 10);
+        vga_writestring(buf);
+        vga_writestring(", in use: ");
+        utoa(pid_count(), buf, 10);
+        vga_writestring(buf);
+        vga_writestring("\n");
+    } else if (strcmp(cmd, "slabinfo") == 0) {
+        slab_print_info();
+    } else if (strcmp(cmd, "smp") == 0) {
+        smp_print_info();
+    } else if (strcmp(cmd, "workqueue") == 0) {
+        workqueue_print_info();
+    } else if (strncmp(cmd, "top", 3) == 0 && (cmd[3] == ' ' || cmd[3] == '\0')) {
+        const char* arg = cmd + 3;
+        while (*arg == ' ') arg++;
+        acct_top(*arg ? (u32)atoi(arg) : 1);
+    } else if (strncmp(cmd, "dl", 2) == 0 && (cmd[2] == ' ' || cmd[2] == '\0')) {
+        const char* arg = cmd + 2;
+        while (*arg == ' ') arg++;
+        
+        if (strncmp(arg, "run ", 4) == 0) {
+            // runtime, deadline, period and optional work per job, in ms
+            u64 params[4] = { 0, 0, 0, 0 };
+            u32 count = 0;
+            arg += 4;
+            while (count < 4) {
+                while (*arg == ' ') arg++;
+                if (*arg < '0' || *arg > '9') {
+                    break;
+                }
+                params[count++] = (u64)atoi(arg) * NSEC_PER_MSEC;
+                while (*arg >= '0' && *arg <= '9') arg++;
+            }
+            
+            if (count < 3) {
+                vga_writestring("Usage: dl run <runtime> <deadline> <period> [<work>]\n");
+            } else {
+                u64 work = count == 4 ? params[3] : params[0] / 2;
+                u32 pid = sched_dl_run_load(params[0], params[1], params[2], work);
+                if (pid) {
+                    char buf[16];
+                    utoa(pid, buf, 10);
+                    vga_writestring("Started deadline load, PID ");
+                    vga_writestring(buf);
+                    vga_writestring("\n");
+                } else {
+                    vga_writestring("Rejected: need runtime <= deadline <= period <= 1000 ms and free bandwidth.\n");
+                }
+            }
+        } else if (strcmp(arg, "stop") == 0) {
+            char buf[16];
+            utoa(sched_dl_stop_loads(), buf, 10);
+            vga_writestring("Stopped ");
+            vga_writestring(buf);
+            vga_writestring(" deadline load(s)\n");
+        } else if (*arg != '\0') {
+            vga_writestring("Usage: dl [run <runtime> <deadline> <period> [<work>]|stop]\n");
+        }
+        sched_dl_print_info();
+    } else if (strncmp(cmd, "slice", 5) == 0 && (cmd[5] == ' ' || cmd[5] == '\0')) {
+        const char* arg = cmd + 5;
+        while (*arg == ' ') arg++;
+        
+        if (*arg >= '0' && *arg <= '9') {
+            int prio = atoi(arg);
+            while (*arg >= '0' && *arg <= '9') arg++;
+            while (*arg == ' ') arg++;
+            if (prio < 0 || !sched_set_slice((u32)prio, (u32)atoi(arg))) {
+                vga_writestring("Priority must be 0..31 and the slice 1..1000 ms.\n");
+            }
+        } else if (*arg != '\0') {
+            vga_writestring("Usage: slice [<prio> <ms>]\n");
+        }
+        sched_print_slices();
+    } else if (strcmp(cmd, "boottime") == 0) {
+        boottime_report();
+    } else if (strcmp(cmd, "uptime") == 0) {
+        char buf[32];
+        vga_writestring("\nUptime: ");
+        u64toa(div_u64(time_ns(), NSEC_PER_MSEC), buf, 10);
+        vga_writestring(buf);
+        vga_writestring(" ms\nTSC: ");
+        utoa(time_tsc_khz(), buf, 10);
+        vga_writestring(buf);
+        vga_writestring(" kHz\nClock events: ");
+        vga_writestring(clockevent_get()->name);
+        vga_writestring(", ");
+        utoa(clockevent_get()->events, buf, 10);
+        vga_writestring(buf);
+        vga_writestring(" interrupts\nPending timers: ");
+        utoa(timer_count(), buf, 10);
+        vga_writestring(buf);
+        vga_writestring("\n\n");
+    } else if (strncmp(cmd, "sleep ", 6) == 0) {
+        int ms = atoi(cmd + 6);
+        if (ms > 0) {
+            u64 start = time_ns();
+            msleep((u32)ms);
+            
+            char buf[32];
+            vga_writestring("Slept ");
+            u64toa(div_u64(time_ns() - start, NSEC_PER_USEC), buf, 10);
+            vga_writestring(buf);
+            vga_writestring(" us\n");
+        }
     } else if (strcmp(cmd, "reboot") == 0) {
         vga_writestring("\nRebooting...\n");
         outb(0x64, 0xFE);
@@ -194,34 +497,92 @@ void kernel_main(u32 magic, u32 addr) {
     (void)magic;
     (void)addr;
     
+    boottime_start();
+    
 
     vga_init();
+    boottime_mark("vga_init");
+    
+
+    tracepoint_init();
+    boottime_mark("tracepoint_init");
     
 
     gdt_init();
+    boottime_mark("gdt_init");
+    
+
+    fpu_init();
+    boottime_mark("fpu_init");
     
 
     memory_init(32 * 1024 * 1024);
+    boottime_mark("memory_init");
+    
+
+    acpi_init();
+    boottime_mark("acpi_init");
     
 
     idt_init();
+    boottime_mark("idt_init");
+    
+
+    softirq_init();
+    boottime_mark("softirq_init");
+    
+
+    time_init();
+    boottime_mark("time_init");
+    
+
+    timer_init();
+    boottime_mark("timer_init");
+    
+
+    vdso_init();
+    boottime_mark("vdso_init");
+    
+
+    irqsoff_init();
     
 
     security_init();
+    boottime_mark("security_init");
     
 
     keyboard_init();
+    boottime_mark("keyboard_init");
+    
+
+    profile_init();
     
 
     process_init();
+    boottime_mark("process_init");
     
 
     syscall_init();
+    boottime_mark("syscall_init");
+    
+    smp_init();
+    boottime_mark("smp_init");
+    
+    workqueue_init();
+    softirq_init_threads();
+    boottime_mark("kthread_init");
+    
+
+    serial_init();
+    boottime_mark("serial_init");
     
 
     __asm__ volatile("sti");
     
 
+    boottime_report_serial();
+    
+
     print_welcome();
     
 
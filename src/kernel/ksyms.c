@@ -0,0 +1,76 @@
+#include "ksyms.h"
+#include <kernel/kernel.h>
+#include "../lib/string.h"
+
+// Emitted by scripts/ksyms.awk from `nm -n` of the first link stage. The
+// references are weak so the first stage links without a table.
+extern const u32 ksym_count __attribute__((weak));
+extern const u32 ksym_addrs[] __attribute__((weak));
+extern const char* const ksym_names[] __attribute__((weak));
+
+u32 ksym_total(void) {
+    if (&ksym_count == 0) {
+        return 0;
+    }
+    return ksym_count;
+}
+
+u32 ksym_index(u32 addr) {
+    u32 count = ksym_total();
+    if (count == 0 || addr < ksym_addrs[0]) {
+        return KSYM_NONE;
+    }
+    
+    // Binary search for the last symbol at or below addr
+    u32 lo = 0;
+    u32 hi = count;
+    while (hi - lo > 1) {
+        u32 mid = lo + (hi - lo) / 2;
+        if (ksym_addrs[mid] <= addr) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    return lo;
+}
+
+u32 ksym_address(u32 index) {
+    if (index >= ksym_total()) {
+        return 0;
+    }
+    return ksym_addrs[index];
+}
+
+const char* ksym_name(u32 index) {
+    if (index >= ksym_total()) {
+        return "?";
+    }
+    return ksym_names[index];
+}
+
+const char* ksym_lookup(u32 addr, u32* offset) {
+    u32 index = ksym_index(addr);
+    if (index == KSYM_NONE) {
+        if (offset) {
+            *offset = 0;
+        }
+        return "?";
+    }
+    
+    if (offset) {
+        *offset = addr - ksym_addrs[index];
+    }
+    return ksym_names[index];
+}
+
+u32 ksym_lookup_name(const char* name) {
+    u32 count = ksym_total();
+    for (u32 i = 0; i < count; i++) {
+        if (strcmp(ksym_names[i], name) == 0) {
+            return ksym_addrs[i];
+        }
+    }
+    return 0;
+}
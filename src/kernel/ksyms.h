@@ -0,0 +1,16 @@
+#ifndef KSYMS_H
+#define KSYMS_H
+
+#include <kernel/kernel.h>
+
+#define KSYM_NONE 0xFFFFFFFF
+
+// Kernel symbol table functions
+u32 ksym_total(void);
+u32 ksym_index(u32 addr);
+u32 ksym_address(u32 index);
+const char* ksym_name(u32 index);
+const char* ksym_lookup(u32 addr, u32* offset);
+u32 ksym_lookup_name(const char* name);
+
+#endif // KSYMS_H
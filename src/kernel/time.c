@@ -0,0 +1,171 @@
+#include "time.h"
+#include <kernel/kernel.h>
+#include <kernel/interrupts.h>
+#include "../drivers/pit.h"
+#include "../arch/x86/apic.h"
+#include "../lib/div64.h"
+
+#define CPUID_EDX_TSC (1 << 4)
+
+// ns = (cycles * tsc_mult) >> tsc_shift, counted from time_init()
+static u64 tsc_base = 0;
+static u32 tsc_khz = 0;
+static u32 tsc_mult = 0;
+static u32 tsc_shift = 0;
+
+static u32 lapic_timer_khz = 0;
+
+static clock_event_t* clock_event = 0;
+static void (*clock_event_handler)(void) = 0;
+
+static void clockevent_interrupt(void) {
+    clock_event->events++;
+    
+    if (clock_event_handler) {
+        clock_event_handler();
+    }
+}
+
+// PIT channel 0, used when there is no local APIC
+static void pit_set_next_event(u64 delta_ns) {
+    u64 count = div_u64(delta_ns * PIT_FREQUENCY, NSEC_PER_SEC);
+    pit_oneshot(count > PIT_MAX_COUNT ? PIT_MAX_COUNT : (u16)count);
+}
+
+static void pit_event_interrupt(struct registers* regs) {
+    (void)regs;
+    clockevent_interrupt();
+}
+
+static clock_event_t pit_clock_event = {
+    .name = "PIT one-shot",
+    .set_next_event = pit_set_next_event,
+    .stop = pit_stop,
+};
+
+// Local APIC timer, preferred because it needs no port I/O to rearm
+static void lapic_set_next_event(u64 delta_ns) {
+    lapic_timer_oneshot((u32)div_u64(delta_ns * lapic_timer_khz, NSEC_PER_MSEC));
+}
+
+static void lapic_event_interrupt(struct registers* regs) {
+    (void)regs;
+    lapic_eoi();
+    clockevent_interrupt();
+}
+
+static clock_event_t lapic_clock_event = {
+    .name = "LAPIC timer one-shot",
+    .set_next_event = lapic_set_next_event,
+    .stop = lapic_timer_stop,
+};
+
+static void time_calibrate(void) {
+    u16 latch = PIT_FREQUENCY * TIME_CALIBRATE_MS / 1000;
+    
+    if (apic_enabled()) {
+        lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+        lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+        lapic_write(LAPIC_REG_TIMER_INIT, 0xFFFFFFFF);
+    }
+    
+    u64 start = rdtsc();
+    pit_wait(latch);
+    u64 end = rdtsc();
+    
+    tsc_khz = (u32)div_u64(end - start, TIME_CALIBRATE_MS);
+    
+    if (apic_enabled()) {
+        u32 elapsed = 0xFFFFFFFF - lapic_read(LAPIC_REG_TIMER_CURRENT);
+        lapic_timer_stop();
+        lapic_timer_khz = elapsed / TIME_CALIBRATE_MS;
+    }
+}
+
+void time_init(void) {
+    u32 eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    
+    if (!(edx & CPUID_EDX_TSC)) {
+        kernel_panic("No time stamp counter present!");
+    }
+    
+    time_calibrate();
+    if (tsc_khz == 0) {
+        kernel_panic("TSC calibration failed!");
+    }
+    
+    // Largest shift whose multiplier still fits in 32 bits keeps the most precision
+    tsc_shift = 32;
+    while (div_u64((u64)NSEC_PER_MSEC << tsc_shift, tsc_khz) > 0xFFFFFFFF) {
+        tsc_shift--;
+    }
+    tsc_mult = (u32)div_u64((u64)NSEC_PER_MSEC << tsc_shift, tsc_khz);
+    tsc_base = rdtsc();
+    
+    if (lapic_timer_khz) {
+        clock_event = &lapic_clock_event;
+        clock_event->max_delta_ns = div_u64(0xFFFFFFFFULL * NSEC_PER_MSEC, lapic_timer_khz);
+        clock_event->min_delta_ns = NSEC_PER_USEC;
+        register_interrupt_handler(APIC_TIMER_VECTOR, lapic_event_interrupt);
+    } else {
+        clock_event = &pit_clock_event;
+        clock_event->max_delta_ns = div_u64((u64)PIT_MAX_COUNT * NSEC_PER_SEC, PIT_FREQUENCY);
+        clock_event->min_delta_ns = 10 * NSEC_PER_USEC;
+        pit_stop();
+        register_interrupt_handler(IRQ_BASE + PIT_IRQ, pit_event_interrupt);
+    }
+}
+
+u64 time_cycles_to_ns(u64 cycles) {
+    return mul_u64_u32_shr(cycles, tsc_mult, tsc_shift);
+}
+
+u64 time_ns(void) {
+    return time_cycles_to_ns(rdtsc() - tsc_base);
+}
+
+void time_get_clocksource(u64* base, u32* mult, u32* shift) {
+    *base = tsc_base;
+    *mult = tsc_mult;
+    *shift = tsc_shift;
+}
+
+u32 time_tsc_khz(void) {
+    return tsc_khz;
+}
+
+void ndelay(u64 ns) {
+    u64 end = time_ns() + ns;
+    
+    while (time_ns() < end) {
+        __asm__ volatile("pause");
+    }
+}
+
+const clock_event_t* clockevent_get(void) {
+    return clock_event;
+}
+
+void clockevent_set_handler(void (*handler)(void)) {
+    clock_event_handler = handler;
+}
+
+// Arm the device once for an absolute deadline; deadlines past max_delta_ns
+// fire early and the handler simply rearms for the remainder
+void clockevent_program(u64 expires_ns) {
+    u64 now = time_ns();
+    u64 delta = expires_ns > now ? expires_ns - now : 0;
+    
+    if (delta < clock_event->min_delta_ns) {
+        delta = clock_event->min_delta_ns;
+    } else if (delta > clock_event->max_delta_ns) {
+        delta = clock_event->max_delta_ns;
+    }
+    
+    clock_event->set_next_event(delta);
+}
+
+void clockevent_cancel(void) {
+    clock_event->stop();
+}
@@ -0,0 +1,37 @@
+#ifndef TIME_H
+#define TIME_H
+
+#include <kernel/kernel.h>
+
+#define NSEC_PER_USEC   1000
+#define NSEC_PER_MSEC   1000000
+#define NSEC_PER_SEC    1000000000
+
+// PIT channel 2 window used to calibrate the TSC and the LAPIC timer
+#define TIME_CALIBRATE_MS 20
+
+// One-shot interrupt source; only ever armed for the next deadline
+typedef struct clock_event {
+    const char* name;
+    u64 min_delta_ns;
+    u64 max_delta_ns;
+    void (*set_next_event)(u64 delta_ns);
+    void (*stop)(void);
+    u32 events;
+} clock_event_t;
+
+// Clocksource functions
+void time_init(void);
+u64 time_ns(void);
+u64 time_cycles_to_ns(u64 cycles);
+u32 time_tsc_khz(void);
+void time_get_clocksource(u64* base, u32* mult, u32* shift);
+void ndelay(u64 ns);
+
+// Clock event functions
+const clock_event_t* clockevent_get(void);
+void clockevent_set_handler(void (*handler)(void));
+void clockevent_program(u64 expires_ns);
+void clockevent_cancel(void);
+
+#endif // TIME_H
@@ -0,0 +1,307 @@
+#include "timer.h"
+#include <kernel/kernel.h>
+#include <kernel/irqflags.h>
+#include <kernel/spinlock.h>
+#include <kernel/interrupts.h>
+#include "../interrupts/softirq.h"
+#include "../arch/x86/apic.h"
+#include "../arch/x86/smp.h"
+#include "../process/process.h"
+#include "../process/wait.h"
+#include "../lib/div64.h"
+
+#define TIMER_NONE 0xFFFFFFFFFFFFFFFFULL
+
+static ktimer_t* tv1[TVR_SIZE];
+static ktimer_t* tvn[TVN_LEVELS][TVN_SIZE];
+
+// Next tick the wheel has not processed yet
+static u64 wheel_clock = 0;
+static u32 pending_timers = 0;
+
+// Tick the clock event device is currently armed for
+static u64 next_event_tick = TIMER_NONE;
+
+// The wheel and the clock event device belong to the boot CPU; other CPUs
+// add and delete under the lock and kick the BSP to rearm
+static spinlock_t timer_lock = SPINLOCK_INIT;
+
+u64 timer_ticks(void) {
+    return div_u64(time_ns(), TIMER_TICK_NS);
+}
+
+static void timer_link(ktimer_t** head, ktimer_t* timer) {
+    timer->next = *head;
+    if (*head) {
+        (*head)->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+}
+
+static void timer_unlink(ktimer_t* timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = 0;
+    timer->pprev = 0;
+}
+
+static void internal_add_timer(ktimer_t* timer) {
+    u64 expires = timer->expires;
+    u64 idx = expires - wheel_clock;
+    ktimer_t** slot;
+    
+    if (expires < wheel_clock) {
+        // Already due, run on the next processed tick
+        slot = &tv1[wheel_clock & TVR_MASK];
+    } else if (idx < TVR_SIZE) {
+        slot = &tv1[expires & TVR_MASK];
+    } else {
+        // Beyond the outermost level the timer is clamped and re-cascaded
+        u32 level = 0;
+        while (level < TVN_LEVELS - 1 && idx >= (1ULL << (TVR_BITS + (level + 1) * TVN_BITS))) {
+            level++;
+        }
+        if (idx >= (1ULL << (TVR_BITS + TVN_LEVELS * TVN_BITS))) {
+            expires = wheel_clock + (1ULL << (TVR_BITS + TVN_LEVELS * TVN_BITS)) - 1;
+        }
+        slot = &tvn[level][(expires >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK];
+    }
+    
+    timer_link(slot, timer);
+}
+
+// Move one coarse slot down a level, returns the slot index used
+static u32 cascade(u32 level) {
+    u32 index = (wheel_clock >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK;
+    ktimer_t* list = tvn[level][index];
+    tvn[level][index] = 0;
+    
+    while (list) {
+        ktimer_t* timer = list;
+        list = timer->next;
+        internal_add_timer(timer);
+    }
+    
+    return index;
+}
+
+// Earliest tick worth waking for. Coarse levels always expire at or after
+// the next 256-tick boundary, so an empty first level only costs one early
+// wakeup at that boundary.
+static u64 timer_next_expiry(void) {
+    if (pending_timers == 0) {
+        return TIMER_NONE;
+    }
+    
+    u32 index = wheel_clock & TVR_MASK;
+    for (u32 i = index; i < TVR_SIZE; i++) {
+        if (tv1[i]) {
+            return wheel_clock + (i - index);
+        }
+    }
+    
+    return wheel_clock + (TVR_SIZE - index);
+}
+
+static void timer_reprogram(void) {
+    u64 next = timer_next_expiry();
+    
+    next_event_tick = next;
+    if (next == TIMER_NONE) {
+        clockevent_cancel();
+    } else {
+        clockevent_program(next * TIMER_TICK_NS);
+    }
+}
+
+static void run_timers(void) {
+    u64 now = timer_ticks();
+    u32 flags = spin_lock_irqsave(&timer_lock);
+    
+    while (wheel_clock <= now) {
+        u32 index = wheel_clock & TVR_MASK;
+        
+        if (index == 0) {
+            for (u32 level = 0; level < TVN_LEVELS; level++) {
+                if (cascade(level) != 0) {
+                    break;
+                }
+            }
+        }
+        
+        // Expired timers move to a local list so timer_del() stays safe
+        // while callbacks run with interrupts enabled
+        ktimer_t* head = 0;
+        if (tv1[index]) {
+            head = tv1[index];
+            head->pprev = &head;
+            tv1[index] = 0;
+        }
+        wheel_clock++;
+        
+        while (head) {
+            ktimer_t* timer = head;
+            timer_unlink(timer);
+            pending_timers--;
+            
+            spin_unlock_irqrestore(&timer_lock, flags);
+            timer->func(timer->data);
+            flags = spin_lock_irqsave(&timer_lock);
+        }
+    }
+    
+    timer_reprogram();
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+static void timer_event(void) {
+    next_event_tick = TIMER_NONE;
+    raise_softirq(SOFTIRQ_TIMER);
+}
+
+// Sent by another CPU whose new timer beats the armed deadline
+static void timer_kick_handler(struct registers* regs) {
+    (void)regs;
+    spin_lock(&timer_lock);
+    if (next_event_tick != TIMER_NONE) {
+        clockevent_program(next_event_tick * TIMER_TICK_NS);
+    }
+    spin_unlock(&timer_lock);
+    lapic_eoi();
+}
+
+void timer_init(void) {
+    for (u32 i = 0; i < TVR_SIZE; i++) {
+        tv1[i] = 0;
+    }
+    for (u32 level = 0; level < TVN_LEVELS; level++) {
+        for (u32 i = 0; i < TVN_SIZE; i++) {
+            tvn[level][i] = 0;
+        }
+    }
+    
+    wheel_clock = timer_ticks();
+    pending_timers = 0;
+    next_event_tick = TIMER_NONE;
+    
+    open_softirq(SOFTIRQ_TIMER, run_timers);
+    clockevent_set_handler(timer_event);
+    register_interrupt_handler(IPI_TIMER_VECTOR, timer_kick_handler);
+}
+
+void timer_setup(ktimer_t* timer, void (*func)(u32 data), u32 data) {
+    timer->next = 0;
+    timer->pprev = 0;
+    timer->expires = 0;
+    timer->func = func;
+    timer->data = data;
+}
+
+bool timer_pending(const ktimer_t* timer) {
+    return timer->pprev != 0;
+}
+
+void timer_add(ktimer_t* timer, u64 delay_ns) {
+    u32 flags = spin_lock_irqsave(&timer_lock);
+    bool kick = false;
+    
+    if (timer_pending(timer)) {
+        timer_unlink(timer);
+        pending_timers--;
+    }
+    
+    // An empty wheel may lag far behind after a long idle, skip ahead
+    if (pending_timers == 0) {
+        wheel_clock = timer_ticks();
+    }
+    
+    // Round the deadline up so the timer never fires before delay_ns has passed
+    u64 deadline = time_ns() + delay_ns;
+    timer->expires = div_u64(deadline + TIMER_TICK_NS - 1, TIMER_TICK_NS);
+    internal_add_timer(timer);
+    pending_timers++;
+    
+    // Only touch the hardware when the new timer beats the armed deadline
+    if (timer->expires < next_event_tick) {
+        next_event_tick = timer->expires;
+        if (cpu_id() == 0) {
+            clockevent_program(timer->expires * TIMER_TICK_NS);
+        } else {
+            kick = true;
+        }
+    }
+    
+    spin_unlock_irqrestore(&timer_lock, flags);
+    
+    if (kick) {
+        smp_send_timer_kick();
+    }
+}
+
+bool timer_del(ktimer_t* timer) {
+    u32 flags = spin_lock_irqsave(&timer_lock);
+    bool was_pending = timer_pending(timer);
+    
+    // The armed deadline is left alone; an early event just rearms
+    if (was_pending) {
+        timer_unlink(timer);
+        pending_timers--;
+    }
+    
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return was_pending;
+}
+
+u32 timer_count(void) {
+    return pending_timers;
+}
+
+static void sleep_wakeup(u32 data) {
+    *(volatile bool*)data = true;
+}
+
+// Before the scheduler is up (and in contexts that cannot block) sleep by
+// halting; sti only takes effect after hlt starts, so no wakeup is lost
+static void nanosleep_halt(u64 ns) {
+    volatile bool done = false;
+    ktimer_t timer;
+    timer_setup(&timer, sleep_wakeup, (u32)&done);
+    timer_add(&timer, ns);
+    
+    u32 flags = local_irq_save();
+    while (!done) {
+        softirq_run_deferred();
+        safe_halt();
+        local_irq_disable();
+    }
+    local_irq_restore(flags);
+}
+
+// The task blocks and the CPU runs other work until the deadline
+void nanosleep(u64 ns) {
+    if (ns < TIMER_TICK_NS) {
+        ndelay(ns);
+        return;
+    }
+    
+    process_t* task = process_get_current();
+    if (!task || task == this_cpu()->idle || in_interrupt() || preempt_count()) {
+        nanosleep_halt(ns);
+        return;
+    }
+    
+    u64 deadline = time_ns() + ns;
+    u64 now;
+    while ((now = time_ns()) < deadline) {
+        set_current_state(task, PROCESS_STATE_BLOCKED);
+        schedule_timeout(deadline - now);
+    }
+    set_current_state(task, PROCESS_STATE_RUNNING);
+}
+
+void msleep(u32 ms) {
+    nanosleep((u64)ms * NSEC_PER_MSEC);
+}
@@ -0,0 +1,40 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <kernel/kernel.h>
+#include "time.h"
+
+// Wheel granularity; shorter sleeps spin on the TSC instead
+#define TIMER_TICK_NS   NSEC_PER_MSEC
+
+// Five-level cascading wheel: 256 one-tick slots, then 4 x 64 coarser slots
+#define TVR_BITS        8
+#define TVN_BITS        6
+#define TVR_SIZE        (1 << TVR_BITS)
+#define TVN_SIZE        (1 << TVN_BITS)
+#define TVR_MASK        (TVR_SIZE - 1)
+#define TVN_MASK        (TVN_SIZE - 1)
+#define TVN_LEVELS      4
+
+typedef struct ktimer {
+    struct ktimer* next;
+    struct ktimer** pprev;
+    u64 expires;            // Absolute, in wheel ticks
+    void (*func)(u32 data);
+    u32 data;
+} ktimer_t;
+
+// Timer functions
+void timer_init(void);
+void timer_setup(ktimer_t* timer, void (*func)(u32 data), u32 data);
+void timer_add(ktimer_t* timer, u64 delay_ns);
+bool timer_del(ktimer_t* timer);
+bool timer_pending(const ktimer_t* timer);
+u64 timer_ticks(void);
+u32 timer_count(void);
+
+// Sleep functions
+void nanosleep(u64 ns);
+void msleep(u32 ms);
+
+#endif // TIMER_H
@@ -0,0 +1,136 @@
+#include "vdso.h"
+#include <kernel/kernel.h>
+#include <kernel/memory.h>
+#include "time.h"
+#include "../lib/string.h"
+
+// Text page code is copied verbatim, so it may only call other VDSO_TEXT
+// functions and reach kernel state through VDSO_DATA_ADDR
+#define VDSO_TEXT __attribute__((section(".vdso.text"), noinline)) NOTRACE
+
+#define barrier() __asm__ volatile("" ::: "memory")
+#define vdso_user_data ((const volatile vdso_data_t*)VDSO_DATA_ADDR)
+
+// Bounds of the text page code, provided by linker.ld
+extern u8 __vdso_text_start[];
+extern u8 __vdso_text_end[];
+
+// Kernel alias of the data page
+static vdso_data_t* vdso_data = 0;
+
+VDSO_TEXT u64 vdso_time_ns(void) {
+    u32 seq, mult, shift, low, high;
+    u64 base, offset;
+    
+    do {
+        seq = vdso_user_data->seq;
+        barrier();
+        mult = vdso_user_data->tsc_mult;
+        shift = vdso_user_data->tsc_shift;
+        base = vdso_user_data->tsc_base;
+        offset = vdso_user_data->mono_offset_ns;
+        __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+        barrier();
+    } while ((seq & 1) || seq != vdso_user_data->seq);
+    
+    // Same 96-bit scaling as mul_u64_u32_shr(), spelled out to stay self-contained
+    u64 delta = (((u64)high << 32) | low) - base;
+    u64 ns = ((u64)(u32)delta * mult) >> shift;
+    if (delta >> 32) {
+        ns += ((u64)(u32)(delta >> 32) * mult) << (32 - shift);
+    }
+    return offset + ns;
+}
+
+VDSO_TEXT s32 vdso_clock_gettime(u32 clock, vdso_timespec_t* ts) {
+    if (clock != VDSO_CLOCK_MONOTONIC) {
+        return -1;
+    }
+    
+    u64 ns = vdso_time_ns();
+    u32 sec, nsec;
+    
+    // One divl: the quotient fits in 32 bits for the next 136 years
+    __asm__("divl %4" : "=a"(sec), "=d"(nsec) : "a"((u32)ns), "d"((u32)(ns >> 32)), "rm"((u32)NSEC_PER_SEC));
+    ts->tv_sec = sec;
+    ts->tv_nsec = nsec;
+    return 0;
+}
+
+// The CPU number is the limit of VDSO_CPU_SEGMENT in that CPU's GDT
+VDSO_TEXT u32 vdso_getpid(void) {
+    u32 cpu, again, seq, pid;
+    
+    do {
+        __asm__ volatile("lsl %1, %0" : "=r"(cpu) : "r"((u32)(VDSO_CPU_SEGMENT | RING_3)) : "cc");
+        seq = vdso_user_data->cpus[cpu].seq;
+        barrier();
+        pid = vdso_user_data->cpus[cpu].pid;
+        barrier();
+        __asm__ volatile("lsl %1, %0" : "=r"(again) : "r"((u32)(VDSO_CPU_SEGMENT | RING_3)) : "cc");
+    } while (again != cpu || seq != vdso_user_data->cpus[cpu].seq);
+    
+    return pid;
+}
+
+void vdso_update_time(void) {
+    if (!vdso_data) {
+        return;
+    }
+    
+    u64 base;
+    u32 mult, shift;
+    time_get_clocksource(&base, &mult, &shift);
+    
+    vdso_data->seq++;
+    barrier();
+    vdso_data->tsc_base = base;
+    vdso_data->tsc_mult = mult;
+    vdso_data->tsc_shift = shift;
+    vdso_data->tsc_khz = time_tsc_khz();
+    vdso_data->mono_offset_ns = 0;
+    barrier();
+    vdso_data->seq++;
+}
+
+// Called from the switch with interrupts off, so only this CPU writes its slot
+void vdso_set_process(u32 pid) {
+    if (vdso_data) {
+        u32 cpu = cpu_id();
+        vdso_data->cpus[cpu].seq++;
+        barrier();
+        vdso_data->cpus[cpu].pid = pid;
+    }
+}
+
+static u32 vdso_entry(void* func) {
+    return VDSO_TEXT_ADDR + ((u32)func - (u32)__vdso_text_start);
+}
+
+void vdso_init(void) {
+    page_directory_t* dir = paging_get_kernel_directory();
+    u32 text_size = __vdso_text_end - __vdso_text_start;
+    
+    if (text_size > PAGE_SIZE) {
+        kernel_panic("vDSO text does not fit in one page!");
+    }
+    
+    // Both frames are written through kernel-only identity aliases and
+    // mapped read-only for user space
+    u32 data_frame = pmm_alloc_frame();
+    u32 text_frame = pmm_alloc_frame();
+    vdso_data = (vdso_data_t*)paging_map_physical(data_frame, PAGE_SIZE, false);
+    u8* text = (u8*)paging_map_physical(text_frame, PAGE_SIZE, false);
+    
+    memset(vdso_data, 0, PAGE_SIZE);
+    memset(text, 0xCC, PAGE_SIZE);
+    memcpy(text, __vdso_text_start, text_size);
+    
+    vdso_data->entry_clock_gettime = vdso_entry(vdso_clock_gettime);
+    vdso_data->entry_time_ns = vdso_entry(vdso_time_ns);
+    vdso_data->entry_getpid = vdso_entry(vdso_getpid);
+    vdso_update_time();
+    
+    paging_map_user_frame(VDSO_DATA_ADDR, data_frame, false, dir);
+    paging_map_user_frame(VDSO_TEXT_ADDR, text_frame, false, dir);
+}
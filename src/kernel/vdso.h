@@ -0,0 +1,50 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include <kernel/kernel.h>
+
+// Read-only pages at the top of every user address space
+#define VDSO_DATA_ADDR  0xBFFFE000
+#define VDSO_TEXT_ADDR  0xBFFFF000
+
+#define VDSO_CLOCK_MONOTONIC 1
+
+typedef struct {
+    u32 tv_sec;
+    u32 tv_nsec;
+} vdso_timespec_t;
+
+// Readers retry while seq is odd or changed across the read
+typedef struct {
+    volatile u32 seq;
+    u32 tsc_mult;
+    u32 tsc_shift;
+    u32 tsc_khz;
+    u64 tsc_base;
+    u64 mono_offset_ns;
+    
+    // Task running on each CPU, rewritten on every switch there. seq is
+    // bumped first, so a reader that sees the same CPU and seq around its
+    // read was that task throughout.
+    struct {
+        volatile u32 seq;
+        volatile u32 pid;
+    } cpus[NR_CPUS];
+    
+    // User addresses of the functions in the text page
+    u32 entry_clock_gettime;
+    u32 entry_time_ns;
+    u32 entry_getpid;
+} vdso_data_t;
+
+// Kernel side
+void vdso_init(void);
+void vdso_update_time(void);
+void vdso_set_process(u32 pid);
+
+// Text page functions, copied to VDSO_TEXT_ADDR and called from ring 3
+s32 vdso_clock_gettime(u32 clock, vdso_timespec_t* ts);
+u64 vdso_time_ns(void);
+u32 vdso_getpid(void);
+
+#endif // VDSO_H
@@ -0,0 +1,292 @@
+#include "workqueue.h"
+#include <kernel/kernel.h>
+#include <kernel/spinlock.h>
+#include "../process/kthread.h"
+#include "../process/wait.h"
+#include "../interrupts/softirq.h"
+#include "../drivers/vga.h"
+#include "../lib/string.h"
+
+// A worker slot; flush_work() looks at current to find running items
+typedef struct {
+    bool used;
+    process_t* task;
+    work_t* current;
+} worker_t;
+
+// One shared FIFO served by the whole pool
+static spinlock_t wq_lock = SPINLOCK_INIT;
+static work_t* wq_head = 0;
+static work_t* wq_tail = 0;
+static worker_t workers[WQ_MAX_WORKERS];
+static u32 nr_workers = 0;
+static u32 nr_idle = 0;
+static u32 nr_queued = 0;
+static u32 nr_executed = 0;
+static u32 peak_workers = 0;
+static bool wq_ready = false;
+
+static wait_queue_head_t worker_wait = WAIT_QUEUE_HEAD_INIT;
+static wait_queue_head_t flush_wait = WAIT_QUEUE_HEAD_INIT;
+
+static void worker_thread(void* data);
+
+// Claim a free slot, wq_lock held; the thread is created after unlocking
+static worker_t* worker_reserve(void) {
+    if (!wq_ready || nr_workers >= WQ_MAX_WORKERS) {
+        return 0;
+    }
+    
+    for (u32 i = 0; i < WQ_MAX_WORKERS; i++) {
+        if (!workers[i].used) {
+            workers[i].used = true;
+            workers[i].current = 0;
+            nr_workers++;
+            if (nr_workers > peak_workers) {
+                peak_workers = nr_workers;
+            }
+            return &workers[i];
+        }
+    }
+    return 0;
+}
+
+static void worker_spawn(worker_t* worker) {
+    char name[PROCESS_NAME_LEN];
+    char id[8];
+    
+    strcpy(name, "kworker/");
+    utoa((u32)(worker - workers), id, 10);
+    strcat(name, id);
+    
+    if (!kthread_run(worker_thread, worker, name)) {
+        u32 flags = spin_lock_irqsave(&wq_lock);
+        worker->used = false;
+        nr_workers--;
+        spin_unlock_irqrestore(&wq_lock, flags);
+    }
+}
+
+static void worker_thread(void* data) {
+    worker_t* worker = (worker_t*)data;
+    worker->task = process_get_current();
+    
+    u32 flags = spin_lock_irqsave(&wq_lock);
+    while (1) {
+        if (!wq_head) {
+            nr_idle++;
+            spin_unlock_irqrestore(&wq_lock, flags);
+            bool busy = wait_event_timeout(worker_wait, wq_head != 0, WQ_IDLE_TIMEOUT_NS);
+            flags = spin_lock_irqsave(&wq_lock);
+            nr_idle--;
+            
+            // Shrink the pool once load has gone away
+            if (!busy && !wq_head && nr_workers > WQ_MIN_WORKERS) {
+                break;
+            }
+            continue;
+        }
+        
+        work_t* work = wq_head;
+        wq_head = work->next;
+        if (!wq_head) {
+            wq_tail = 0;
+        }
+        nr_queued--;
+        work->flags &= ~WORK_PENDING;
+        worker->current = work;
+        
+        // More work behind this item and nobody left to take it: grow
+        worker_t* spare = wq_head && nr_idle == 0 ? worker_reserve() : 0;
+        spin_unlock_irqrestore(&wq_lock, flags);
+        
+        if (spare) {
+            worker_spawn(spare);
+        }
+        work->func(work);
+        
+        flags = spin_lock_irqsave(&wq_lock);
+        worker->current = 0;
+        nr_executed++;
+        spin_unlock_irqrestore(&wq_lock, flags);
+        
+        wake_up(&flush_wait);
+        flags = spin_lock_irqsave(&wq_lock);
+    }
+    
+    worker->used = false;
+    worker->task = 0;
+    nr_workers--;
+    spin_unlock_irqrestore(&wq_lock, flags);
+}
+
+void workqueue_init(void) {
+    memset(workers, 0, sizeof(workers));
+    wq_ready = true;
+    
+    for (u32 i = 0; i < WQ_MIN_WORKERS; i++) {
+        u32 flags = spin_lock_irqsave(&wq_lock);
+        worker_t* worker = worker_reserve();
+        spin_unlock_irqrestore(&wq_lock, flags);
+        if (worker) {
+            worker_spawn(worker);
+        }
+    }
+}
+
+void work_init(work_t* work, work_func_t func) {
+    work->next = 0;
+    work->func = func;
+    work->flags = 0;
+}
+
+static void delayed_work_timer(u32 data) {
+    work_t* work = &((delayed_work_t*)data)->work;
+    
+    u32 flags = spin_lock_irqsave(&wq_lock);
+    work->flags &= ~WORK_PENDING;
+    spin_unlock_irqrestore(&wq_lock, flags);
+    
+    queue_work(work);
+}
+
+void delayed_work_init(delayed_work_t* dwork, work_func_t func) {
+    work_init(&dwork->work, func);
+    timer_setup(&dwork->timer, delayed_work_timer, (u32)dwork);
+}
+
+// Safe from any context. Returns false if the item is already pending.
+// Work queued before workqueue_init() runs once the first worker starts.
+// Creating a thread can sleep, so from interrupt or non-preemptible context
+// the item only waits for a worker, and the next worker to pick up an item
+// with nobody idle behind it grows the pool instead.
+bool queue_work(work_t* work) {
+    bool atomic = in_interrupt() || preempt_count();
+    u32 flags = spin_lock_irqsave(&wq_lock);
+    
+    if (work->flags & WORK_PENDING) {
+        spin_unlock_irqrestore(&wq_lock, flags);
+        return false;
+    }
+    
+    work->flags |= WORK_PENDING;
+    work->next = 0;
+    if (wq_tail) {
+        wq_tail->next = work;
+    } else {
+        wq_head = work;
+    }
+    wq_tail = work;
+    nr_queued++;
+    
+    worker_t* spare = nr_idle == 0 && !atomic ? worker_reserve() : 0;
+    spin_unlock_irqrestore(&wq_lock, flags);
+    
+    if (spare) {
+        worker_spawn(spare);
+    } else {
+        wake_up_one(&worker_wait);
+    }
+    return true;
+}
+
+// The item counts as pending while its timer runs
+bool queue_delayed_work(delayed_work_t* dwork, u64 delay_ns) {
+    u32 flags = spin_lock_irqsave(&wq_lock);
+    
+    if (dwork->work.flags & WORK_PENDING) {
+        spin_unlock_irqrestore(&wq_lock, flags);
+        return false;
+    }
+    dwork->work.flags |= WORK_PENDING;
+    spin_unlock_irqrestore(&wq_lock, flags);
+    
+    timer_add(&dwork->timer, delay_ns);
+    return true;
+}
+
+// Returns true if the timer was stopped before the work was queued
+bool cancel_delayed_work(delayed_work_t* dwork) {
+    if (!timer_del(&dwork->timer)) {
+        return false;
+    }
+    
+    u32 flags = spin_lock_irqsave(&wq_lock);
+    dwork->work.flags &= ~WORK_PENDING;
+    spin_unlock_irqrestore(&wq_lock, flags);
+    return true;
+}
+
+static bool work_busy(work_t* work) {
+    u32 flags = spin_lock_irqsave(&wq_lock);
+    bool busy = (work->flags & WORK_PENDING) != 0;
+    
+    for (u32 i = 0; i < WQ_MAX_WORKERS && !busy; i++) {
+        busy = workers[i].used && workers[i].current == work;
+    }
+    spin_unlock_irqrestore(&wq_lock, flags);
+    return busy;
+}
+
+// Wait until the item is neither queued nor running
+void flush_work(work_t* work) {
+    wait_event(flush_wait, !work_busy(work));
+}
+
+// Run a delayed item now instead of at its deadline, then wait for it
+void flush_delayed_work(delayed_work_t* dwork) {
+    if (cancel_delayed_work(dwork)) {
+        queue_work(&dwork->work);
+    }
+    flush_work(&dwork->work);
+}
+
+static bool workqueue_idle(void) {
+    u32 flags = spin_lock_irqsave(&wq_lock);
+    bool idle = nr_queued == 0;
+    
+    for (u32 i = 0; i < WQ_MAX_WORKERS && idle; i++) {
+        idle = !workers[i].used || !workers[i].current;
+    }
+    spin_unlock_irqrestore(&wq_lock, flags);
+    return idle;
+}
+
+// Wait until every item queued so far has run. Delayed items still on
+// their timers are not waited for.
+void flush_workqueue(void) {
+    wait_event(flush_wait, workqueue_idle());
+}
+
+void workqueue_stats(workqueue_stats_t* stats) {
+    u32 flags = spin_lock_irqsave(&wq_lock);
+    stats->workers = nr_workers;
+    stats->idle = nr_idle;
+    stats->queued = nr_queued;
+    stats->executed = nr_executed;
+    stats->peak_workers = peak_workers;
+    spin_unlock_irqrestore(&wq_lock, flags);
+}
+
+static void wq_print_field(const char* label, u32 value) {
+    char buf[16];
+    vga_writestring(label);
+    utoa(value, buf, 10);
+    vga_writestring(buf);
+    vga_writestring("\n");
+}
+
+void workqueue_print_info(void) {
+    workqueue_stats_t stats;
+    workqueue_stats(&stats);
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\nWorkqueue:\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    wq_print_field("  Workers:   ", stats.workers);
+    wq_print_field("  Idle:      ", stats.idle);
+    wq_print_field("  Peak:      ", stats.peak_workers);
+    wq_print_field("  Queued:    ", stats.queued);
+    wq_print_field("  Executed:  ", stats.executed);
+    vga_writestring("\n");
+}
@@ -0,0 +1,53 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <kernel/kernel.h>
+#include "timer.h"
+
+// Worker pool bounds. A worker is added when work is queued or picked up and
+// none is idle; one that stays idle for WQ_IDLE_TIMEOUT_NS exits, down to the
+// minimum.
+#define WQ_MIN_WORKERS      1
+#define WQ_MAX_WORKERS      8
+#define WQ_IDLE_TIMEOUT_NS  (5ULL * NSEC_PER_SEC)
+
+#define WORK_PENDING        0x1
+
+struct work;
+typedef void (*work_func_t)(struct work* work);
+
+// Deferred function call run in process context by a worker thread. The
+// item may be freed or requeued by its own function.
+typedef struct work {
+    struct work* next;
+    work_func_t func;
+    volatile u32 flags;
+} work_t;
+
+typedef struct {
+    work_t work;
+    ktimer_t timer;
+} delayed_work_t;
+
+typedef struct {
+    u32 workers;
+    u32 idle;
+    u32 queued;
+    u32 executed;
+    u32 peak_workers;
+} workqueue_stats_t;
+
+// Workqueue functions
+void workqueue_init(void);
+void work_init(work_t* work, work_func_t func);
+void delayed_work_init(delayed_work_t* dwork, work_func_t func);
+bool queue_work(work_t* work);
+bool queue_delayed_work(delayed_work_t* dwork, u64 delay_ns);
+bool cancel_delayed_work(delayed_work_t* dwork);
+void flush_work(work_t* work);
+void flush_delayed_work(delayed_work_t* dwork);
+void flush_workqueue(void);
+void workqueue_stats(workqueue_stats_t* stats);
+void workqueue_print_info(void);
+
+#endif // WORKQUEUE_H
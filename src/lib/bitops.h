@@ -0,0 +1,29 @@
+#ifndef BITOPS_H
+#define BITOPS_H
+
+#include <stdint.h>
+
+// Index of the most significant set bit plus one, 0 when x is 0
+static inline uint32_t fls(uint32_t x) {
+    uint32_t r;
+    
+    if (!x) {
+        return 0;
+    }
+    __asm__("bsrl %1, %0" : "=r"(r) : "rm"(x));
+    return r + 1;
+}
+
+// Index of the least significant set bit, undefined when x is 0
+static inline uint32_t __ffs(uint32_t x) {
+    uint32_t r;
+    __asm__("bsfl %1, %0" : "=r"(r) : "rm"(x));
+    return r;
+}
+
+// floor(log2(x)), undefined when x is 0
+static inline uint32_t ilog2(uint32_t x) {
+    return fls(x) - 1;
+}
+
+#endif // BITOPS_H
@@ -0,0 +1,43 @@
+#ifndef DIV64_H
+#define DIV64_H
+
+#include <stdint.h>
+
+// 64-by-32 division without libgcc's __udivdi3: two chained divl
+static inline uint64_t div_u64_rem(uint64_t dividend, uint32_t divisor, uint32_t* remainder) {
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t low = (uint32_t)dividend;
+    uint32_t quot_high = 0;
+    uint32_t quot_low;
+    uint32_t rem;
+    
+    if (high >= divisor) {
+        quot_high = high / divisor;
+        high %= divisor;
+    }
+    
+    __asm__("divl %4" : "=a"(quot_low), "=d"(rem) : "a"(low), "d"(high), "rm"(divisor));
+    
+    if (remainder) {
+        *remainder = rem;
+    }
+    return ((uint64_t)quot_high << 32) | quot_low;
+}
+
+static inline uint64_t div_u64(uint64_t dividend, uint32_t divisor) {
+    return div_u64_rem(dividend, divisor, 0);
+}
+
+// (a * mul) >> shift with a 96-bit intermediate, shift must be at most 32
+static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift) {
+    uint32_t high = (uint32_t)(a >> 32);
+    uint32_t low = (uint32_t)a;
+    uint64_t ret = ((uint64_t)low * mul) >> shift;
+    
+    if (high) {
+        ret += ((uint64_t)high * mul) << (32 - shift);
+    }
+    return ret;
+}
+
+#endif // DIV64_H
@@ -1,4 +1,5 @@
 #include "string.h"
+#include "div64.h"
 
 size_t strlen(const char* str) {
     size_t len = 0;
@@ -173,3 +174,30 @@ char* utoa(unsigned int value, char* str, int base) {
     return str;
 }
 
+char* u64toa(uint64_t value, char* str, int base) {
+    char* ptr = str;
+    char* ptr1 = str;
+    char tmp_char;
+    uint32_t digit;
+    
+    if (base < 2 || base > 36) {
+        *str = '\0';
+        return str;
+    }
+    
+    do {
+        value = div_u64_rem(value, base, &digit);
+        *ptr++ = "0123456789abcdefghijklmnopqrstuvwxyz"[digit];
+    } while (value);
+    
+    *ptr-- = '\0';
+    
+    while (ptr1 < ptr) {
+        tmp_char = *ptr;
+        *ptr-- = *ptr1;
+        *ptr1++ = tmp_char;
+    }
+    
+    return str;
+}
+
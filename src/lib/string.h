@@ -22,5 +22,6 @@ int memcmp(const void* ptr1, const void* ptr2, size_t num);
 int atoi(const char* str);
 char* itoa(int value, char* str, int base);
 char* utoa(unsigned int value, char* str, int base);
+char* u64toa(uint64_t value, char* str, int base);
 
 #endif // STRING_H
@@ -1,6 +1,10 @@
 #include <kernel/memory.h>
+#include <kernel/spinlock.h>
+#include "../arch/x86/smp.h"
 #include "../lib/string.h"
 #include "../drivers/vga.h"
+#include "../trace/tracepoint.h"
+#include "../trace/boottime.h"
 
 static u32 total_frames;
 static u32* frame_bitmap;
@@ -13,6 +17,20 @@ static heap_block_t* heap_start = 0;
 static u32 heap_end;
 static u32 placement_address = 0;
 
+// Application processors share the frame bitmap and the heap list
+static spinlock_t frame_lock = SPINLOCK_INIT;
+static spinlock_t heap_lock = SPINLOCK_INIT;
+
+// Page tables are addressed through the identity-mapped low 4 MiB, but the
+// heap takes every free frame there once memory_init() has carved it. Tables
+// created after that come from a pool reserved just before.
+#define PT_POOL_FRAMES 64
+static u32 pt_pool_next = 0;
+static u32 pt_pool_end = 0;
+
+// Pages paging_unmap_user() takes down per TLB shootdown
+#define UNMAP_BATCH 16
+
 #define HEAP_MAGIC 0xDEADBEEF
 #define HEAP_MIN_BLOCK_SIZE 16
 
@@ -63,22 +81,37 @@ static u32 first_free_frame(void) {
     return (u32)-1;
 }
 
-u32 pmm_alloc_frame(void) {
+// Returns 0 when memory is exhausted; frame 0 is never free
+u32 pmm_try_alloc_frame(void) {
+    u32 flags = spin_lock_irqsave(&frame_lock);
     u32 frame = first_free_frame();
     if (frame == (u32)-1) {
-        kernel_panic("Out of physical memory!");
+        spin_unlock_irqrestore(&frame_lock, flags);
         return 0;
     }
     set_frame(frame * PAGE_SIZE);
+    spin_unlock_irqrestore(&frame_lock, flags);
+    TRACE_EVENT(page_alloc, frame * PAGE_SIZE, 0);
     return frame * PAGE_SIZE;
 }
 
+u32 pmm_alloc_frame(void) {
+    u32 frame = pmm_try_alloc_frame();
+    if (!frame) {
+        kernel_panic("Out of physical memory!");
+    }
+    return frame;
+}
+
 void pmm_free_frame(u32 frame_addr) {
+    TRACE_EVENT(page_free, frame_addr, 0);
+    u32 flags = spin_lock_irqsave(&frame_lock);
     clear_frame(frame_addr);
     u32 frame = frame_addr / PAGE_SIZE;
     if (frame < next_free_frame) {
         next_free_frame = frame;
     }
+    spin_unlock_irqrestore(&frame_lock, flags);
 }
 
 
@@ -97,6 +130,26 @@ static u32 kmalloc_early(u32 size, bool align, u32* phys) {
     return tmp;
 }
 
+static u32 alloc_page_table(u32* phys) {
+    if (!pt_pool_end) {
+        return kmalloc_early(sizeof(page_table_t), true, phys);
+    }
+    
+    u32 flags = spin_lock_irqsave(&frame_lock);
+    if (pt_pool_next >= pt_pool_end) {
+        spin_unlock_irqrestore(&frame_lock, flags);
+        kernel_panic("Out of page table frames!");
+        *phys = 0;
+        return 0;
+    }
+    u32 table = pt_pool_next;
+    pt_pool_next += PAGE_SIZE;
+    spin_unlock_irqrestore(&frame_lock, flags);
+    
+    *phys = table;
+    return table;
+}
+
 page_t* paging_get_page(u32 address, bool make, page_directory_t* dir) {
     address /= PAGE_SIZE;
     u32 table_idx = address / 1024;
@@ -105,7 +158,7 @@ page_t* paging_get_page(u32 address, bool make, page_directory_t* dir) {
         return &dir->tables[table_idx]->pages[address % 1024];
     } else if (make) {
         u32 phys;
-        dir->tables[table_idx] = (page_table_t*)kmalloc_early(sizeof(page_table_t), true, &phys);
+        dir->tables[table_idx] = (page_table_t*)alloc_page_table(&phys);
         memset(dir->tables[table_idx], 0, sizeof(page_table_t));
         dir->tablesPhysical[table_idx] = phys | PAGE_PRESENT | PAGE_WRITE;
         return &dir->tables[table_idx]->pages[address % 1024];
@@ -128,6 +181,93 @@ void paging_unmap_page(page_t* page) {
     }
 }
 
+// Identity-map a physical range (ACPI tables, MMIO registers) into the
+// kernel directory. Frames outside RAM are not tracked by the bitmap.
+void* paging_map_physical(u32 phys_addr, u32 size, bool uncached) {
+    u32 start = PAGE_ALIGN_DOWN(phys_addr);
+    u32 end = PAGE_ALIGN_UP(phys_addr + size);
+    
+    for (u32 addr = start; addr < end; addr += PAGE_SIZE) {
+        page_t* page = paging_get_page(addr, true, kernel_directory);
+        if (!page->present) {
+            paging_map_page(page, addr, true, true);
+            if (uncached) {
+                *(u32*)page |= PAGE_NOCACHE | PAGE_WRITETHROUGH;
+            }
+            __asm__ volatile("invlpg (%0)" :: "r"(addr) : "memory");
+        }
+    }
+    
+    return (void*)phys_addr;
+}
+
+// Map one existing frame at a user address in the given directory
+void paging_map_user_frame(u32 vaddr, u32 phys, bool writeable, page_directory_t* dir) {
+    page_t* page = paging_get_page(vaddr, true, dir);
+    paging_map_page(page, phys, false, writeable);
+    
+    // The directory entry must allow ring 3 as well as the table entry
+    dir->tablesPhysical[vaddr / PAGE_SIZE / 1024] |= PAGE_USER;
+    __asm__ volatile("invlpg (%0)" :: "r"(vaddr) : "memory");
+}
+
+// Back a user range with fresh zeroed frames in the given directory.
+// Returns 0, with nothing left mapped, if memory runs out.
+void* paging_map_user(u32 vaddr, u32 size, bool writeable, page_directory_t* dir) {
+    u32 start = PAGE_ALIGN_DOWN(vaddr);
+    u32 end = PAGE_ALIGN_UP(vaddr + size);
+    
+    for (u32 addr = start; addr < end; addr += PAGE_SIZE) {
+        page_t* page = paging_get_page(addr, false, dir);
+        if (!page || !page->present) {
+            u32 frame = pmm_try_alloc_frame();
+            if (!frame) {
+                paging_unmap_user(start, addr - start, dir);
+                return 0;
+            }
+            paging_map_user_frame(addr, frame, true, dir);
+            page = paging_get_page(addr, false, dir);
+        }
+        
+        // Clear through the writable mapping, then apply the requested access
+        page->rw = 1;
+        __asm__ volatile("invlpg (%0)" :: "r"(addr) : "memory");
+        memset((void*)addr, 0, PAGE_SIZE);
+        page->rw = writeable ? 1 : 0;
+        __asm__ volatile("invlpg (%0)" :: "r"(addr) : "memory");
+    }
+    
+    return (void*)vaddr;
+}
+
+// Frames go back to the allocator only once no CPU can still reach them
+// through a stale TLB entry (see smp_flush_tlb_range() for the locking rule)
+void paging_unmap_user(u32 vaddr, u32 size, page_directory_t* dir) {
+    u32 start = PAGE_ALIGN_DOWN(vaddr);
+    u32 end = PAGE_ALIGN_UP(vaddr + size);
+    
+    while (start < end) {
+        u32 frames[UNMAP_BATCH];
+        u32 count = 0;
+        u32 addr = start;
+    
+        for (; addr < end && count < UNMAP_BATCH; addr += PAGE_SIZE) {
+            page_t* page = paging_get_page(addr, false, dir);
+            if (page && page->present) {
+                frames[count++] = page->frame * PAGE_SIZE;
+                page->present = 0;
+                __asm__ volatile("invlpg (%0)" :: "r"(addr) : "memory");
+            }
+        }
+    
+        smp_flush_tlb_range(dir, start, addr);
+        for (u32 i = 0; i < count; i++) {
+            pmm_free_frame(frames[i]);
+        }
+        start = addr;
+    }
+}
+
 void paging_switch_directory(page_directory_t* dir) {
     current_directory = dir;
     __asm__ volatile("mov %0, %%cr3" :: "r"(dir->physicalAddr));
@@ -179,6 +319,19 @@ void memory_init(u32 mem_size) {
     
 
     paging_init();
+    boottime_mark("paging_init");
+    
+    // Reserve the table pool, then mark everything placed so far (the
+    // directory, the identity tables and the pool) before the heap takes
+    // its frames
+    pt_pool_next = kmalloc_early(PT_POOL_FRAMES * PAGE_SIZE, true, 0);
+    if (placement_address > 0x400000) {
+        kernel_panic("Early allocations exceed the identity mapping!");
+    }
+    for (u32 i = 0; i < placement_address; i += PAGE_SIZE) {
+        set_frame(i);
+    }
+    pt_pool_end = pt_pool_next + PT_POOL_FRAMES * PAGE_SIZE;
     
 
     heap_start = (heap_block_t*)KERNEL_HEAP_START;
@@ -210,7 +363,7 @@ void* kmalloc(u32 size) {
     }
     size = (size + 3) & ~3;
     
-
+    u32 flags = spin_lock_irqsave(&heap_lock);
     heap_block_t* current = heap_start;
     while (current) {
 
@@ -237,6 +390,7 @@ void* kmalloc(u32 size) {
             }
             
             current->used = true;
+            spin_unlock_irqrestore(&heap_lock, flags);
             return (void*)((u32)current + sizeof(heap_block_t));
         }
         
@@ -277,7 +431,7 @@ void kfree(void* ptr) {
     }
     
     heap_block_t* block = (heap_block_t*)((u32)ptr - sizeof(heap_block_t));
-    
+    u32 flags = spin_lock_irqsave(&heap_lock);
 
     if (block->magic != HEAP_MAGIC) {
         kernel_panic("Invalid free: corrupted block!");
@@ -308,6 +462,8 @@ void kfree(void* ptr) {
             block->next->prev = block->prev;
         }
     }
+    
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
 
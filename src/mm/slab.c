@@ -0,0 +1,203 @@
+#include <kernel/slab.h>
+#include <kernel/kernel.h>
+#include <kernel/memory.h>
+#include "../lib/string.h"
+#include "../drivers/vga.h"
+
+#define KMEM_SLAB_SIZE (KMEM_SLAB_PAGES * PAGE_SIZE)
+
+// Lives at the start of its heap block; objects follow at the first aligned
+// offset, each with a trailing pointer back to this header
+typedef struct kmem_slab {
+    struct kmem_slab* next;
+    struct kmem_slab* prev;
+    kmem_cache_t* cache;
+    void* freelist;
+    u32 inuse;
+} kmem_slab_t;
+
+static kmem_cache_t* cache_chain = 0;
+
+static inline u32 align_up(u32 value, u32 align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static inline kmem_slab_t** slab_backptr(kmem_cache_t* cache, void* obj) {
+    return (kmem_slab_t**)((u32)obj + align_up(cache->object_size, 4));
+}
+
+static void slab_list_add(kmem_slab_t** list, kmem_slab_t* slab) {
+    slab->prev = 0;
+    slab->next = *list;
+    if (*list) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+static void slab_list_del(kmem_slab_t** list, kmem_slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = 0;
+    slab->prev = 0;
+}
+
+// align must be a power of two
+kmem_cache_t* kmem_cache_create(const char* name, u32 size, u32 align) {
+    if (align < 4) {
+        align = 4;
+    }
+    
+    kmem_cache_t* cache = (kmem_cache_t*)kmalloc(sizeof(kmem_cache_t));
+    memset(cache, 0, sizeof(kmem_cache_t));
+    spin_lock_init(&cache->lock);
+    cache->name = name;
+    cache->object_size = size;
+    cache->align = align;
+    cache->stride = align_up(align_up(size, 4) + sizeof(kmem_slab_t*), align);
+    
+    // The heap only guarantees 4-byte alignment, so reserve room to align up
+    u32 usable = KMEM_SLAB_SIZE - sizeof(kmem_slab_t) - (align - 4);
+    cache->objs_per_slab = usable / cache->stride;
+    if (cache->objs_per_slab == 0) {
+        kernel_panic("kmem_cache_create: object larger than a slab");
+    }
+    
+    cache->next = cache_chain;
+    cache_chain = cache;
+    return cache;
+}
+
+static kmem_slab_t* slab_grow(kmem_cache_t* cache) {
+    kmem_slab_t* slab = (kmem_slab_t*)kmalloc(KMEM_SLAB_SIZE);
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->freelist = 0;
+    
+    // Thread the free list through the objects, lowest address first
+    u32 base = align_up((u32)slab + sizeof(kmem_slab_t), cache->align);
+    for (u32 i = cache->objs_per_slab; i-- > 0;) {
+        void* obj = (void*)(base + i * cache->stride);
+        *slab_backptr(cache, obj) = slab;
+        *(void**)obj = slab->freelist;
+        slab->freelist = obj;
+    }
+    
+    cache->slabs++;
+    cache->total_objs += cache->objs_per_slab;
+    return slab;
+}
+
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    u32 flags = spin_lock_irqsave(&cache->lock);
+    kmem_slab_t* slab = cache->partial;
+    
+    if (!slab) {
+        slab = cache->empty;
+        if (slab) {
+            slab_list_del(&cache->empty, slab);
+        } else {
+            slab = slab_grow(cache);
+        }
+        slab_list_add(&cache->partial, slab);
+    }
+    
+    void* obj = slab->freelist;
+    slab->freelist = *(void**)obj;
+    slab->inuse++;
+    cache->active_objs++;
+    
+    if (slab->inuse == cache->objs_per_slab) {
+        slab_list_del(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return obj;
+}
+
+// Return every empty slab but the newest to the heap, cache lock held
+static void slab_shrink(kmem_cache_t* cache) {
+    kmem_slab_t* slab = cache->empty ? cache->empty->next : 0;
+    
+    while (slab) {
+        kmem_slab_t* next = slab->next;
+        slab_list_del(&cache->empty, slab);
+        cache->slabs--;
+        cache->total_objs -= cache->objs_per_slab;
+        kfree(slab);
+        slab = next;
+    }
+}
+
+void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+    if (!obj) {
+        return;
+    }
+    
+    kmem_slab_t* slab = *slab_backptr(cache, obj);
+    if (slab->cache != cache) {
+        kernel_panic("kmem_cache_free: object from another cache");
+    }
+    
+    u32 flags = spin_lock_irqsave(&cache->lock);
+    if (slab->inuse == cache->objs_per_slab) {
+        slab_list_del(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+    
+    *(void**)obj = slab->freelist;
+    slab->freelist = obj;
+    slab->inuse--;
+    cache->active_objs--;
+    
+    // Keep one empty slab around to absorb alloc/free churn
+    if (slab->inuse == 0) {
+        slab_list_del(&cache->partial, slab);
+        slab_list_add(&cache->empty, slab);
+        if (slab->next) {
+            slab_shrink(cache);
+        }
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+void kmem_cache_shrink(kmem_cache_t* cache) {
+    u32 flags = spin_lock_irqsave(&cache->lock);
+    slab_shrink(cache);
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+static void slab_print_column(u32 value, u32 width) {
+    char buf[16];
+    utoa(value, buf, 10);
+    for (u32 pad = strlen(buf); pad < width; pad++) {
+        vga_putchar(' ');
+    }
+    vga_writestring(buf);
+}
+
+void slab_print_info(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\nCache            Size  Active   Total  PerSlab  Slabs\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    
+    for (kmem_cache_t* cache = cache_chain; cache; cache = cache->next) {
+        vga_writestring(cache->name);
+        for (u32 pad = strlen(cache->name); pad < 14; pad++) {
+            vga_putchar(' ');
+        }
+        slab_print_column(cache->object_size, 6);
+        slab_print_column(cache->active_objs, 8);
+        slab_print_column(cache->total_objs, 8);
+        slab_print_column(cache->objs_per_slab, 9);
+        slab_print_column(cache->slabs, 7);
+        vga_writestring("\n");
+    }
+    vga_writestring("\n");
+}
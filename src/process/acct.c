@@ -0,0 +1,176 @@
+#include "acct.h"
+#include <kernel/kernel.h>
+#include <kernel/interrupts.h>
+#include "process.h"
+#include "../kernel/time.h"
+#include "../drivers/vga.h"
+#include "../drivers/keyboard.h"
+#include "../lib/string.h"
+#include "../lib/div64.h"
+
+// Consecutive snapshots and the CPU time each task used in between. top only
+// runs from the shell, so one static set is enough and keeps it off the stack.
+static process_info_t top_prev[TOP_MAX_TASKS];
+static process_info_t top_curr[TOP_MAX_TASKS];
+static u64 top_delta[TOP_MAX_TASKS];
+static u32 top_order[TOP_MAX_TASKS];
+
+static u64 cycles_to_us(u64 cycles) {
+    u32 khz = time_tsc_khz();
+    return khz ? div_u64(cycles * 1000, khz) : 0;
+}
+
+static const process_info_t* top_find_prev(const process_info_t* info, u32 nr_prev) {
+    for (u32 i = 0; i < nr_prev; i++) {
+        if (top_prev[i].key == info->key && top_prev[i].pid == info->pid) {
+            return &top_prev[i];
+        }
+    }
+    return 0;
+}
+
+// Fill top_delta with each task's CPU time since the last snapshot, in us,
+// and top_order with the task indices busiest first
+static void top_compute(u32 nr_prev, u32 nr) {
+    for (u32 i = 0; i < nr; i++) {
+        const process_info_t* info = &top_curr[i];
+        const process_info_t* old = top_find_prev(info, nr_prev);
+        u64 total = info->acct.utime + info->acct.stime;
+        u64 before = old ? old->acct.utime + old->acct.stime : 0;
+    
+        top_delta[i] = total > before ? cycles_to_us(total - before) : 0;
+    
+        u32 pos = i;
+        while (pos > 0 && top_delta[top_order[pos - 1]] < top_delta[i]) {
+            top_order[pos] = top_order[pos - 1];
+            pos--;
+        }
+        top_order[pos] = i;
+    }
+}
+
+static void top_column(u64 value, u32 width) {
+    char buf[24];
+    u64toa(value, buf, 10);
+    for (u32 pad = strlen(buf); pad < width; pad++) {
+        vga_putchar(' ');
+    }
+    vga_writestring(buf);
+}
+
+// Tenths of a percent as "xx.x"
+static void top_percent(u64 part_us, u64 whole_us, u32 width) {
+    u32 tenths = whole_us ? (u32)div_u64(part_us * 1000, (u32)whole_us) : 0;
+    char buf[16];
+    
+    utoa(tenths / 10, buf, 10);
+    u32 len = strlen(buf);
+    buf[len++] = '.';
+    buf[len++] = (char)('0' + tenths % 10);
+    buf[len] = '\0';
+    
+    for (u32 pad = len; pad < width; pad++) {
+        vga_putchar(' ');
+    }
+    vga_writestring(buf);
+}
+
+static char top_state(const process_info_t* info) {
+    switch (info->state) {
+        case PROCESS_STATE_RUNNING:
+        case PROCESS_STATE_READY:
+            return 'R';
+        case PROCESS_STATE_BLOCKED:
+            return 'S';
+        default:
+            return 'Z';
+    }
+}
+
+static void top_print(u32 nr, u32 seconds, u64 interval_us) {
+    u64 idle_us = 0;
+    u32 cpus = 0;
+    
+    for (u32 i = 0; i < nr; i++) {
+        if (top_curr[i].idle) {
+            idle_us += top_delta[i];
+            cpus++;
+        }
+    }
+    u64 capacity_us = interval_us * (cpus ? cpus : 1);
+    
+    vga_clear();
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("top - every ");
+    top_column(seconds, 0);
+    vga_writestring(" s, any key exits\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_writestring("Tasks:");
+    top_column(nr - cpus, 4);
+    vga_writestring("   CPUs:");
+    top_column(cpus, 3);
+    vga_writestring("   Busy:");
+    top_percent(capacity_us > idle_us ? capacity_us - idle_us : 0, capacity_us, 6);
+    vga_writestring("%   Uptime:");
+    top_column(div_u64(time_ns(), NSEC_PER_SEC), 7);
+    vga_writestring(" s\n\n");
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("  PID NAME         S CPU PRI  %CPU  USER ms   SYS ms   VCSW  IVCSW SYSCALL  RSS\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    
+    for (u32 row = 0; row < nr && row < TOP_ROWS; row++) {
+        const process_info_t* info = &top_curr[top_order[row]];
+    
+        top_column(info->pid, 5);
+        vga_putchar(' ');
+        vga_writestring(info->name[0] ? info->name : "-");
+        for (u32 pad = info->name[0] ? strlen(info->name) : 1; pad < 12; pad++) {
+            vga_putchar(' ');
+        }
+        vga_putchar(' ');
+        vga_putchar(top_state(info));
+        top_column(info->cpu, 4);
+        if (info->deadline) {
+            vga_writestring("  DL");
+        } else {
+            top_column(info->prio, 4);
+        }
+        top_percent(top_delta[top_order[row]], interval_us, 6);
+        top_column(div_u64(cycles_to_us(info->acct.utime), 1000), 9);
+        top_column(div_u64(cycles_to_us(info->acct.stime), 1000), 9);
+        top_column(info->acct.nvcsw, 7);
+        top_column(info->acct.nivcsw, 7);
+        top_column(info->acct.syscalls, 8);
+        top_column(info->acct.rss_pages * (PAGE_SIZE / 1024), 4);
+        vga_writestring("K\n");
+    }
+}
+
+// Redraw every few seconds until a key is pressed; the key is consumed.
+// %CPU is the share of one CPU over the last interval.
+void acct_top(u32 seconds) {
+    if (seconds == 0) {
+        seconds = 1;
+    } else if (seconds > TOP_MAX_SECONDS) {
+        seconds = TOP_MAX_SECONDS;
+    }
+    
+    u32 nr_prev = process_snapshot(top_prev, TOP_MAX_TASKS);
+    u64 prev_ns = time_ns();
+    
+    vga_writestring("top: first sample in progress, any key exits\n");
+    while (!keyboard_wait_timeout((u64)seconds * NSEC_PER_SEC)) {
+        u32 nr = process_snapshot(top_curr, TOP_MAX_TASKS);
+        u64 now = time_ns();
+    
+        top_compute(nr_prev, nr);
+        top_print(nr, seconds, div_u64(now - prev_ns, NSEC_PER_USEC));
+    
+        memcpy(top_prev, top_curr, nr * sizeof(process_info_t));
+        nr_prev = nr;
+        prev_ns = now;
+    }
+    keyboard_getchar();
+    vga_writestring("\n");
+}
@@ -0,0 +1,14 @@
+#ifndef ACCT_H
+#define ACCT_H
+
+#include "kernel.h"
+
+// top tracks at most TOP_MAX_TASKS tasks and lists the busiest TOP_ROWS
+#define TOP_MAX_TASKS   64
+#define TOP_ROWS        18
+#define TOP_MAX_SECONDS 60
+
+// Accounting report functions
+void acct_top(u32 seconds);
+
+#endif // ACCT_H
@@ -0,0 +1,99 @@
+#include "futex.h"
+#include <kernel/kernel.h>
+#include <kernel/memory.h>
+#include "process.h"
+#include "../interrupts/softirq.h"
+#include "../kernel/time.h"
+
+// One wait queue per bucket; waiters carry their key, so different futexes
+// hashing together only share the lock
+static wait_queue_head_t futex_queues[FUTEX_HASH_SIZE];
+
+void futex_init(void) {
+    for (u32 i = 0; i < FUTEX_HASH_SIZE; i++) {
+        wait_queue_init(&futex_queues[i]);
+    }
+}
+
+// Physical address of an aligned user word, 0 if it is not mapped. Page 0
+// is never a user page, so 0 cannot be a real key.
+static u32 futex_key(process_t* proc, u32 uaddr) {
+    if ((uaddr & 0x3) || !memory_validate_user_ptr((const void*)uaddr, sizeof(u32))) {
+        return 0;
+    }
+    
+    page_t* page = paging_get_page(uaddr, false, proc->page_directory);
+    if (!page || !page->present || !page->user) {
+        return 0;
+    }
+    return (page->frame << 12) | (uaddr & 0xFFF);
+}
+
+static wait_queue_head_t* futex_bucket(u32 key) {
+    return &futex_queues[((key >> 2) * 0x9E3779B1u) >> (32 - FUTEX_HASH_BITS)];
+}
+
+// Sleep while *uaddr == val. The waiter is queued before the word is read,
+// so a waker that changes the word and then calls futex_wake() either finds
+// it queued or is seen through the new value.
+s32 futex_wait(process_t* proc, u32 uaddr, u32 val, u64 timeout_ns) {
+    u32 key = futex_key(proc, uaddr);
+    if (!key || in_interrupt() || preempt_count()) {
+        return FUTEX_EFAULT;
+    }
+    
+    wait_queue_head_t* wq = futex_bucket(key);
+    wait_queue_entry_t wait;
+    wait_entry_init(&wait);
+    wait.key = key;
+    
+    prepare_to_wait(wq, &wait);
+    if (*(volatile u32*)uaddr != val) {
+        finish_wait(wq, &wait);
+        return FUTEX_EAGAIN;
+    }
+    
+    bool timed_out = false;
+    if (timeout_ns) {
+        timed_out = !schedule_timeout(timeout_ns);
+    } else {
+        process_schedule();
+    }
+    
+    // futex_wake() takes the entry off the queue; still queued means the
+    // timer or some other wakeup ended the sleep
+    bool queued = wait.queued;
+    finish_wait(wq, &wait);
+    
+    if (queued && timed_out) {
+        return FUTEX_ETIMEDOUT;
+    }
+    return 0;
+}
+
+// Wake up to nr tasks waiting on uaddr; returns how many
+s32 futex_wake(process_t* proc, u32 uaddr, u32 nr) {
+    u32 key = futex_key(proc, uaddr);
+    if (!key) {
+        return FUTEX_EFAULT;
+    }
+    if (!nr) {
+        return 0;
+    }
+    return (s32)wake_up_key(futex_bucket(key), key, nr);
+}
+
+// ebx = address of the word, ecx = FUTEX_OP(op, timeout_ms), edx = the
+// expected value for WAIT or the number of waiters to wake for WAKE
+s32 futex_syscall(u32 uaddr, u32 op, u32 val) {
+    process_t* proc = process_get_current();
+    
+    switch (op & FUTEX_OP_MASK) {
+        case FUTEX_WAIT:
+            return futex_wait(proc, uaddr, val, (u64)(op >> FUTEX_TIMEOUT_SHIFT) * NSEC_PER_MSEC);
+        case FUTEX_WAKE:
+            return futex_wake(proc, uaddr, val);
+        default:
+            return FUTEX_EFAULT;
+    }
+}
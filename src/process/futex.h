@@ -0,0 +1,33 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include "kernel.h"
+#include "wait.h"
+
+// Operations, in the low byte of ecx for SYS_FUTEX
+#define FUTEX_WAIT          0
+#define FUTEX_WAKE          1
+#define FUTEX_OP_MASK       0xFF
+
+// Only three argument registers are free, so a WAIT timeout in ms rides in
+// the upper 24 bits of the op; 0 waits forever
+#define FUTEX_TIMEOUT_SHIFT 8
+#define FUTEX_OP(op, timeout_ms) ((op) | ((timeout_ms) << FUTEX_TIMEOUT_SHIFT))
+
+// Error returns
+#define FUTEX_EFAULT        (-1)    // Bad address, op or context
+#define FUTEX_EAGAIN        (-2)    // Word no longer held the expected value
+#define FUTEX_ETIMEDOUT     (-3)
+
+// Waiters hash on the physical address of the word, so tasks mapping the
+// same page at different addresses still meet
+#define FUTEX_HASH_BITS     6
+#define FUTEX_HASH_SIZE     (1 << FUTEX_HASH_BITS)
+
+// Futex functions
+void futex_init(void);
+s32 futex_wait(struct process* proc, u32 uaddr, u32 val, u64 timeout_ns);
+s32 futex_wake(struct process* proc, u32 uaddr, u32 nr);
+s32 futex_syscall(u32 uaddr, u32 op, u32 val);
+
+#endif // FUTEX_H
@@ -0,0 +1,251 @@
+#include "ioring.h"
+#include <kernel/kernel.h>
+#include <kernel/memory.h>
+#include <kernel/spinlock.h>
+#include "process.h"
+#include "kthread.h"
+#include "syscall.h"
+#include "../lib/string.h"
+
+#define barrier() __asm__ volatile("" ::: "memory")
+
+static ioring_t iorings[IORING_MAX_RINGS];
+static spinlock_t ioring_lock = SPINLOCK_INIT;
+// Not part of the ring: the owner must be able to wake the poller after the
+// poller is free to release the ring
+static wait_queue_head_t ioring_detach_wait = WAIT_QUEUE_HEAD_INIT;
+
+static s32 ioring_execute(const ioring_sqe_t* sqe) {
+    switch (sqe->opcode) {
+        case IORING_OP_NOP:
+            return 0;
+        case IORING_OP_WRITE:
+            return sys_write((const char*)sqe->addr, sqe->len);
+        case IORING_OP_READ:
+            return sys_read((char*)sqe->addr, sqe->len);
+        default:
+            return -1;
+    }
+}
+
+// Consume up to to_submit entries and post one completion for each
+static u32 ioring_submit(ioring_t* ring, u32 to_submit) {
+    ioring_shared_t* shared = ring->shared;
+    u32 head = shared->sq_head;
+    u32 available = shared->sq_tail - head;
+    barrier();
+    
+    // A corrupt tail cannot make us walk more than one ring's worth
+    if (available > IORING_SQ_ENTRIES) {
+        available = IORING_SQ_ENTRIES;
+    }
+    if (available > to_submit) {
+        available = to_submit;
+    }
+    
+    u32 done = 0;
+    while (done < available) {
+        // Leave the rest queued until the process reaps completions
+        if (shared->cq_tail - shared->cq_head >= IORING_CQ_ENTRIES) {
+            break;
+        }
+        
+        // Copy first so user space cannot change the entry under us
+        ioring_sqe_t sqe = shared->sqes[(head + done) & IORING_SQ_MASK];
+        s32 result = ioring_execute(&sqe);
+        
+        ioring_cqe_t* cqe = &shared->cqes[shared->cq_tail & IORING_CQ_MASK];
+        cqe->user_data = sqe.user_data;
+        cqe->result = result;
+        barrier();
+        shared->cq_tail++;
+        done++;
+    }
+    
+    barrier();
+    shared->sq_head = head + done;
+    ring->submitted += done;
+    return done;
+}
+
+static void ioring_free_slot(ioring_t* ring) {
+    u32 flags = spin_lock_irqsave(&ioring_lock);
+    memset(ring, 0, sizeof(ioring_t));
+    spin_unlock_irqrestore(&ioring_lock, flags);
+}
+
+// Unmap the shared page and give the slot back
+static void ioring_release(ioring_t* ring, page_directory_t* dir) {
+    paging_unmap_user((u32)ring->shared, sizeof(ioring_shared_t), dir);
+    ioring_free_slot(ring);
+}
+
+// Mark the poller idle unless entries arrived since the last poll. The
+// process checks the flag after queueing, so either it sees NEED_WAKEUP or
+// we see its entries.
+static bool ioring_poller_sleep(ioring_t* ring) {
+    ioring_shared_t* shared = ring->shared;
+    
+    shared->flags |= IORING_SQ_NEED_WAKEUP;
+    __sync_synchronize();
+    if (shared->sq_tail != shared->sq_head) {
+        shared->flags &= ~IORING_SQ_NEED_WAKEUP;
+        ring->idle_polls = 0;
+        return false;
+    }
+    ring->poller_idle = true;
+    return true;
+}
+
+// SQPOLL: drain the ring every period and sleep after a quiet spell until
+// ioring_enter() wakes us. Running as a thread of our own keeps the user
+// pointers in the entries on the owner's address space and lets reads block.
+static void ioring_sq_thread(void* data) {
+    ioring_t* ring = (ioring_t*)data;
+    
+    while (!kthread_should_stop()) {
+        if (ioring_submit(ring, IORING_SQ_ENTRIES)) {
+            ring->idle_polls = 0;
+            wake_up(&ring->cq_wait);
+        } else if (++ring->idle_polls >= IORING_SQPOLL_IDLE && ioring_poller_sleep(ring)) {
+            wake_up(&ring->cq_wait);
+            wait_event(ring->sq_wait, !ring->poller_idle || kthread_should_stop());
+            ring->idle_polls = 0;
+            continue;
+        }
+        wait_event_timeout(ring->sq_wait, kthread_should_stop(), IORING_SQPOLL_PERIOD_NS);
+    }
+    
+    // The owner is done with the ring only once it has set detached
+    wait_event(ioring_detach_wait, ring->detached);
+    ioring_release(ring, process_get_current()->page_directory);
+}
+
+static void ioring_wakeup_poller(ioring_t* ring) {
+    ring->shared->flags &= ~IORING_SQ_NEED_WAKEUP;
+    ring->poller_idle = false;
+    wake_up(&ring->sq_wait);
+}
+
+static ioring_t* ioring_alloc(struct process* proc, u32* slot) {
+    ioring_t* ring = 0;
+    u32 flags = spin_lock_irqsave(&ioring_lock);
+    
+    for (u32 i = 0; i < IORING_MAX_RINGS; i++) {
+        if (!iorings[i].owner) {
+            ring = &iorings[i];
+            ring->owner = proc;
+            *slot = i;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&ioring_lock, flags);
+    return ring;
+}
+
+static bool ioring_start_poller(ioring_t* ring, u32 slot) {
+    char name[PROCESS_NAME_LEN] = "io_sq/";
+    utoa(slot, name + 6, 10);
+    
+    ring->poller = kthread_create(ioring_sq_thread, ring, name);
+    if (!ring->poller) {
+        return false;
+    }
+    ring->poller->page_directory = ring->owner->page_directory;
+    kthread_start(ring->poller);
+    return true;
+}
+
+// Returns the ring's slot, whose shared page is at IORING_RING_ADDR(slot),
+// or -1. User addresses this high are negative as an s32, hence the slot.
+s32 ioring_setup(struct process* proc, u32 flags) {
+    if (!proc || proc->ioring) {
+        return -1;
+    }
+    
+    u32 slot;
+    ioring_t* ring = ioring_alloc(proc, &slot);
+    if (!ring) {
+        return -1;
+    }
+    
+    u32 user_addr = IORING_RING_ADDR(slot);
+    ring->shared = (ioring_shared_t*)paging_map_user(user_addr, sizeof(ioring_shared_t), true, proc->page_directory);
+    if (!ring->shared) {
+        ioring_free_slot(ring);
+        return -1;
+    }
+    ring->shared->sq_entries = IORING_SQ_ENTRIES;
+    ring->shared->cq_entries = IORING_CQ_ENTRIES;
+    ring->setup_flags = flags & IORING_SETUP_SQPOLL;
+    ring->idle_polls = 0;
+    ring->enters = 0;
+    ring->submitted = 0;
+    wait_queue_init(&ring->sq_wait);
+    wait_queue_init(&ring->cq_wait);
+    
+    if ((ring->setup_flags & IORING_SETUP_SQPOLL) && !ioring_start_poller(ring, slot)) {
+        ioring_release(ring, proc->page_directory);
+        return -1;
+    }
+    
+    proc->acct.rss_pages += PAGE_ALIGN_UP(sizeof(ioring_shared_t)) / PAGE_SIZE;
+    proc->ioring = ring;
+    return (s32)slot;
+}
+
+// One ring transition for a whole batch; returns entries consumed or -1
+s32 ioring_enter(struct process* proc, u32 to_submit, u32 min_complete, u32 flags) {
+    ioring_t* ring = proc ? proc->ioring : 0;
+    if (!ring) {
+        return -1;
+    }
+    ring->enters++;
+    
+    u32 submitted = 0;
+    if (ring->setup_flags & IORING_SETUP_SQPOLL) {
+        if (flags & IORING_ENTER_SQ_WAKEUP) {
+            ioring_wakeup_poller(ring);
+        }
+    } else {
+        submitted = ioring_submit(ring, to_submit);
+    }
+    
+    if (min_complete > IORING_CQ_ENTRIES) {
+        min_complete = IORING_CQ_ENTRIES;
+    }
+    
+    // Only the poller can still be producing completions at this point; it
+    // wakes us after each batch and when it goes to sleep
+    if (ring->setup_flags & IORING_SETUP_SQPOLL) {
+        ioring_shared_t* shared = ring->shared;
+        wait_event(ring->cq_wait, shared->cq_tail - shared->cq_head >= min_complete ||
+                   ring->poller_idle);
+    }
+    
+    return (s32)submitted;
+}
+
+void ioring_destroy(struct process* proc) {
+    ioring_t* ring = proc->ioring;
+    if (!ring) {
+        return;
+    }
+    
+    proc->ioring = 0;
+    proc->acct.rss_pages -= PAGE_ALIGN_UP(sizeof(ioring_shared_t)) / PAGE_SIZE;
+    wake_up(&ring->cq_wait);
+    
+    if (!ring->poller) {
+        ioring_release(ring, proc->page_directory);
+        return;
+    }
+    
+    // We may be the exiting owner and cannot wait for the poller; it frees
+    // the ring once it has stopped and we have let go of it
+    kthread_request_stop(ring->poller);
+    wake_up(&ring->sq_wait);
+    __sync_synchronize();
+    ring->detached = true;
+    wake_up(&ioring_detach_wait);
+}
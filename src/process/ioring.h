@@ -0,0 +1,90 @@
+#ifndef IORING_H
+#define IORING_H
+
+#include "kernel.h"
+#include "wait.h"
+
+// Ring sizes, both powers of two; completions get twice the room
+#define IORING_SQ_ENTRIES   64
+#define IORING_CQ_ENTRIES   128
+#define IORING_SQ_MASK      (IORING_SQ_ENTRIES - 1)
+#define IORING_CQ_MASK      (IORING_CQ_ENTRIES - 1)
+
+// Each ring gets one page at IORING_USER_BASE + slot * PAGE_SIZE. Every task
+// still runs on the one kernel page directory, so that page, like the rest of
+// user memory, is visible to every task; slots keep rings apart, they do not
+// protect them from each other.
+#define IORING_MAX_RINGS    32
+#define IORING_USER_BASE    0xBFF00000
+#define IORING_RING_ADDR(slot) (IORING_USER_BASE + (slot) * PAGE_SIZE)
+
+// Setup flags
+#define IORING_SETUP_SQPOLL 0x1
+
+// Enter flags
+#define IORING_ENTER_SQ_WAKEUP 0x1
+
+// Shared flags, written by the kernel
+#define IORING_SQ_NEED_WAKEUP  0x1
+
+// SQ poller thread period and how many empty polls it makes before sleeping
+#define IORING_SQPOLL_PERIOD_NS NSEC_PER_MSEC
+#define IORING_SQPOLL_IDLE      100
+
+// Opcodes
+#define IORING_OP_NOP       0
+#define IORING_OP_WRITE     1
+#define IORING_OP_READ      2
+
+typedef struct {
+    u8  opcode;
+    u8  flags;
+    u16 reserved;
+    u32 addr;
+    u32 len;
+    u32 user_data;
+} ioring_sqe_t;
+
+typedef struct {
+    u32 user_data;
+    s32 result;
+} ioring_cqe_t;
+
+// Layout of the page shared with user space. The process owns sq_tail and
+// cq_head, the kernel owns sq_head and cq_tail; all four only ever grow.
+typedef struct {
+    volatile u32 sq_head;
+    volatile u32 sq_tail;
+    volatile u32 cq_head;
+    volatile u32 cq_tail;
+    volatile u32 flags;
+    u32 sq_entries;
+    u32 cq_entries;
+    u32 reserved;
+    ioring_sqe_t sqes[IORING_SQ_ENTRIES];
+    ioring_cqe_t cqes[IORING_CQ_ENTRIES];
+} ioring_shared_t;
+
+typedef struct ioring {
+    struct process* owner;
+    ioring_shared_t* shared;
+    u32 setup_flags;
+    
+    // SQPOLL kernel thread; it runs on the owner's address space and frees
+    // the ring once the owner has detached from it
+    struct process* poller;
+    u32 idle_polls;
+    volatile bool poller_idle;
+    volatile bool detached;
+    wait_queue_head_t sq_wait;      // Poller waiting for a period or a wakeup
+    wait_queue_head_t cq_wait;      // ioring_enter() waiting for completions
+    u32 enters;
+    u32 submitted;
+} ioring_t;
+
+// Ring functions
+s32 ioring_setup(struct process* proc, u32 flags);
+s32 ioring_enter(struct process* proc, u32 to_submit, u32 min_complete, u32 flags);
+void ioring_destroy(struct process* proc);
+
+#endif // IORING_H
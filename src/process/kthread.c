@@ -0,0 +1,63 @@
+#include "kthread.h"
+#include <kernel/kernel.h>
+#include "wait.h"
+#include "../lib/string.h"
+
+// First code of every kernel thread; the trampoline calls process_exit()
+// when this returns
+static void kthread_entry(void) {
+    process_t* self = process_get_current();
+    self->thread_fn(self->thread_data);
+}
+
+// Returns 0 when no PID is free
+process_t* kthread_create(void (*fn)(void* data), void* data, const char* name) {
+    process_t* task = process_alloc(kthread_entry, RING_0);
+    if (!task) {
+        return 0;
+    }
+    
+    task->thread_fn = fn;
+    task->thread_data = data;
+    strncpy(task->name, name, PROCESS_NAME_LEN - 1);
+    task->name[PROCESS_NAME_LEN - 1] = '\0';
+    return task;
+}
+
+process_t* kthread_run(void (*fn)(void* data), void* data, const char* name) {
+    process_t* task = kthread_create(fn, data, name);
+    if (task) {
+        kthread_start(task);
+    }
+    return task;
+}
+
+// Only valid before kthread_start()
+void kthread_bind(process_t* task, u32 cpu) {
+    task->cpus_allowed = 1u << cpu;
+}
+
+void kthread_start(process_t* task) {
+    process_wake_new(task);
+}
+
+bool kthread_should_stop(void) {
+    return process_get_current()->should_stop;
+}
+
+// Ask the thread to return and wait until it has; it must poll
+// kthread_should_stop() in its loop
+void kthread_stop(process_t* task) {
+    u32 pid = task->pid;
+    
+    kthread_request_stop(task);
+    process_wait(pid);
+}
+
+// As kthread_stop() without the wait, for callers that cannot block. The
+// thread must not exit before the caller is done with it.
+void kthread_request_stop(process_t* task) {
+    task->should_stop = true;
+    __sync_synchronize();
+    wake_up_process(task);
+}
@@ -0,0 +1,18 @@
+#ifndef KTHREAD_H
+#define KTHREAD_H
+
+#include "kernel.h"
+#include "process.h"
+
+// Kernel threads are ring 0 tasks on the kernel address space. They are
+// created stopped, so affinity or the address space can be set first, and
+// exit when their function returns.
+process_t* kthread_create(void (*fn)(void* data), void* data, const char* name);
+process_t* kthread_run(void (*fn)(void* data), void* data, const char* name);
+void kthread_bind(process_t* task, u32 cpu);
+void kthread_start(process_t* task);
+bool kthread_should_stop(void);
+void kthread_stop(process_t* task);
+void kthread_request_stop(process_t* task);
+
+#endif // KTHREAD_H
@@ -0,0 +1,147 @@
+#include "pid.h"
+#include <kernel/kernel.h>
+#include <kernel/memory.h>
+#include <kernel/spinlock.h>
+#include "../lib/string.h"
+#include "../lib/bitops.h"
+
+#define BITS_PER_WORD 32
+
+// One bit per PID plus a direct PID -> process index, both sized to pid_max
+static u32* pid_bitmap = 0;
+static struct process** pid_table = 0;
+static u32 pid_max = 0;
+static u32 pid_last = 0;
+static u32 pid_used = 0;
+static spinlock_t pid_lock = SPINLOCK_INIT;
+
+static inline u32 pid_words(u32 max) {
+    return (max + BITS_PER_WORD - 1) / BITS_PER_WORD;
+}
+
+static void pid_resize(u32 max) {
+    u32* bitmap = (u32*)kmalloc(pid_words(max) * sizeof(u32));
+    struct process** table = (struct process**)kmalloc(max * sizeof(struct process*));
+    
+    memset(bitmap, 0, pid_words(max) * sizeof(u32));
+    memset(table, 0, max * sizeof(struct process*));
+    
+    if (pid_bitmap) {
+        u32 keep = max < pid_max ? max : pid_max;
+        memcpy(bitmap, pid_bitmap, pid_words(keep) * sizeof(u32));
+        memcpy(table, pid_table, keep * sizeof(struct process*));
+        kfree(pid_bitmap);
+        kfree(pid_table);
+    }
+    
+    pid_bitmap = bitmap;
+    pid_table = table;
+    pid_max = max;
+}
+
+void pid_init(void) {
+    pid_resize(PID_MAX_DEFAULT);
+    
+    // PID 0 is the boot context
+    pid_bitmap[0] = 1;
+    pid_last = 0;
+    pid_used = 1;
+}
+
+// First clear bit in [start, pid_max), or pid_max if none
+static u32 pid_find_zero(u32 start) {
+    u32 word = start / BITS_PER_WORD;
+    u32 bits = ~pid_bitmap[word] & (0xFFFFFFFF << (start % BITS_PER_WORD));
+    
+    while (!bits) {
+        if (++word >= pid_words(pid_max)) {
+            return pid_max;
+        }
+        bits = ~pid_bitmap[word];
+    }
+    
+    u32 pid = word * BITS_PER_WORD + __ffs(bits);
+    return pid < pid_max ? pid : pid_max;
+}
+
+// Returns 0 when every PID is taken
+u32 pid_alloc(void) {
+    u32 flags = spin_lock_irqsave(&pid_lock);
+    u32 pid = pid_last + 1 < pid_max ? pid_find_zero(pid_last + 1) : pid_max;
+    
+    if (pid >= pid_max) {
+        pid = pid_find_zero(1);
+        if (pid >= pid_max) {
+            spin_unlock_irqrestore(&pid_lock, flags);
+            return 0;
+        }
+    }
+    
+    pid_bitmap[pid / BITS_PER_WORD] |= 1u << (pid % BITS_PER_WORD);
+    pid_last = pid;
+    pid_used++;
+    spin_unlock_irqrestore(&pid_lock, flags);
+    return pid;
+}
+
+void pid_free(u32 pid) {
+    if (pid == 0 || pid >= pid_max) {
+        return;
+    }
+    
+    u32 flags = spin_lock_irqsave(&pid_lock);
+    u32 bit = 1u << (pid % BITS_PER_WORD);
+    if (pid_bitmap[pid / BITS_PER_WORD] & bit) {
+        pid_bitmap[pid / BITS_PER_WORD] &= ~bit;
+        pid_table[pid] = 0;
+        pid_used--;
+    }
+    spin_unlock_irqrestore(&pid_lock, flags);
+}
+
+void pid_attach(u32 pid, struct process* proc) {
+    u32 flags = spin_lock_irqsave(&pid_lock);
+    if (pid < pid_max) {
+        pid_table[pid] = proc;
+    }
+    spin_unlock_irqrestore(&pid_lock, flags);
+}
+
+struct process* pid_lookup(u32 pid) {
+    u32 flags = spin_lock_irqsave(&pid_lock);
+    struct process* proc = pid < pid_max ? pid_table[pid] : 0;
+    spin_unlock_irqrestore(&pid_lock, flags);
+    return proc;
+}
+
+// Shrinking fails while a PID at or above the new limit is still in use
+bool pid_set_max(u32 max) {
+    if (max < 2 || max > PID_MAX_LIMIT) {
+        return false;
+    }
+    
+    u32 flags = spin_lock_irqsave(&pid_lock);
+    for (u32 pid = max; pid < pid_max; pid++) {
+        if (pid_bitmap[pid / BITS_PER_WORD] & (1u << (pid % BITS_PER_WORD))) {
+            spin_unlock_irqrestore(&pid_lock, flags);
+            return false;
+        }
+    }
+    
+    if (max != pid_max) {
+        pid_resize(max);
+        if (pid_last >= max) {
+            pid_last = 0;
+        }
+    }
+    spin_unlock_irqrestore(&pid_lock, flags);
+    return true;
+}
+
+u32 pid_get_max(void) {
+    return pid_max;
+}
+
+u32 pid_count(void) {
+    return pid_used;
+}
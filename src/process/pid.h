@@ -0,0 +1,24 @@
+#ifndef PID_H
+#define PID_H
+
+#include "kernel.h"
+
+struct process;
+
+// PIDs run from 1 to pid_max - 1 and are handed out cyclically, so a freed
+// PID is not reused until the allocator wraps around. pid_max can be raised
+// up to PID_MAX_LIMIT at runtime and also bounds the number of tasks.
+#define PID_MAX_DEFAULT 1024
+#define PID_MAX_LIMIT   32768
+
+// PID functions
+void pid_init(void);
+u32 pid_alloc(void);
+void pid_free(u32 pid);
+void pid_attach(u32 pid, struct process* proc);
+struct process* pid_lookup(u32 pid);
+bool pid_set_max(u32 max);
+u32 pid_get_max(void);
+u32 pid_count(void);
+
+#endif // PID_H
@@ -1,121 +1,627 @@
 #include "process.h"`n#include <kernel/kernel.h>`n#include <kernel/memory.h>`n#include "../lib/string.h"
 #include "string.h"
+#include "../trace/tracepoint.h"
+#include "ioring.h"
+#include "scheduler.h"
+#include "pid.h"
+#include "wait.h"
+#include <kernel/slab.h>
+#include "../kernel/vdso.h"
 
-static process_t processes[MAX_PROCESSES];
-static process_t* current_process = 0;
-static process_t* ready_queue = 0;
-static u32 next_pid = 1;
+#include "../kernel/time.h"
+#include "../drivers/vga.h"
+#include "../lib/div64.h"
+#include <kernel/irqflags.h>
+
+#include <kernel/spinlock.h>
+#include "../arch/x86/smp.h"
+#include "../interrupts/softirq.h"
+
+// Assembly helpers in arch/x86/switch.asm
+extern void switch_to(u32* prev_esp, u32 next_esp);
+extern void process_trampoline(void);
+void process_start(void);
+
+// Carried across switch_to so the incoming task can finish the switch
+typedef struct {
+    process_t* switch_prev;
+    u64 switch_start;
+    ctxsw_stats_t stats;
+} process_cpu_t;
+
+static kmem_cache_t* process_cache = 0;
+static process_cpu_t process_cpus[NR_CPUS];
+
+// The context kernel_main runs in; it becomes pid 0, is never freed and
+// anchors the circular list of all tasks
+static process_t init_task;
+
+// Guards the task list and the TERMINATED/on_cpu handoff that decides who
+// frees a dead task
+static spinlock_t tasklist_lock = SPINLOCK_INIT;
+
+static u32 fpu_restores_base = 0;
+
+// Woken whenever a task terminates, for process_wait()
+static wait_queue_head_t exit_wait = WAIT_QUEUE_HEAD_INIT;
+
+static inline process_t* current_task(void) {
+    process_t* proc;
+    __asm__ volatile("movl %%gs:%c1, %0" : "=r"(proc) : "i"(PERCPU_CURRENT_OFFSET));
+    return proc;
+}
+
+// Idle tasks are per CPU, never queued, and have no PID
+static process_t* process_alloc_idle(u32 cpu) {
+    process_t* idle = (process_t*)kmem_cache_alloc(process_cache);
+    
+    memset(idle, 0, sizeof(process_t));
+    idle->state = PROCESS_STATE_RUNNING;
+    idle->page_directory = paging_get_kernel_directory();
+    idle->cpus_allowed = 1u << cpu;
+    idle->cpu = cpu;
+    fpu_state_init(&idle->fpu_state);
+    
+    strcpy(idle->name, "idle/");
+    utoa(cpu, idle->name + 5, 10);
+    idle->acct.stamp = rdtsc();
+    return idle;
+}
 
 void process_init(void) {
-    memset(processes, 0, sizeof(processes));
-    current_process = 0;
-    ready_queue = 0;
-    next_pid = 1;
+    process_cache = kmem_cache_create("process", sizeof(process_t), __alignof__(process_t));
+    pid_init();
+    sched_init();
+    
+    // Adopt the boot stack so switch_to has somewhere to save it. The shell
+    // waits on the keyboard IRQ, which only the BSP takes, so it stays there.
+    memset(&init_task, 0, sizeof(init_task));
+    init_task.pid = 0;
+    init_task.state = PROCESS_STATE_RUNNING;
+    init_task.page_directory = paging_get_kernel_directory();
+    init_task.task_next = &init_task;
+    init_task.task_prev = &init_task;
+    init_task.cpus_allowed = 1u << 0;
+    init_task.on_cpu = true;
+    strcpy(init_task.name, "init");
+    init_task.acct.stamp = rdtsc();
+    pid_attach(0, &init_task);
+    sched_fork(&init_task, SCHED_PRIO_DEFAULT);
+    fpu_state_init(&init_task.fpu_state);
+    this_cpu()->current = &init_task;
+    this_cpu()->curr_prio = init_task.prio;
+    this_cpu()->slice_end = time_ns() + sched_slice_ns(init_task.prio);
+    
+    // The BSP idles on a stack of its own, entered through the trampoline
+    process_t* idle = process_alloc_idle(0);
+    u32* sp = (u32*)((u32)kmalloc(KERNEL_STACK_SIZE) + KERNEL_STACK_SIZE);
+    idle->kernel_stack = (u32)sp;
+    *--sp = (u32)process_trampoline;
+    *--sp = 0;                      // ebp
+    *--sp = (u32)cpu_idle;          // ebx
+    *--sp = 0;                      // esi
+    *--sp = 0;                      // edi
+    idle->esp = (u32)sp;
+    this_cpu()->idle = idle;
+    
+    fpu_lazy_init(&init_task);
+    process_ctxsw_reset();
 }
 
-process_t* process_create(void (*entry_point)(void), u8 privilege_level) {
-    // Find free process slot
-    process_t* proc = 0;
-    for (u32 i = 0; i < MAX_PROCESSES; i++) {
-        if (processes[i].state == PROCESS_STATE_TERMINATED || processes[i].pid == 0) {
-            proc = &processes[i];
-            break;
-        }
+// Application processors turn their boot stack into their idle task
+void process_init_cpu(u32 stack_top) {
+    cpu_t* cpu = this_cpu();
+    process_t* idle = process_alloc_idle(cpu->id);
+    
+    idle->kernel_stack = stack_top;
+    idle->on_cpu = true;
+    cpu->idle = idle;
+    cpu->current = idle;
+    tss_set_kernel_stack(KERNEL_DATA_SEGMENT, stack_top);
+    fpu_switch(0, idle);
+}
+
+// Build a task without making it runnable, so the caller can adjust it
+// (affinity, address space) before process_wake_new()
+process_t* process_alloc(void (*entry_point)(void), u8 privilege_level) {
+    // pid_max bounds the number of tasks
+    u32 pid = pid_alloc();
+    if (!pid) {
+        return 0;
     }
     
+    process_t* proc = (process_t*)kmem_cache_alloc(process_cache);
     if (!proc) {
-        return 0;  // No free slots
+        pid_free(pid);
+        return 0;
+    }
+    
+    // Allocate kernel stack
+    void* stack = kmalloc(KERNEL_STACK_SIZE);
+    if (!stack) {
+        kmem_cache_free(process_cache, proc);
+        pid_free(pid);
+        return 0;
     }
     
     // Initialize process
-    proc->pid = next_pid++;
+    memset(proc, 0, sizeof(process_t));
+    proc->pid = pid;
     proc->state = PROCESS_STATE_READY;
     proc->privilege_level = privilege_level;
     
     // Clone kernel page directory for now
     // In a real implementation, create separate user space
     proc->page_directory = paging_get_kernel_directory();
+    proc->kernel_stack = (u32)stack + KERNEL_STACK_SIZE;
     
-    // Allocate kernel stack
-    proc->kernel_stack = (u32)kmalloc(4096) + 4096;
+    // Seed the frame switch_to pops: edi, esi, ebx, ebp, return address
+    u32* sp = (u32*)proc->kernel_stack;
+    *--sp = (u32)process_trampoline;
+    *--sp = 0;                      // ebp
+    *--sp = (u32)entry_point;       // ebx, called by the trampoline
+    *--sp = 0;                      // esi
+    *--sp = 0;                      // edi
     
-    // Set up initial stack frame
-    proc->esp = proc->kernel_stack;
-    proc->ebp = proc->kernel_stack;
+    proc->esp = (u32)sp;
+    proc->ebp = 0;
     proc->eip = (u32)entry_point;
     
-    // Add to ready queue
-    proc->next = ready_queue;
-    ready_queue = proc;
+    // Start from a clean x87/SSE state
+    fpu_state_init(&proc->fpu_state);
+    proc->ioring = 0;
+    
+    proc->cpus_allowed = CPU_MASK_ALL;
+    proc->acct.rss_pages = KERNEL_STACK_SIZE / PAGE_SIZE;
+    
+    // Link at the tail of the task list and publish the PID
+    u32 flags = spin_lock_irqsave(&tasklist_lock);
+    proc->task_next = &init_task;
+    proc->task_prev = init_task.task_prev;
+    init_task.task_prev->task_next = proc;
+    init_task.task_prev = proc;
+    pid_attach(pid, proc);
+    spin_unlock_irqrestore(&tasklist_lock, flags);
     
     return proc;
 }
 
+void process_wake_new(process_t* proc) {
+    sched_fork(proc, SCHED_PRIO_DEFAULT);
+    sched_enqueue(proc);
+}
+
+process_t* process_create(void (*entry_point)(void), u8 privilege_level) {
+    process_t* proc = process_alloc(entry_point, privilege_level);
+    if (proc) {
+        process_wake_new(proc);
+    }
+    return proc;
+}
+
+static void process_free(process_t* proc) {
+    if (proc->kernel_stack) {
+        kfree((void*)(proc->kernel_stack - KERNEL_STACK_SIZE));
+    }
+    kmem_cache_free(process_cache, proc);
+}
+
 void process_terminate(u32 pid) {
-    for (u32 i = 0; i < MAX_PROCESSES; i++) {
-        if (processes[i].pid == pid) {
-            processes[i].state = PROCESS_STATE_TERMINATED;
-            
-            // Remove from ready queue
-            if (ready_queue == &processes[i]) {
-                ready_queue = processes[i].next;
-            } else {
-                process_t* prev = ready_queue;
-                while (prev && prev->next != &processes[i]) {
-                    prev = prev->next;
-                }
-                if (prev) {
-                    prev->next = processes[i].next;
-                }
-            }
-            
-            // Free kernel stack
-            if (processes[i].kernel_stack) {
-                kfree((void*)(processes[i].kernel_stack - 4096));
-            }
-            
-            break;
-        }
+    // pid 0 is the boot context
+    if (pid == 0) {
+        return;
+    }
+    
+    u32 flags = spin_lock_irqsave(&tasklist_lock);
+    process_t* proc = pid_lookup(pid);
+    if (!proc || proc->state == PROCESS_STATE_TERMINATED) {
+        spin_unlock_irqrestore(&tasklist_lock, flags);
+        return;
+    }
+    
+    proc->state = PROCESS_STATE_TERMINATED;
+    proc->task_prev->task_next = proc->task_next;
+    proc->task_next->task_prev = proc->task_prev;
+    pid_free(pid);
+    
+    // Off the queue before deciding who frees it. A pick marks its task
+    // on_cpu under the queue lock, so either we dequeue it here or some CPU
+    // is on that stack and frees the task once it switches away.
+    sched_dequeue(proc);
+    bool running = proc->on_cpu;
+    spin_unlock_irqrestore(&tasklist_lock, flags);
+    
+    sched_dl_release(proc);
+    wait_abort(proc);
+    ioring_destroy(proc);
+    fpu_release(proc);
+    
+    if (!running) {
+        process_free(proc);
     }
+    
+    wake_up(&exit_wait);
+}
+
+// Block until the task now holding pid has terminated. Only the PID slot is
+// compared, since the task itself may already be freed.
+void process_wait(u32 pid) {
+    process_t* proc = pid_lookup(pid);
+    if (proc && proc != current_task()) {
+        wait_event(exit_wait, pid_lookup(pid) != proc);
+    }
+}
+
+void process_exit(void) {
+    process_t* current = current_task();
+    
+    if (current == &init_task) {
+        return;
+    }
+    
+    // Any switch away from a dead task is its last, so the teardown must not
+    // be preempted half way
+    preempt_disable();
+    process_terminate(current->pid);
+    preempt_enable_no_resched();
+    process_schedule();
+    kernel_panic("process_exit: dead task rescheduled");
 }
 
 void process_yield(void) {
-    // Simple round-robin scheduling
-    if (!current_process || !ready_queue) {
+    // A deadline task yields to end its job and sleeps until the next period
+    process_t* current = current_task();
+    if (current && current->dl.enabled) {
+        sched_dl_yield(current);
+        process_schedule();
         return;
     }
     
-    current_process->state = PROCESS_STATE_READY;
+    if (!sched_has_runnable()) {
+        return;
+    }
     process_schedule();
 }
 
-void process_schedule(void) {
-    if (!ready_queue) {
+// Runs on the incoming task's stack right after switch_to
+static void process_finish_switch(void) {
+    process_cpu_t* pc = &process_cpus[cpu_id()];
+    process_t* prev = pc->switch_prev;
+    u32 cycles = (u32)(rdtsc() - pc->switch_start);
+    
+    pc->stats.switches++;
+    pc->stats.cycles += cycles;
+    if (cycles < pc->stats.min_cycles) {
+        pc->stats.min_cycles = cycles;
+    }
+    if (cycles > pc->stats.max_cycles) {
+        pc->stats.max_cycles = cycles;
+    }
+    pc->switch_prev = 0;
+    
+    // prev's registers are saved now, so other CPUs may steal it
+    spin_lock(&tasklist_lock);
+    prev->on_cpu = false;
+    bool dead = prev->state == PROCESS_STATE_TERMINATED;
+    spin_unlock(&tasklist_lock);
+    
+    if (dead) {
+        process_free(prev);
+    } else if (prev->migrating) {
+        sched_migrate(prev);
+    }
+}
+
+// First code a new task runs, called from process_trampoline
+void process_start(void) {
+    process_finish_switch();
+    local_irq_enable();
+}
+
+// A runnable task queues behind its peers before the pick, so equal
+// priorities round-robin; blocked and dead tasks just drop out. A preempted
+// task stays queued even if it had just marked itself blocked: it has not
+// tested its wait condition yet, and the wakeup may already have happened.
+static void schedule(bool preempt) {
+    u32 flags = local_irq_save();
+    cpu_t* cpu = this_cpu();
+    process_cpu_t* pc = &process_cpus[cpu->id];
+    process_t* prev = cpu->current;
+    u64 now = time_ns();
+    
+    cpu->need_resched = false;
+    
+    // May throttle it, which keeps it off the queue below
+    if (prev->dl.enabled) {
+        sched_dl_charge(prev, now);
+    }
+    
+    bool runnable = prev->state == PROCESS_STATE_RUNNING || prev->state == PROCESS_STATE_READY ||
+        (preempt && prev->state == PROCESS_STATE_BLOCKED);
+    if (prev != cpu->idle && runnable) {
+        prev->state = PROCESS_STATE_READY;
+        sched_requeue(prev);
+    }
+    
+    process_t* next = sched_pick_next();
+    if (!next) {
+        next = cpu->idle;
+    }
+    
+    // Whoever runs next starts a fresh slice; a deadline task runs until its
+    // budget is used up
+    cpu->curr_prio = next->prio;
+    if (next->dl.enabled) {
+        cpu->curr_deadline = sched_dl_start(next, now);
+        cpu->slice_end = now + (next->dl.runtime_left > 0 ? (u64)next->dl.runtime_left : 0);
+    } else {
+        cpu->curr_deadline = 0;
+        cpu->slice_end = now + sched_slice_ns(next->prio);
+    }
+    
+    // The pick left next on_cpu; a task killed since keeps its state
+    __sync_bool_compare_and_swap(&next->state, PROCESS_STATE_READY, PROCESS_STATE_RUNNING);
+    if (next == prev) {
+        local_irq_restore(flags);
         return;
     }
     
-    // Get next ready process
-    process_t* next = ready_queue;
-    ready_queue = next->next;
+    TRACE_EVENT(sched_switch, prev->pid, next->pid);
     
-    // Add current process back to queue if still ready
-    if (current_process && current_process->state == PROCESS_STATE_READY) {
-        current_process->next = ready_queue;
-        ready_queue = current_process;
+    // The switch itself is charged to prev
+    u64 tsc = rdtsc();
+    pc->switch_start = tsc;
+    acct_write_begin(&prev->acct);
+    prev->acct.stime += tsc - prev->acct.stamp;
+    acct_write_end(&prev->acct);
+    acct_write_begin(&next->acct);
+    next->acct.stamp = tsc;
+    acct_write_end(&next->acct);
+    if (preempt && prev != cpu->idle) {
+        pc->stats.preemptions++;
+        prev->acct.nivcsw++;
+    } else {
+        prev->acct.nvcsw++;
     }
     
     // Switch to next process
-    current_process = next;
-    current_process->state = PROCESS_STATE_RUNNING;
+    cpu->current = next;
     
-    // Switch page directory
-    paging_switch_directory(current_process->page_directory);
+    // Reloading CR3 flushes the TLB, so skip it between tasks sharing one
+    if (next->page_directory != prev->page_directory) {
+        paging_switch_directory(next->page_directory);
+        pc->stats.cr3_loads++;
+    } else {
+        pc->stats.cr3_skips++;
+    }
     
     // Update TSS for privilege level switching
-    tss_set_kernel_stack(KERNEL_DATA_SEGMENT, current_process->kernel_stack);
+    if (next->kernel_stack) {
+        tss_set_kernel_stack(KERNEL_DATA_SEGMENT, next->kernel_stack);
+    }
+    
+    // FPU registers are saved only if prev used them, loaded on first use
+    fpu_switch(prev, next);
+    
+    // getpid() is answered from this CPU's slot in the shared page without a trap
+    vdso_set_process(next->pid);
+    
+    pc->switch_prev = prev;
+    switch_to(&prev->esp, next->esp);
+    
+    // Back on prev's stack, scheduled in again by some later switch
+    process_finish_switch();
+    local_irq_restore(flags);
+}
+
+// Give up the CPU by choice: yielding, blocking or exiting
+void process_schedule(void) {
+    schedule(false);
+}
+
+// Involuntary switch on the way out of an interrupt or system call
+void process_preempt(void) {
+    schedule(true);
+}
+
+// Called by preempt_enable() when it drops the last level with a switch due
+void preempt_schedule(void) {
+    if (preempt_count() == 0 && (raw_local_save_flags() & EFLAGS_IF) && !in_interrupt()) {
+        process_preempt();
+    }
+}
+
+// Voluntary preemption point for long-running kernel loops
+void cond_resched(void) {
+    if (need_resched() && preempt_count() == 0 && !in_interrupt()) {
+        process_preempt();
+    }
+}
+
+// Per-CPU idle loop. need_resched is checked with interrupts off so a kick
+// between the pick and hlt is not lost.
+void cpu_idle(void) {
+    cpu_t* cpu = this_cpu();
+    
+    while (1) {
+        softirq_run_deferred();
+        process_schedule();
+        
+        local_irq_disable();
+        if (!cpu->need_resched && !sched_has_runnable()) {
+            safe_halt();
+        } else {
+            local_irq_enable();
+        }
+    }
 }
 
 process_t* process_get_current(void) {
-    return current_process;
+    return current_task();
+}
+
+process_t* process_get_init(void) {
+    return &init_task;
+}
+
+process_t* process_find(u32 pid) {
+    return pid_lookup(pid);
+}
+
+void process_set_affinity(process_t* proc, u32 cpus_allowed) {
+    if (cpus_allowed) {
+        sched_set_affinity(proc, cpus_allowed);
+    }
+}
+
+static void process_fill_info(const process_t* proc, process_info_t* info, u64 now) {
+    info->key = proc;
+    info->pid = proc->pid;
+    memcpy(info->name, proc->name, PROCESS_NAME_LEN);
+    info->state = proc->state;
+    info->cpu = proc->cpu;
+    info->prio = proc->prio;
+    info->deadline = proc->dl.enabled;
+    info->idle = proc == smp_cpu(proc->cpu)->idle;
+    
+    // The task may be running on another CPU; retry until a copy was taken
+    // with no update in progress or in between
+    u32 seq;
+    do {
+        seq = proc->acct.seq;
+        __asm__ volatile("" ::: "memory");
+        info->acct = proc->acct;
+        __asm__ volatile("" ::: "memory");
+    } while ((seq & 1) || seq != proc->acct.seq);
+    
+    // A task still running has an open interval; count it so a CPU sitting
+    // in hlt or a user loop does not look idle
+    if (proc->on_cpu && now > info->acct.stamp) {
+        if (info->acct.in_user) {
+            info->acct.utime += now - info->acct.stamp;
+        } else {
+            info->acct.stime += now - info->acct.stamp;
+        }
+    }
+}
+
+// Copy the accounting of every task, idle tasks included, into out. Returns
+// how many entries were filled.
+u32 process_snapshot(process_info_t* out, u32 max) {
+    u32 count = 0;
+    process_t* proc;
+    
+    u32 flags = spin_lock_irqsave(&tasklist_lock);
+    u64 now = rdtsc();
+    if (count < max) {
+        process_fill_info(&init_task, &out[count++], now);
+    }
+    for_each_process(proc) {
+        if (count < max) {
+            process_fill_info(proc, &out[count++], now);
+        }
+    }
+    for (u32 cpu = 0; cpu < smp_num_cpus(); cpu++) {
+        process_t* idle = smp_cpu(cpu)->idle;
+        if (idle && smp_cpu_online(cpu) && count < max) {
+            process_fill_info(idle, &out[count++], now);
+        }
+    }
+    spin_unlock_irqrestore(&tasklist_lock, flags);
+    
+    return count;
 }
 
+void process_ctxsw_stats(ctxsw_stats_t* stats) {
+    memset(stats, 0, sizeof(ctxsw_stats_t));
+    stats->min_cycles = 0xFFFFFFFF;
+    
+    for (u32 cpu = 0; cpu < NR_CPUS; cpu++) {
+        const ctxsw_stats_t* s = &process_cpus[cpu].stats;
+        stats->switches += s->switches;
+        stats->cycles += s->cycles;
+        stats->cr3_loads += s->cr3_loads;
+        stats->cr3_skips += s->cr3_skips;
+        stats->preemptions += s->preemptions;
+        if (s->switches && s->min_cycles < stats->min_cycles) {
+            stats->min_cycles = s->min_cycles;
+        }
+        if (s->max_cycles > stats->max_cycles) {
+            stats->max_cycles = s->max_cycles;
+        }
+    }
+    stats->fpu_restores = fpu_lazy_restore_count() - fpu_restores_base;
+}
+
+u32 process_ctxsw_count(u32 cpu) {
+    return process_cpus[cpu].stats.switches;
+}
+
+void process_ctxsw_reset(void) {
+    for (u32 cpu = 0; cpu < NR_CPUS; cpu++) {
+        memset(&process_cpus[cpu].stats, 0, sizeof(ctxsw_stats_t));
+        process_cpus[cpu].stats.min_cycles = 0xFFFFFFFF;
+    }
+    fpu_restores_base = fpu_lazy_restore_count();
+}
+
+static void ctxsw_print_field(const char* label, u32 value) {
+    char buf[16];
+    vga_writestring(label);
+    utoa(value, buf, 10);
+    vga_writestring(buf);
+    vga_writestring("\n");
+}
+
+void process_ctxsw_report(void) {
+    ctxsw_stats_t stats;
+    process_ctxsw_stats(&stats);
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\nContext switches:\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    ctxsw_print_field("  Switches:        ", stats.switches);
+    if (stats.switches) {
+        ctxsw_print_field("  Avg cycles:      ", (u32)div_u64(stats.cycles, stats.switches));
+        ctxsw_print_field("  Min cycles:      ", stats.min_cycles);
+        ctxsw_print_field("  Max cycles:      ", stats.max_cycles);
+    }
+    ctxsw_print_field("  CR3 reloads:     ", stats.cr3_loads);
+    ctxsw_print_field("  CR3 skipped:     ", stats.cr3_skips);
+    ctxsw_print_field("  Lazy FPU loads:  ", stats.fpu_restores);
+    ctxsw_print_field("  Preemptions:     ", stats.preemptions);
+    vga_writestring("\n");
+}
+
+static volatile bool ctxsw_bench_running = false;
+
+static void ctxsw_bench_task(void) {
+    while (ctxsw_bench_running) {
+        process_yield();
+    }
+}
+
+// Ping-pong with a kernel task so every yield is a real switch
+void process_ctxsw_bench(u32 rounds) {
+    ctxsw_bench_running = true;
+    process_t* partner = process_create(ctxsw_bench_task, 0);
+    if (!partner) {
+        vga_writestring("No free process slot.\n");
+        ctxsw_bench_running = false;
+        return;
+    }
+    
+    // Keep the partner next to us, or the yields would not switch
+    process_set_affinity(partner, 1u << cpu_id());
+    
+    process_ctxsw_reset();
+    for (u32 i = 0; i < rounds; i++) {
+        process_yield();
+    }
+    
+    process_ctxsw_report();
+    
+    // Let the task see the flag and exit
+    ctxsw_bench_running = false;
+    process_yield();
+}
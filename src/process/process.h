@@ -3,8 +3,15 @@
 
 #include "kernel.h"
 #include "memory.h"
+#include "../arch/x86/fpu.h"
+#include "../arch/x86/smp.h"
+#include "sched_deadline.h"
 
-#define MAX_PROCESSES 32
+#define KERNEL_STACK_SIZE 4096
+#define PROCESS_NAME_LEN  16
+
+// Default affinity: any CPU
+#define CPU_MASK_ALL 0xFFFFFFFF
 
 typedef enum {
     PROCESS_STATE_READY,
@@ -13,6 +20,22 @@ typedef enum {
     PROCESS_STATE_TERMINATED
 } process_state_t;
 
+// CPU and memory use of one task. TSC cycles since stamp are charged to
+// user time on entry from ring 3, and to system time on the way back and at
+// every switch away. seq is odd while the times are being updated, so other
+// CPUs can read them without tearing the 64-bit fields.
+typedef struct {
+    volatile u32 seq;
+    u64 utime;
+    u64 stime;
+    u64 stamp;
+    bool in_user;           // Between the return to ring 3 and the next entry
+    u32 nvcsw;              // Gave up the CPU: yield, block, exit
+    u32 nivcsw;             // Preempted
+    u32 syscalls;
+    u32 rss_pages;          // Kernel stack plus user pages mapped for the task
+} task_acct_t;
+
 typedef struct process {
     u32 pid;
     u32 esp;
@@ -22,15 +45,166 @@ typedef struct process {
     process_state_t state;
     u8 privilege_level;
     u32 kernel_stack;
+    fpu_state_t fpu_state;
+    struct ioring* ioring;
+    
+    // All tasks, a circular list anchored at the boot context
+    struct process* task_next;
+    struct process* task_prev;
+    
+    // Run queue linkage and priority, owned by scheduler.c
     struct process* next;
+    struct process* prev;
+    u8 static_prio;
+    u8 prio;
+    u8 sleep_bonus;
+    bool on_rq;
+    sched_dl_t dl;
+    
+    // CPU whose queue holds the task, where it may run, and whether some
+    // CPU is running it or still switching away from it. A task whose
+    // affinity changed while it ran is queued elsewhere only once it is off
+    // the CPU (migrating).
+    u32 cpu;
+    u32 cpus_allowed;
+    volatile bool on_cpu;
+    bool migrating;
+    
+    // Wait queue the task is blocked on, if any (see wait.h)
+    struct wait_queue_head* wait_queue;
+    struct wait_queue_entry* wait_entry;
+    
+    // Kernel threads only (see kthread.h)
+    char name[PROCESS_NAME_LEN];
+    void (*thread_fn)(void* data);
+    void* thread_data;
+    volatile bool should_stop;
+    
+    task_acct_t acct;
 } process_t;
 
+// One task as seen by process_snapshot()
+typedef struct {
+    const process_t* key;   // Matches the same task across snapshots
+    u32 pid;
+    char name[PROCESS_NAME_LEN];
+    process_state_t state;
+    u32 cpu;
+    u8 prio;
+    bool deadline;
+    bool idle;
+    task_acct_t acct;
+} process_info_t;
+
+// Context switch cost, measured from the scheduling decision to the first
+// instruction back on the incoming stack
+typedef struct {
+    u32 switches;
+    u64 cycles;
+    u32 min_cycles;
+    u32 max_cycles;
+    u32 cr3_loads;
+    u32 cr3_skips;
+    u32 fpu_restores;       // #NM traps that moved FPU state
+    u32 preemptions;        // Switches forced by need_resched
+} ctxsw_stats_t;
+
+// Publish a state change before testing a wakeup condition
+static inline void set_current_state(process_t* task, process_state_t state) {
+    task->state = state;
+    __sync_synchronize();
+}
+
+// Walk every task except the boot context
+#define for_each_process(p) \
+    for ((p) = process_get_init()->task_next; (p) != process_get_init(); (p) = (p)->task_next)
+
+// Times are only written by the CPU the task is on, with interrupts off, so
+// writers never nest; x86 keeps stores in order, the barrier keeps gcc too
+static inline NOTRACE void acct_write_begin(task_acct_t* acct) {
+    acct->seq++;
+    __asm__ volatile("" ::: "memory");
+}
+
+static inline NOTRACE void acct_write_end(task_acct_t* acct) {
+    __asm__ volatile("" ::: "memory");
+    acct->seq++;
+}
+
+// Close the current user mode interval on entry from ring 3
+static inline NOTRACE void acct_user_exit(void) {
+    process_t* task = this_cpu()->current;
+    u64 now = rdtsc();
+    acct_write_begin(&task->acct);
+    task->acct.utime += now - task->acct.stamp;
+    task->acct.stamp = now;
+    task->acct.in_user = false;
+    acct_write_end(&task->acct);
+}
+
+// Close the kernel interval on the way back to ring 3
+static inline NOTRACE void acct_user_enter(void) {
+    process_t* task = this_cpu()->current;
+    u64 now = rdtsc();
+    acct_write_begin(&task->acct);
+    task->acct.stime += now - task->acct.stamp;
+    task->acct.stamp = now;
+    task->acct.in_user = true;
+    acct_write_end(&task->acct);
+}
+
+// Kernel preemption. A task is switched out on return from an interrupt
+// once need_resched is set, unless it is inside a preempt_disable() section.
+// The count is updated with one gs-relative instruction, so it cannot be
+// torn by a migration in between.
+static inline NOTRACE void preempt_disable(void) {
+    __asm__ volatile("incl %%gs:%c0" :: "i"(__builtin_offsetof(cpu_t, preempt_count)) : "memory");
+}
+
+static inline NOTRACE u32 preempt_count(void) {
+    return this_cpu()->preempt_count;
+}
+
+static inline NOTRACE bool need_resched(void) {
+    return this_cpu()->need_resched;
+}
+
+void preempt_schedule(void);
+void process_preempt(void);
+
+static inline NOTRACE void preempt_enable_no_resched(void) {
+    __asm__ volatile("decl %%gs:%c0" :: "i"(__builtin_offsetof(cpu_t, preempt_count)) : "memory");
+}
+
+static inline NOTRACE void preempt_enable(void) {
+    preempt_enable_no_resched();
+    if (need_resched()) {
+        preempt_schedule();
+    }
+}
+
 // Process management functions
 void process_init(void);
+void process_init_cpu(u32 stack_top);
+void cpu_idle(void);
 process_t* process_create(void (*entry_point)(void), u8 privilege_level);
+process_t* process_alloc(void (*entry_point)(void), u8 privilege_level);
+void process_wake_new(process_t* proc);
+void process_wait(u32 pid);
 void process_terminate(u32 pid);
+void process_exit(void);
 void process_yield(void);
 void process_schedule(void);
+void cond_resched(void);
 process_t* process_get_current(void);
+process_t* process_get_init(void);
+process_t* process_find(u32 pid);
+void process_set_affinity(process_t* proc, u32 cpus_allowed);
+void process_ctxsw_stats(ctxsw_stats_t* stats);
+void process_ctxsw_reset(void);
+u32 process_ctxsw_count(u32 cpu);
+void process_ctxsw_report(void);
+void process_ctxsw_bench(u32 rounds);
+u32 process_snapshot(process_info_t* out, u32 max);
 
 #endif // PROCESS_H
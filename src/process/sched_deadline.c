@@ -0,0 +1,411 @@
+#include "sched_deadline.h"
+#include <kernel/kernel.h>
+#include <kernel/spinlock.h>
+#include "process.h"
+#include "scheduler.h"
+#include "kthread.h"
+#include "pid.h"
+#include "../lib/string.h"
+#include "../lib/div64.h"
+#include "../drivers/vga.h"
+
+#define DL_BW_LIMIT ((DL_BW_LIMIT_PERCENT << DL_BW_SHIFT) / 100)
+
+// Admitted tasks and the bandwidth reserved on each CPU. Replenishment
+// timers find their task through the table, so one that fires after the
+// task has exited finds an empty slot.
+static spinlock_t dl_lock = SPINLOCK_INIT;
+static process_t* dl_tasks[DL_MAX_TASKS];
+static u32 dl_cpu_bw[NR_CPUS];
+static u32 dl_nr = 0;
+static u32 dl_rejected = 0;
+
+// Load generators started from the shell
+static u32 dl_load_pids[DL_MAX_TASKS];
+
+// Counted once per absolute deadline, and not for a job already finished
+static void dl_check_miss(sched_dl_t* dl, u64 now) {
+    if (!dl->done && now > dl->abs_deadline && dl->missed != dl->abs_deadline) {
+        dl->missed = dl->abs_deadline;
+        dl->misses++;
+    }
+}
+
+static void dl_throttle(sched_dl_t* dl, u64 now) {
+    u64 next = dl->period_start + dl->period;
+    
+    u32 flags = spin_lock_irqsave(&dl_lock);
+    dl->throttled = true;
+    timer_add(&dl->timer, next > now ? next - now : 0);
+    spin_unlock_irqrestore(&dl_lock, flags);
+}
+
+// Timer softirq: start the next period with a full budget. Whichever of this
+// and the switch-out path sees the other's store queues the task (see
+// dl_throttled() in scheduler.c).
+static void dl_replenish(u32 slot) {
+    u32 flags = spin_lock_irqsave(&dl_lock);
+    process_t* proc = dl_tasks[slot];
+    
+    if (!proc || !proc->dl.throttled) {
+        spin_unlock_irqrestore(&dl_lock, flags);
+        return;
+    }
+    
+    sched_dl_t* dl = &proc->dl;
+    u64 now = time_ns();
+    
+    // Throttled by an overrun before the job finished
+    dl_check_miss(dl, now);
+    
+    dl->period_start += dl->period;
+    if (dl->period_start + dl->period <= now) {
+        dl->period_start = now;
+    }
+    dl->abs_deadline = dl->period_start + dl->deadline;
+    dl->runtime_left = (s64)dl->runtime;
+    dl->done = false;
+    dl->periods++;
+    
+    dl->throttled = false;
+    __sync_synchronize();
+    if (proc->state == PROCESS_STATE_READY) {
+        sched_enqueue(proc);
+    }
+    spin_unlock_irqrestore(&dl_lock, flags);
+}
+
+// Admit proc with the given parameters in ns, on the allowed CPU with the
+// most spare bandwidth. The task is pinned there. Returns 0, or -1 if the
+// parameters are invalid, the task is already a deadline task or no CPU has
+// room for it.
+s32 sched_setattr_deadline(process_t* proc, u64 runtime, u64 deadline, u64 period) {
+    if (runtime < DL_RUNTIME_MIN_NS || runtime > deadline || deadline > period || period > DL_PERIOD_MAX_NS) {
+        return -1;
+    }
+    
+    sched_dl_t* dl = &proc->dl;
+    u32 bw = (u32)div_u64(runtime << DL_BW_SHIFT, (u32)period);
+    
+    u32 flags = spin_lock_irqsave(&dl_lock);
+    u32 slot = 0;
+    while (slot < DL_MAX_TASKS && dl_tasks[slot]) {
+        slot++;
+    }
+    
+    u32 best = NR_CPUS;
+    for (u32 cpu = 0; cpu < smp_num_cpus(); cpu++) {
+        if (!smp_cpu_online(cpu) || !(proc->cpus_allowed & (1u << cpu))) {
+            continue;
+        }
+        if (dl_cpu_bw[cpu] + bw <= DL_BW_LIMIT && (best == NR_CPUS || dl_cpu_bw[cpu] < dl_cpu_bw[best])) {
+            best = cpu;
+        }
+    }
+    
+    if (dl->enabled || slot == DL_MAX_TASKS || best == NR_CPUS) {
+        dl_rejected++;
+        spin_unlock_irqrestore(&dl_lock, flags);
+        return -1;
+    }
+    dl_cpu_bw[best] += bw;
+    dl_tasks[slot] = proc;
+    dl_nr++;
+    spin_unlock_irqrestore(&dl_lock, flags);
+    
+    // Off its old queue before the class changes which list it goes on
+    bool queued = proc->on_rq;
+    sched_dequeue(proc);
+    
+    u64 now = time_ns();
+    dl->runtime = runtime;
+    dl->deadline = deadline;
+    dl->period = period;
+    dl->bw = bw;
+    dl->slot = slot;
+    dl->cpu = best;
+    dl->runtime_left = (s64)runtime;
+    dl->period_start = now;
+    dl->abs_deadline = now + deadline;
+    dl->exec_start = now;
+    dl->missed = 0;
+    dl->throttled = false;
+    dl->done = false;
+    dl->periods = 0;
+    dl->misses = 0;
+    dl->overruns = 0;
+    timer_setup(&dl->timer, dl_replenish, slot);
+    
+    // A running task moves at its next requeue
+    proc->cpus_allowed = 1u << best;
+    if (!proc->on_cpu) {
+        proc->cpu = best;
+    }
+    dl->enabled = true;
+    
+    if (queued) {
+        sched_enqueue(proc);
+    }
+    return 0;
+}
+
+// Give back the task's bandwidth; called as it terminates
+void sched_dl_release(process_t* proc) {
+    sched_dl_t* dl = &proc->dl;
+    if (!dl->enabled) {
+        return;
+    }
+    
+    // Throttled keeps wakeups from queueing it again
+    u32 flags = spin_lock_irqsave(&dl_lock);
+    dl_cpu_bw[dl->cpu] -= dl->bw;
+    dl_tasks[dl->slot] = 0;
+    dl_nr--;
+    dl->throttled = true;
+    spin_unlock_irqrestore(&dl_lock, flags);
+    
+    timer_del(&dl->timer);
+    sched_dequeue(proc);
+    dl->enabled = false;
+}
+
+// Switch-out: charge the time since sched_dl_start() and throttle the task
+// if its budget ran dry before it finished the job
+void sched_dl_charge(process_t* proc, u64 now) {
+    sched_dl_t* dl = &proc->dl;
+    
+    dl->runtime_left -= (s64)(now - dl->exec_start);
+    dl->exec_start = now;
+    dl_check_miss(dl, now);
+    
+    if (dl->runtime_left <= 0 && !dl->throttled) {
+        dl->overruns++;
+        dl_throttle(dl, now);
+    }
+}
+
+// Switch-in; returns the deadline the task now runs against
+u64 sched_dl_start(process_t* proc, u64 now) {
+    sched_dl_t* dl = &proc->dl;
+    
+    dl->exec_start = now;
+    dl_check_miss(dl, now);
+    return dl->abs_deadline;
+}
+
+// CBS wakeup rule: the current deadline is kept only if the remaining budget
+// fits in the time left at the reserved bandwidth. Otherwise the task would
+// take more than its share, so it starts a fresh period.
+void sched_dl_wakeup(process_t* proc, u64 now) {
+    sched_dl_t* dl = &proc->dl;
+    if (dl->throttled) {
+        return;
+    }
+    
+    u64 left = dl->runtime_left > 0 ? (u64)dl->runtime_left : 0;
+    if (dl->abs_deadline <= now || left * dl->period > (dl->abs_deadline - now) * dl->runtime) {
+        dl->period_start = now;
+        dl->abs_deadline = now + dl->deadline;
+        dl->runtime_left = (s64)dl->runtime;
+        dl->done = false;
+        dl->periods++;
+    }
+}
+
+// The current job is finished; the rest of the budget is given up until the
+// next period
+void sched_dl_yield(process_t* proc) {
+    sched_dl_t* dl = &proc->dl;
+    u64 now = time_ns();
+    
+    dl->runtime_left -= (s64)(now - dl->exec_start);
+    dl->exec_start = now;
+    dl_check_miss(dl, now);
+    dl->done = true;
+    dl_throttle(dl, now);
+}
+
+u32 sched_dl_nr_tasks(void) {
+    return dl_nr;
+}
+
+// Earliest absolute deadline first; equal deadlines stay FIFO. The run queue
+// linkage is shared with the priority lists, a task is only ever on one.
+void dl_rq_enqueue(runqueue_t* rq, process_t* proc) {
+    process_t* prev = 0;
+    process_t* pos = rq->dl_head;
+    
+    while (pos && pos->dl.abs_deadline <= proc->dl.abs_deadline) {
+        prev = pos;
+        pos = pos->next;
+    }
+    
+    proc->prev = prev;
+    proc->next = pos;
+    if (prev) {
+        prev->next = proc;
+    } else {
+        rq->dl_head = proc;
+    }
+    if (pos) {
+        pos->prev = proc;
+    }
+    
+    rq->dl_nr_running++;
+    rq->nr_running++;
+    proc->on_rq = true;
+}
+
+void dl_rq_dequeue(runqueue_t* rq, process_t* proc) {
+    if (proc->prev) {
+        proc->prev->next = proc->next;
+    } else {
+        rq->dl_head = proc->next;
+    }
+    if (proc->next) {
+        proc->next->prev = proc->prev;
+    }
+    
+    proc->next = 0;
+    proc->prev = 0;
+    proc->on_rq = false;
+    rq->dl_nr_running--;
+    rq->nr_running--;
+}
+
+// Spin for the given ns of wall time per job, then yield to end it
+static void dl_load_thread(void* data) {
+    u64 work = (u32)data;
+    
+    while (!kthread_should_stop()) {
+        u64 start = time_ns();
+        while (time_ns() - start < work) {
+            __asm__ volatile("pause");
+        }
+        process_yield();
+    }
+}
+
+// Returns the PID of the new load thread, 0 if it was not admitted
+u32 sched_dl_run_load(u64 runtime, u64 deadline, u64 period, u64 work) {
+    u32 slot = 0;
+    while (slot < DL_MAX_TASKS && dl_load_pids[slot]) {
+        slot++;
+    }
+    if (slot == DL_MAX_TASKS || work > DL_PERIOD_MAX_NS) {
+        return 0;
+    }
+    
+    process_t* task = kthread_create(dl_load_thread, (void*)(u32)work, "dl-load");
+    if (!task) {
+        return 0;
+    }
+    
+    // Created stopped, so a rejected thread just runs off its end
+    if (sched_setattr_deadline(task, runtime, deadline, period) != 0) {
+        task->should_stop = true;
+        kthread_start(task);
+        return 0;
+    }
+    
+    dl_load_pids[slot] = task->pid;
+    kthread_start(task);
+    return task->pid;
+}
+
+// Returns how many load threads were stopped
+u32 sched_dl_stop_loads(void) {
+    u32 stopped = 0;
+    
+    for (u32 slot = 0; slot < DL_MAX_TASKS; slot++) {
+        u32 pid = dl_load_pids[slot];
+        if (!pid) {
+            continue;
+        }
+        dl_load_pids[slot] = 0;
+    
+        process_t* task = pid_lookup(pid);
+        if (task && task->thread_fn == dl_load_thread) {
+            kthread_stop(task);
+            stopped++;
+        }
+    }
+    return stopped;
+}
+
+static void dl_print_column(u32 value, u32 width) {
+    char buf[16];
+    utoa(value, buf, 10);
+    for (u32 pad = strlen(buf); pad < width; pad++) {
+        vga_putchar(' ');
+    }
+    vga_writestring(buf);
+}
+
+void sched_dl_print_info(void) {
+    typedef struct {
+        u32 pid, cpu, runtime, deadline, period, periods, misses, overruns;
+    } dl_row_t;
+    dl_row_t rows[DL_MAX_TASKS];
+    u32 cpu_bw[NR_CPUS];
+    u32 nr_rows = 0;
+    
+    // Snapshot first; printing is too slow to do under the lock
+    u32 flags = spin_lock_irqsave(&dl_lock);
+    memcpy(cpu_bw, dl_cpu_bw, sizeof(cpu_bw));
+    for (u32 slot = 0; slot < DL_MAX_TASKS; slot++) {
+        process_t* proc = dl_tasks[slot];
+        if (!proc) {
+            continue;
+        }
+        dl_row_t* row = &rows[nr_rows++];
+        row->pid = proc->pid;
+        row->cpu = proc->dl.cpu;
+        row->runtime = (u32)div_u64(proc->dl.runtime, NSEC_PER_USEC);
+        row->deadline = (u32)div_u64(proc->dl.deadline, NSEC_PER_USEC);
+        row->period = (u32)div_u64(proc->dl.period, NSEC_PER_USEC);
+        row->periods = proc->dl.periods;
+        row->misses = proc->dl.misses;
+        row->overruns = proc->dl.overruns;
+    }
+    u32 rejected = dl_rejected;
+    spin_unlock_irqrestore(&dl_lock, flags);
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\nDeadline bandwidth reserved (limit ");
+    dl_print_column(DL_BW_LIMIT_PERCENT, 0);
+    vga_writestring("%):\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    for (u32 cpu = 0; cpu < smp_num_cpus(); cpu++) {
+        if (!smp_cpu_online(cpu)) {
+            continue;
+        }
+        vga_writestring("  CPU");
+        dl_print_column(cpu, 0);
+        vga_writestring(": ");
+        dl_print_column((u32)(((u64)cpu_bw[cpu] * 100) >> DL_BW_SHIFT), 3);
+        vga_writestring("%\n");
+    }
+    vga_writestring("  Rejected: ");
+    dl_print_column(rejected, 0);
+    vga_writestring("\n");
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\n  PID CPU Runtime Deadline  Period Periods Misses Overruns (us)\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    for (u32 i = 0; i < nr_rows; i++) {
+        dl_print_column(rows[i].pid, 5);
+        dl_print_column(rows[i].cpu, 4);
+        dl_print_column(rows[i].runtime, 8);
+        dl_print_column(rows[i].deadline, 9);
+        dl_print_column(rows[i].period, 8);
+        dl_print_column(rows[i].periods, 8);
+        dl_print_column(rows[i].misses, 7);
+        dl_print_column(rows[i].overruns, 9);
+        vga_writestring("\n");
+    }
+    if (!nr_rows) {
+        vga_writestring("  No deadline tasks\n");
+    }
+    vga_writestring("\n");
+}
@@ -0,0 +1,59 @@
+#ifndef SCHED_DEADLINE_H
+#define SCHED_DEADLINE_H
+
+#include "kernel.h"
+#include "../kernel/timer.h"
+
+// Bandwidth is runtime / period in DL_BW_SHIFT fixed point. Admission keeps
+// each CPU's reserved share under DL_BW_LIMIT_PERCENT so normal tasks still
+// get some time.
+#define DL_BW_SHIFT         20
+#define DL_BW_LIMIT_PERCENT 95
+#define DL_MAX_TASKS        16
+
+// Accepted parameters: runtime <= deadline <= period <= DL_PERIOD_MAX_NS
+#define DL_RUNTIME_MIN_NS   (100 * NSEC_PER_USEC)
+#define DL_PERIOD_MAX_NS    NSEC_PER_SEC
+
+struct process;
+struct runqueue;
+
+// Deadline parameters and constant bandwidth server state of one task. The
+// budget is charged when the task switches out; once it runs dry the task is
+// throttled until the next period.
+typedef struct sched_dl {
+    bool enabled;
+    volatile bool throttled;
+    bool done;                  // Current job finished by yielding
+    u32 slot;                   // Index in the deadline task table
+    u32 cpu;                    // CPU the bandwidth is reserved on
+    u64 runtime;
+    u64 deadline;               // Relative to the period start
+    u64 period;
+    u32 bw;
+    s64 runtime_left;
+    u64 abs_deadline;
+    u64 period_start;
+    u64 exec_start;
+    u64 missed;                 // abs_deadline of the last miss counted
+    ktimer_t timer;             // Replenishment at the next period
+    u32 periods;                // Budget replenishments
+    u32 misses;
+    u32 overruns;
+} sched_dl_t;
+
+// Deadline class functions
+s32 sched_setattr_deadline(struct process* proc, u64 runtime, u64 deadline, u64 period);
+void sched_dl_release(struct process* proc);
+void sched_dl_charge(struct process* proc, u64 now);
+u64 sched_dl_start(struct process* proc, u64 now);
+void sched_dl_wakeup(struct process* proc, u64 now);
+void sched_dl_yield(struct process* proc);
+u32 sched_dl_nr_tasks(void);
+void dl_rq_enqueue(struct runqueue* rq, struct process* proc);
+void dl_rq_dequeue(struct runqueue* rq, struct process* proc);
+u32 sched_dl_run_load(u64 runtime, u64 deadline, u64 period, u64 work);
+u32 sched_dl_stop_loads(void);
+void sched_dl_print_info(void);
+
+#endif // SCHED_DEADLINE_H
@@ -0,0 +1,473 @@
+#include "scheduler.h"
+#include <kernel/kernel.h>
+#include "../lib/string.h"
+#include "../lib/bitops.h"
+#include "../arch/x86/smp.h"
+#include "../kernel/time.h"
+#include "../drivers/vga.h"
+
+static runqueue_t runqueues[NR_CPUS];
+static u32 sched_slice_ms[SCHED_PRIO_LEVELS];
+
+static ktimer_t sched_tick_timer;
+static volatile u32 sched_tick_armed = 0;
+
+static void sched_tick(u32 data);
+
+void sched_init(void) {
+    memset(runqueues, 0, sizeof(runqueues));
+    for (u32 cpu = 0; cpu < NR_CPUS; cpu++) {
+        spin_lock_init(&runqueues[cpu].lock);
+    }
+    
+    for (u32 prio = 0; prio < SCHED_PRIO_LEVELS; prio++) {
+        sched_slice_ms[prio] = SCHED_SLICE_MIN_MS +
+            (SCHED_SLICE_MAX_MS - SCHED_SLICE_MIN_MS) * (SCHED_PRIO_LEVELS - 1 - prio) / (SCHED_PRIO_LEVELS - 1);
+    }
+    
+    timer_setup(&sched_tick_timer, sched_tick, 0);
+}
+
+static void sched_tick_arm(void) {
+    if (!__sync_lock_test_and_set(&sched_tick_armed, 1)) {
+        timer_add(&sched_tick_timer, SCHED_TICK_NS);
+    }
+}
+
+// Runs from the timer softirq on the boot CPU. A CPU whose task has used up
+// its slice while others wait is marked; it switches on the way out of the
+// interrupt. The tick stops once every queue is empty.
+static void sched_tick(u32 data) {
+    (void)data;
+    u64 now = time_ns();
+    
+    __sync_lock_release(&sched_tick_armed);
+    
+    for (u32 cpu = 0; cpu < smp_num_cpus(); cpu++) {
+        cpu_t* c = smp_cpu(cpu);
+        if (!c->online || c->current == c->idle || (!runqueues[cpu].nr_running && !c->curr_deadline)) {
+            continue;
+        }
+        if (now >= c->slice_end && !c->need_resched) {
+            c->need_resched = true;
+            smp_send_reschedule(cpu);
+        }
+    }
+    
+    // Deadline budgets are enforced by this tick too
+    if (sched_nr_running() || sched_dl_nr_tasks()) {
+        sched_tick_arm();
+    }
+}
+
+// Lock the queue a task belongs to; a steal may move it while we wait
+static runqueue_t* task_rq_lock(process_t* proc, u32* flags) {
+    while (1) {
+        u32 cpu = proc->cpu;
+        runqueue_t* rq = &runqueues[cpu];
+        
+        *flags = spin_lock_irqsave(&rq->lock);
+        if (proc->cpu == cpu) {
+            return rq;
+        }
+        spin_unlock_irqrestore(&rq->lock, *flags);
+    }
+}
+
+static void sched_update_prio(process_t* proc) {
+    u32 prio = proc->static_prio;
+    prio = prio > proc->sleep_bonus ? prio - proc->sleep_bonus : 0;
+    proc->prio = (u8)prio;
+}
+
+static bool cpu_is_idle(u32 cpu) {
+    cpu_t* c = smp_cpu(cpu);
+    return c->online && c->current == c->idle;
+}
+
+// Queued tasks plus the one running, so a busy CPU with an empty queue
+// still counts as loaded
+static u32 cpu_load(u32 cpu) {
+    return runqueues[cpu].nr_running + (cpu_is_idle(cpu) ? 0 : 1);
+}
+
+// New tasks start on the least loaded CPU they may run on
+static u32 sched_select_cpu(process_t* proc) {
+    u32 best = (proc->cpus_allowed & (1u << cpu_id())) ? cpu_id() : __ffs(proc->cpus_allowed);
+    u32 best_load = 0xFFFFFFFF;
+    
+    for (u32 cpu = 0; cpu < smp_num_cpus(); cpu++) {
+        if (!smp_cpu_online(cpu) || !(proc->cpus_allowed & (1u << cpu))) {
+            continue;
+        }
+        u32 load = cpu_load(cpu);
+        if (load < best_load) {
+            best = cpu;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+void sched_fork(process_t* proc, u8 static_prio) {
+    proc->static_prio = static_prio < SCHED_PRIO_LEVELS ? static_prio : SCHED_PRIO_LEVELS - 1;
+    proc->sleep_bonus = 0;
+    proc->on_rq = false;
+    proc->on_cpu = false;
+    proc->migrating = false;
+    proc->next = 0;
+    proc->prev = 0;
+    sched_update_prio(proc);
+    proc->cpu = sched_select_cpu(proc);
+}
+
+static void rq_enqueue(runqueue_t* rq, process_t* proc) {
+    if (proc->dl.enabled) {
+        dl_rq_enqueue(rq, proc);
+        return;
+    }
+    
+    u8 prio = proc->prio;
+    proc->next = 0;
+    proc->prev = rq->tail[prio];
+    if (rq->tail[prio]) {
+        rq->tail[prio]->next = proc;
+    } else {
+        rq->head[prio] = proc;
+    }
+    rq->tail[prio] = proc;
+    
+    rq->bitmap |= 1u << prio;
+    rq->nr_running++;
+    proc->on_rq = true;
+}
+
+static void rq_dequeue(runqueue_t* rq, process_t* proc) {
+    if (proc->dl.enabled) {
+        dl_rq_dequeue(rq, proc);
+        return;
+    }
+    
+    u8 prio = proc->prio;
+    if (proc->prev) {
+        proc->prev->next = proc->next;
+    } else {
+        rq->head[prio] = proc->next;
+    }
+    if (proc->next) {
+        proc->next->prev = proc->prev;
+    } else {
+        rq->tail[prio] = proc->prev;
+    }
+    
+    if (!rq->head[prio]) {
+        rq->bitmap &= ~(1u << prio);
+    }
+    proc->next = 0;
+    proc->prev = 0;
+    proc->on_rq = false;
+    rq->nr_running--;
+}
+
+// Wake the target if it is idle or running something less urgent,
+// otherwise some idle CPU that can steal. A deadline task beats any normal
+// task and a later deadline.
+static void sched_kick(u32 target, process_t* proc) {
+    cpu_t* c = smp_cpu(target);
+    bool preempt;
+    
+    if (proc->dl.enabled) {
+        preempt = !c->curr_deadline || proc->dl.abs_deadline < c->curr_deadline;
+    } else {
+        preempt = !c->curr_deadline && proc->prio < c->curr_prio;
+    }
+    
+    if (cpu_is_idle(target) || preempt) {
+        c->need_resched = true;
+        smp_send_reschedule(target);
+        return;
+    }
+    
+    // Deadline tasks are pinned, nobody else may take it
+    if (proc->dl.enabled) {
+        return;
+    }
+    
+    for (u32 cpu = 0; cpu < smp_num_cpus(); cpu++) {
+        if (cpu != cpu_id() && cpu_is_idle(cpu)) {
+            smp_send_reschedule(cpu);
+            return;
+        }
+    }
+}
+
+void sched_set_priority(process_t* proc, u8 static_prio) {
+    u32 flags;
+    runqueue_t* rq = task_rq_lock(proc, &flags);
+    bool queued = proc->on_rq;
+    
+    if (queued) {
+        rq_dequeue(rq, proc);
+    }
+    proc->static_prio = static_prio < SCHED_PRIO_LEVELS ? static_prio : SCHED_PRIO_LEVELS - 1;
+    sched_update_prio(proc);
+    if (queued) {
+        rq_enqueue(rq, proc);
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+// Deadline tasks stay on the CPU their bandwidth was admitted on
+void sched_set_affinity(process_t* proc, u32 cpus_allowed) {
+    if (proc->dl.enabled) {
+        return;
+    }
+    
+    u32 flags;
+    runqueue_t* rq = task_rq_lock(proc, &flags);
+    
+    // A queued task may still be switching out on its old CPU; leave it
+    // there so no other CPU picks it before its registers are saved
+    proc->cpus_allowed = cpus_allowed;
+    bool move = proc->on_rq && !proc->on_cpu && !(cpus_allowed & (1u << proc->cpu));
+    if (move) {
+        rq_dequeue(rq, proc);
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+    
+    // A running task moves at its next requeue
+    if (move) {
+        proc->cpu = sched_select_cpu(proc);
+        sched_enqueue(proc);
+    }
+}
+
+// A throttled deadline task stays off the queue until its replenishment
+// timer queues it. The barrier pairs with the one there, so whichever side
+// runs second sees the other's store and queues the task.
+static bool dl_throttled(process_t* proc) {
+    if (!proc->dl.enabled) {
+        return false;
+    }
+    __sync_synchronize();
+    return proc->dl.throttled;
+}
+
+// Append to the tail of the task's priority level on its CPU. A task
+// terminated since the caller looked at it stays off; process_terminate()
+// sets the state before it takes this lock to dequeue.
+void sched_enqueue(process_t* proc) {
+    u32 flags;
+    runqueue_t* rq = task_rq_lock(proc, &flags);
+    bool queued = false;
+    
+    if (!proc->on_rq && !dl_throttled(proc) && proc->state != PROCESS_STATE_TERMINATED) {
+        rq_enqueue(rq, proc);
+        queued = true;
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+    
+    if (queued) {
+        sched_kick(proc->cpu, proc);
+        sched_tick_arm();
+    }
+}
+
+void sched_dequeue(process_t* proc) {
+    u32 flags;
+    runqueue_t* rq = task_rq_lock(proc, &flags);
+    
+    if (proc->on_rq) {
+        rq_dequeue(rq, proc);
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+// A task that ran until it gave up the CPU goes to the back of its level and
+// loses some of its interactive bonus. It stays on this CPU's queue, without
+// kicking anyone, since this CPU is about to pick again.
+void sched_requeue(process_t* proc) {
+    // Out of budget; the replenishment timer brings it back
+    if (dl_throttled(proc)) {
+        return;
+    }
+    
+    if (proc->sleep_bonus) {
+        proc->sleep_bonus--;
+        sched_update_prio(proc);
+    }
+    
+    // Affinity changed while it ran here. Another CPU could pick it before
+    // the switch away from it completes, so sched_migrate() queues it there
+    // from process_finish_switch().
+    if (!(proc->cpus_allowed & (1u << proc->cpu))) {
+        proc->migrating = true;
+        return;
+    }
+    
+    u32 flags;
+    runqueue_t* rq = task_rq_lock(proc, &flags);
+    if (!proc->on_rq) {
+        rq_enqueue(rq, proc);
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+// Hand a task left off the queue by sched_requeue() to a CPU it may use,
+// now that it is off its old one
+void sched_migrate(process_t* proc) {
+    proc->migrating = false;
+    proc->cpu = sched_select_cpu(proc);
+    sched_enqueue(proc);
+}
+
+// A task coming back from sleep is likely I/O bound; let it run sooner
+void sched_wakeup(process_t* proc) {
+    if (proc->dl.enabled) {
+        sched_dl_wakeup(proc, time_ns());
+    } else if (proc->sleep_bonus < SCHED_MAX_BONUS) {
+        proc->sleep_bonus++;
+        sched_update_prio(proc);
+    }
+    
+    // wake_up_process() already made it READY; a kill since then must stick
+    sched_enqueue(proc);
+}
+
+// Take a task from the busiest other queue, starting with the least urgent
+// level. Tasks still switching out elsewhere (on_cpu) are left alone, as are
+// dead ones. The thief marks its pick on_cpu under the lock, so a concurrent
+// process_terminate() sees it as running.
+static process_t* sched_steal(u32 this_cpu_id) {
+    u32 busiest = this_cpu_id;
+    u32 max_load = 0;
+    
+    for (u32 cpu = 0; cpu < smp_num_cpus(); cpu++) {
+        if (cpu != this_cpu_id && runqueues[cpu].nr_running > max_load) {
+            busiest = cpu;
+            max_load = runqueues[cpu].nr_running;
+        }
+    }
+    if (busiest == this_cpu_id) {
+        return 0;
+    }
+    
+    runqueue_t* rq = &runqueues[busiest];
+    process_t* stolen = 0;
+    
+    spin_lock(&rq->lock);
+    u32 bitmap = rq->bitmap;
+    while (bitmap && !stolen) {
+        u32 prio = fls(bitmap) - 1;
+        for (process_t* p = rq->tail[prio]; p; p = p->prev) {
+            if (!p->on_cpu && p->state != PROCESS_STATE_TERMINATED &&
+                (p->cpus_allowed & (1u << this_cpu_id))) {
+                stolen = p;
+                break;
+            }
+        }
+        bitmap &= ~(1u << prio);
+    }
+    if (stolen) {
+        rq_dequeue(rq, stolen);
+        stolen->cpu = this_cpu_id;
+        stolen->on_cpu = true;
+    }
+    spin_unlock(&rq->lock);
+    
+    if (stolen) {
+        runqueues[this_cpu_id].steals++;
+    }
+    return stolen;
+}
+
+// Called with interrupts off from process_schedule(). The pick is marked
+// on_cpu before the queue lock drops, so process_terminate() either dequeues
+// it first or knows a CPU owns it and leaves the freeing to that CPU.
+process_t* sched_pick_next(void) {
+    u32 cpu = cpu_id();
+    runqueue_t* rq = &runqueues[cpu];
+    process_t* next = 0;
+    
+    spin_lock(&rq->lock);
+    while (!next && (rq->dl_head || rq->bitmap)) {
+        next = rq->dl_head ? rq->dl_head : rq->head[__ffs(rq->bitmap)];
+        rq_dequeue(rq, next);
+        
+        // Dead tasks are only dropped; whoever terminated them frees them
+        if (next->state == PROCESS_STATE_TERMINATED) {
+            next = 0;
+        }
+    }
+    if (next) {
+        next->on_cpu = true;
+    }
+    spin_unlock(&rq->lock);
+    
+    if (!next) {
+        next = sched_steal(cpu);
+    }
+    return next;
+}
+
+bool sched_has_runnable(void) {
+    runqueue_t* rq = &runqueues[cpu_id()];
+    return rq->bitmap != 0 || rq->dl_head != 0;
+}
+
+u32 sched_nr_running(void) {
+    u32 total = 0;
+    for (u32 cpu = 0; cpu < NR_CPUS; cpu++) {
+        total += runqueues[cpu].nr_running;
+    }
+    return total;
+}
+
+u32 sched_cpu_nr_running(u32 cpu) {
+    return runqueues[cpu].nr_running;
+}
+
+u32 sched_cpu_steals(u32 cpu) {
+    return runqueues[cpu].steals;
+}
+
+u64 sched_slice_ns(u8 prio) {
+    return (u64)sched_slice_ms[prio] * NSEC_PER_MSEC;
+}
+
+u32 sched_get_slice(u32 prio) {
+    return prio < SCHED_PRIO_LEVELS ? sched_slice_ms[prio] : 0;
+}
+
+// Takes effect from each task's next slice
+bool sched_set_slice(u32 prio, u32 ms) {
+    if (prio >= SCHED_PRIO_LEVELS || ms == 0 || ms > SCHED_SLICE_LIMIT_MS) {
+        return false;
+    }
+    sched_slice_ms[prio] = ms;
+    return true;
+}
+
+void sched_print_slices(void) {
+    char buf[16];
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\nTimeslice (ms) by priority:\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    
+    for (u32 prio = 0; prio < SCHED_PRIO_LEVELS; prio++) {
+        utoa(prio, buf, 10);
+        vga_writestring(prio < 10 ? "   " : "  ");
+        vga_writestring(buf);
+        vga_writestring(": ");
+        utoa(sched_slice_ms[prio], buf, 10);
+        for (u32 pad = strlen(buf); pad < 4; pad++) {
+            vga_putchar(' ');
+        }
+        vga_writestring(buf);
+        if (prio % 8 == 7) {
+            vga_writestring("\n");
+        }
+    }
+    vga_writestring("\n");
+}
@@ -0,0 +1,61 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "kernel.h"
+#include <kernel/spinlock.h>
+#include "process.h"
+#include "../kernel/timer.h"
+
+// Priority 0 is the most urgent; one FIFO run queue per level and a bitmap
+// of non-empty levels, so picking the next task is a single bsf
+#define SCHED_PRIO_LEVELS   32
+#define SCHED_PRIO_DEFAULT  16
+
+// Tasks that keep waking up from sleep are treated as interactive and run
+// up to SCHED_MAX_BONUS levels above their static priority
+#define SCHED_MAX_BONUS     4
+
+// Timeslices by priority: the most urgent level gets the longest slice,
+// scaling linearly down to the shortest at the least urgent level
+#define SCHED_SLICE_MAX_MS  100
+#define SCHED_SLICE_MIN_MS  5
+#define SCHED_SLICE_LIMIT_MS 1000
+
+// The preemption tick runs at wheel resolution, and only while tasks wait
+#define SCHED_TICK_NS       TIMER_TICK_NS
+
+// Every CPU owns a run queue; an idle CPU steals from the busiest one.
+// Deadline tasks sit on their own list ahead of every priority level and are
+// never stolen (see sched_deadline.h).
+typedef struct runqueue {
+    spinlock_t lock;
+    u32 bitmap;
+    process_t* head[SCHED_PRIO_LEVELS];
+    process_t* tail[SCHED_PRIO_LEVELS];
+    process_t* dl_head;
+    u32 dl_nr_running;
+    u32 nr_running;
+    u32 steals;             // Tasks this CPU pulled from others
+} runqueue_t;
+
+// Scheduler functions
+void sched_init(void);
+void sched_fork(process_t* proc, u8 static_prio);
+void sched_set_priority(process_t* proc, u8 static_prio);
+void sched_set_affinity(process_t* proc, u32 cpus_allowed);
+void sched_enqueue(process_t* proc);
+void sched_dequeue(process_t* proc);
+void sched_requeue(process_t* proc);
+void sched_migrate(process_t* proc);
+void sched_wakeup(process_t* proc);
+process_t* sched_pick_next(void);
+bool sched_has_runnable(void);
+u32 sched_nr_running(void);
+u32 sched_cpu_nr_running(u32 cpu);
+u32 sched_cpu_steals(u32 cpu);
+u64 sched_slice_ns(u8 prio);
+u32 sched_get_slice(u32 prio);
+bool sched_set_slice(u32 prio, u32 ms);
+void sched_print_slices(void);
+
+#endif // SCHEDULER_H
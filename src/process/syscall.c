@@ -4,74 +4,318 @@
 #include "vga.h"
 #include "process.h"
 #include "audit.h"
+#include "../trace/tracepoint.h"
+#include "../kernel/timer.h"
+#include "ioring.h"
+#include "futex.h"
+#include <kernel/irqflags.h>
+#include "../lib/bitops.h"
+#include "../lib/div64.h"
 
-static void sys_write(const char* str, u32 len) {
+// Copied through a small stack buffer so no heap allocation is needed per call
+s32 sys_write(const char* str, u32 len) {
     if (!memory_validate_user_ptr(str, len)) {
         audit_log_event(AUDIT_INVALID_POINTER, (u32)str, len, 0, 0);
-        return;
+        return -1;
     }
     
-
-    char* safe_str = (char*)kmalloc(len + 1);
-    if (!safe_str) {
-        return;
+    char chunk[SYSCALL_WRITE_CHUNK + 1];
+    for (u32 done = 0; done < len; ) {
+        u32 count = len - done;
+        if (count > SYSCALL_WRITE_CHUNK) {
+            count = SYSCALL_WRITE_CHUNK;
+        }
+        
+        memcpy(chunk, str + done, count);
+        chunk[count] = '\0';
+        security_sanitize_string(chunk, count + 1);
+        vga_writestring(chunk);
+        
+        done += count;
     }
     
-    memcpy(safe_str, str, len);
-    safe_str[len] = '\0';
-    security_sanitize_string(safe_str, len + 1);
-    
-    vga_writestring(safe_str);
-    kfree(safe_str);
+    return (s32)len;
 }
 
-static void sys_read(char* buf, u32 len) {
+s32 sys_read(char* buf, u32 len) {
     if (!memory_validate_user_ptr(buf, len)) {
         audit_log_event(AUDIT_INVALID_POINTER, (u32)buf, len, 0, 0);
-        return;
+        return -1;
     }
     
 
     memset(buf, 0, len);
+    return 0;
 }
 
 static void sys_exit(u32 code) {
     (void)code;
-    process_t* current = process_get_current();
-    if (current) {
-        process_terminate(current->pid);
+    process_exit();
+}
+
+// ebx = seconds, ecx = nanoseconds, like the fields of a timespec
+static s32 sys_nanosleep(u32 seconds, u32 nanoseconds) {
+    if (nanoseconds >= NSEC_PER_SEC) {
+        return -1;
     }
+    
+    nanosleep((u64)seconds * NSEC_PER_SEC + nanoseconds);
+    return 0;
+}
+
+// Register-level entry points: arguments arrive as ebx, ecx, edx
+static s32 entry_write(u32 buf, u32 len, u32 unused) {
+    (void)unused;
+    return sys_write((const char*)buf, len);
+}
+
+static s32 entry_read(u32 buf, u32 len, u32 unused) {
+    (void)unused;
+    return sys_read((char*)buf, len);
+}
+
+static s32 entry_exit(u32 code, u32 unused1, u32 unused2) {
+    (void)unused1;
+    (void)unused2;
+    sys_exit(code);
+    return 0;
+}
+
+static s32 entry_nanosleep(u32 seconds, u32 nanoseconds, u32 unused) {
+    (void)unused;
+    return sys_nanosleep(seconds, nanoseconds);
+}
+
+static s32 entry_ioring_setup(u32 flags, u32 unused1, u32 unused2) {
+    (void)unused1;
+    (void)unused2;
+    return ioring_setup(process_get_current(), flags);
+}
+
+static s32 entry_ioring_enter(u32 to_submit, u32 min_complete, u32 flags) {
+    return ioring_enter(process_get_current(), to_submit, min_complete, flags);
+}
+
+static s32 entry_futex(u32 uaddr, u32 op, u32 val) {
+    return futex_syscall(uaddr, op, val);
 }
 
+static const syscall_desc_t syscall_table[NR_SYSCALLS] = {
+    [SYS_WRITE]        = { "write",        entry_write,        2, SYSCALL_F_AUDIT },
+    [SYS_READ]         = { "read",         entry_read,         2, SYSCALL_F_AUDIT },
+    [SYS_EXIT]         = { "exit",         entry_exit,         1, SYSCALL_F_AUDIT | SYSCALL_F_NORETURN },
+    [SYS_NANOSLEEP]    = { "nanosleep",    entry_nanosleep,    2, SYSCALL_F_AUDIT },
+    [SYS_IORING_SETUP] = { "ioring_setup", entry_ioring_setup, 1, SYSCALL_F_AUDIT },
+    [SYS_IORING_ENTER] = { "ioring_enter", entry_ioring_enter, 3, SYSCALL_F_AUDIT },
+    [SYS_FUTEX]        = { "futex",        entry_futex,        3, 0 },
+};
+
+static syscall_stat_t syscall_stats[NR_SYSCALLS];
+static u32 syscall_unknown = 0;
+
 void syscall_handler(struct registers* regs) {
+    TRACE_EVENT(syscall_entry, regs->eax, regs->ebx);
+    
     if (!security_validate_privilege(RING_3)) {
         audit_log_event(AUDIT_PRIVILEGE_VIOLATION, regs->eax, 0, 0, 0);
         return;
     }
     
+    u32 syscall_num = regs->eax;
+    if (syscall_num >= NR_SYSCALLS || !syscall_table[syscall_num].handler) {
+        audit_log_event(AUDIT_SYSCALL, regs->eax, regs->ebx, regs->ecx, regs->edx);
+        syscall_unknown++;
+        regs->eax = (u32)-1;
+        return;
+    }
+    
+    const syscall_desc_t* desc = &syscall_table[syscall_num];
+    syscall_stat_t* stat = &syscall_stats[syscall_num];
+    
+    if (desc->flags & SYSCALL_F_AUDIT) {
+        audit_log_event(AUDIT_SYSCALL, regs->eax, regs->ebx, regs->ecx, regs->edx);
+    }
+    
+    // Count before calling so a call that never returns is still seen
+    stat->calls++;
+    process_get_current()->acct.syscalls++;
+    
+    u64 start = rdtsc();
+    s32 result = desc->handler(regs->ebx, regs->ecx, regs->edx);
+    u64 delta = rdtsc() - start;
+    
+    u32 cycles = delta > 0xFFFFFFFF ? 0xFFFFFFFF : (u32)delta;
+    u32 bucket = fls(cycles);
+    stat->cycles += cycles;
+    stat->histogram[bucket < SYSCALL_HIST_BUCKETS ? bucket : SYSCALL_HIST_BUCKETS - 1]++;
+    if (cycles > stat->max_cycles) {
+        stat->max_cycles = cycles;
+    }
+    if (result < 0) {
+        stat->errors++;
+    }
+    
+    regs->eax = (u32)result;
+}
+
+const syscall_stat_t* syscall_get_stat(u32 nr) {
+    return nr < NR_SYSCALLS ? &syscall_stats[nr] : 0;
+}
+
+void syscall_stats_reset(void) {
+    u32 flags = local_irq_save();
+    memset(syscall_stats, 0, sizeof(syscall_stats));
+    syscall_unknown = 0;
+    local_irq_restore(flags);
+}
 
-    audit_log_event(AUDIT_SYSCALL, regs->eax, regs->ebx, regs->ecx, regs->edx);
+static void syscall_print_column(u32 value, u32 width) {
+    char buf[32];
+    utoa(value, buf, 10);
+    for (u32 pad = strlen(buf); pad < width; pad++) {
+        vga_putchar(' ');
+    }
+    vga_writestring(buf);
+}
+
+void syscall_print_stats(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\nNr  Name             Args      Calls   Errors   AvgCyc     MaxCyc\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
     
+    for (u32 nr = 0; nr < NR_SYSCALLS; nr++) {
+        const syscall_desc_t* desc = &syscall_table[nr];
+        syscall_stat_t* stat = &syscall_stats[nr];
+        if (!desc->handler) {
+            continue;
+        }
+        
+        u32 avg = stat->calls ? (u32)div_u64(stat->cycles, stat->calls) : 0;
+        
+        syscall_print_column(nr, 2);
+        vga_writestring("  ");
+        vga_writestring(desc->name);
+        for (u32 pad = strlen(desc->name); pad < 15; pad++) {
+            vga_putchar(' ');
+        }
+        syscall_print_column(desc->nargs, 6);
+        syscall_print_column(stat->calls, 11);
+        syscall_print_column(stat->errors, 9);
+        syscall_print_column(avg, 9);
+        syscall_print_column(stat->max_cycles, 11);
+        vga_writestring("\n");
+    }
+    
+    if (syscall_unknown) {
+        vga_writestring("Unknown system call numbers: ");
+        syscall_print_column(syscall_unknown, 0);
+        vga_writestring("\n");
+    }
+    vga_writestring("\n");
+}
 
-    u32 syscall_num = regs->eax;
+void syscall_print_histogram(u32 nr) {
+    if (nr >= NR_SYSCALLS || !syscall_table[nr].handler) {
+        vga_writestring("Unknown system call.\n");
+        return;
+    }
+    
+    syscall_stat_t* stat = &syscall_stats[nr];
     
-    switch (syscall_num) {
-        case SYS_WRITE:
-            sys_write((const char*)regs->ebx, regs->ecx);
-            break;
-        case SYS_READ:
-            sys_read((char*)regs->ebx, regs->ecx);
-            break;
-        case SYS_EXIT:
-            sys_exit(regs->ebx);
-            break;
-        default:
-            break;
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\n");
+    vga_writestring(syscall_table[nr].name);
+    vga_writestring(" cycles    Count\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    
+    for (u32 i = 0; i < SYSCALL_HIST_BUCKETS; i++) {
+        if (!stat->histogram[i]) {
+            continue;
+        }
+        
+        // Bucket i holds [2^(i-1), 2^i); the last one is open ended
+        vga_writestring(i == SYSCALL_HIST_BUCKETS - 1 ? ">=" : "< ");
+        syscall_print_column(i == SYSCALL_HIST_BUCKETS - 1 ? 1U << (i - 1) : 1U << i, 12);
+        syscall_print_column(stat->histogram[i], 8);
+        vga_writestring("\n");
     }
+    vga_writestring("\n");
 }
 
-void syscall_init(void) {
+static bool sysenter_active = false;
+
+// Ring 0 stack for user entries until a process installs its own
+static u8 syscall_boot_stack[4096] __attribute__((aligned(16)));
+
+// Called from sysenter_entry; SYSENTER cleared IF just like the int 0x80 gate
+void sysenter_dispatch(struct registers* regs) {
+    trace_hardirqs_off(regs->eip);
+    acct_user_exit();
+    syscall_handler(regs);
+    
+    // SYSEXIT always returns to user mode, a safe point to give up the CPU
+    if (need_resched()) {
+        process_preempt();
+    }
+    acct_user_enter();
+    trace_hardirqs_on(_THIS_IP_);
+}
 
-    idt_set_gate(0x80, (u32)syscall_handler, KERNEL_CODE_SEGMENT, 0xEE);
+bool sysenter_enabled(void) {
+    return sysenter_active;
+}
+
+void sysenter_set_stack(u32 esp) {
+    if (sysenter_active) {
+        wrmsr(IA32_SYSENTER_ESP, esp);
+    }
+}
+
+static bool sysenter_supported(void) {
+    u32 eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    
+    if (!(edx & CPUID_EDX_SEP)) {
+        return false;
+    }
+    
+    // Early Pentium Pro parts report SEP without implementing it
+    u32 family = (eax >> 8) & 0xF;
+    u32 model = (eax >> 4) & 0xF;
+    u32 stepping = eax & 0xF;
+    return !(family == 6 && model < 3 && stepping < 3);
+}
+
+// The SYSENTER MSRs are per CPU; APs call this while coming up
+void syscall_init_cpu(void) {
+    if (!sysenter_active) {
+        return;
+    }
+    
+    // SYSEXIT derives the user selectors from this one (CS + 16, CS + 24),
+    // which matches the GDT layout in gdt_init_cpu()
+    wrmsr(IA32_SYSENTER_CS, KERNEL_CODE_SEGMENT);
+    wrmsr(IA32_SYSENTER_EIP, (u32)sysenter_entry);
+}
+
+void syscall_init(void) {
+    futex_init();
+    
+    // int 0x80 goes through the common stub like any other vector
+    idt_set_gate(SYSCALL_VECTOR, isr_stub_table[SYSCALL_VECTOR], KERNEL_CODE_SEGMENT, 0xEE);
+    register_interrupt_handler(SYSCALL_VECTOR, syscall_handler);
+    
+    if (!sysenter_supported()) {
+        return;
+    }
+    
+    sysenter_active = true;
+    syscall_init_cpu();
+    
+    if (tss_get_kernel_stack()) {
+        sysenter_set_stack(tss_get_kernel_stack());
+    } else {
+        tss_set_kernel_stack(KERNEL_DATA_SEGMENT, (u32)syscall_boot_stack + sizeof(syscall_boot_stack));
+    }
 }
 
@@ -8,9 +8,67 @@
 #define SYS_WRITE 1
 #define SYS_READ  2
 #define SYS_EXIT  3
+#define SYS_NANOSLEEP 4
+#define SYS_IORING_SETUP 5
+#define SYS_IORING_ENTER 6
+#define SYS_FUTEX        7
+#define NR_SYSCALLS      8
+
+// Descriptor flags
+#define SYSCALL_F_AUDIT    0x1  // Log an AUDIT_SYSCALL entry for every call
+#define SYSCALL_F_NORETURN 0x2  // Does not return to the caller on success
+
+// Handler cycle histogram: bucket n counts calls of [2^(n-1), 2^n) cycles
+#define SYSCALL_HIST_BUCKETS 24
+
+// Handlers take ebx, ecx, edx and return a value for eax, negative on error
+typedef s32 (*syscall_fn_t)(u32 arg0, u32 arg1, u32 arg2);
+
+typedef struct {
+    const char* name;
+    syscall_fn_t handler;
+    u8 nargs;
+    u8 flags;
+} syscall_desc_t;
+
+typedef struct {
+    u32 calls;
+    u32 errors;
+    u32 max_cycles;
+    u64 cycles;
+    u32 histogram[SYSCALL_HIST_BUCKETS];
+} syscall_stat_t;
+
+#define SYSCALL_VECTOR 0x80
+
+// Largest piece of a user string sanitized and printed at once
+#define SYSCALL_WRITE_CHUNK 128
+
+// SYSENTER model-specific registers
+#define IA32_SYSENTER_CS  0x174
+#define IA32_SYSENTER_ESP 0x175
+#define IA32_SYSENTER_EIP 0x176
+#define CPUID_EDX_SEP     (1 << 11)
 
 // System call functions
 void syscall_init(void);
+void syscall_init_cpu(void);
 void syscall_handler(struct registers* regs);
 
+// Operation bodies, shared with the submission ring
+s32 sys_write(const char* str, u32 len);
+s32 sys_read(char* buf, u32 len);
+
+// Per-syscall statistics
+const syscall_stat_t* syscall_get_stat(u32 nr);
+void syscall_stats_reset(void);
+void syscall_print_stats(void);
+void syscall_print_histogram(u32 nr);
+
+// SYSENTER fast path, int 0x80 stays available as the fallback
+bool sysenter_enabled(void);
+void sysenter_set_stack(u32 esp);
+void sysenter_dispatch(struct registers* regs);
+extern void sysenter_entry(void);
+
 #endif // SYSCALL_H
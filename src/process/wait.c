@@ -0,0 +1,167 @@
+#include "wait.h"
+#include <kernel/kernel.h>
+#include "scheduler.h"
+#include "../kernel/timer.h"
+
+void wait_queue_init(wait_queue_head_t* wq) {
+    spin_lock_init(&wq->lock);
+    wq->head = 0;
+    wq->tail = 0;
+}
+
+void wait_entry_init(wait_queue_entry_t* entry) {
+    entry->task = process_get_current();
+    entry->next = 0;
+    entry->prev = 0;
+    entry->key = 0;
+    entry->queued = false;
+}
+
+static void wait_list_add(wait_queue_head_t* wq, wait_queue_entry_t* entry) {
+    entry->next = 0;
+    entry->prev = wq->tail;
+    if (wq->tail) {
+        wq->tail->next = entry;
+    } else {
+        wq->head = entry;
+    }
+    wq->tail = entry;
+    entry->queued = true;
+}
+
+static void wait_list_del(wait_queue_head_t* wq, wait_queue_entry_t* entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        wq->head = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        wq->tail = entry->prev;
+    }
+    entry->next = 0;
+    entry->prev = 0;
+    entry->queued = false;
+}
+
+// Queue the entry if a wakeup already took it off, and mark the task
+// blocked. The lock orders the state store before the caller's test.
+void prepare_to_wait(wait_queue_head_t* wq, wait_queue_entry_t* entry) {
+    process_t* task = entry->task;
+    u32 flags = spin_lock_irqsave(&wq->lock);
+    
+    if (!entry->queued) {
+        wait_list_add(wq, entry);
+    }
+    task->wait_queue = wq;
+    task->wait_entry = entry;
+    task->state = PROCESS_STATE_BLOCKED;
+    
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void finish_wait(wait_queue_head_t* wq, wait_queue_entry_t* entry) {
+    process_t* task = entry->task;
+    u32 flags = spin_lock_irqsave(&wq->lock);
+    
+    task->state = PROCESS_STATE_RUNNING;
+    if (entry->queued) {
+        wait_list_del(wq, entry);
+    }
+    task->wait_queue = 0;
+    task->wait_entry = 0;
+    
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// A task killed while blocked must not leave its stack entry behind
+void wait_abort(process_t* proc) {
+    wait_queue_head_t* wq = proc->wait_queue;
+    if (!wq) {
+        return;
+    }
+    
+    u32 flags = spin_lock_irqsave(&wq->lock);
+    if (proc->wait_entry && proc->wait_entry->queued) {
+        wait_list_del(wq, proc->wait_entry);
+    }
+    proc->wait_queue = 0;
+    proc->wait_entry = 0;
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// Only a blocked task is queued; one already running or runnable will
+// test its condition again anyway
+bool wake_up_process(process_t* proc) {
+    if (!__sync_bool_compare_and_swap(&proc->state, PROCESS_STATE_BLOCKED, PROCESS_STATE_READY)) {
+        return false;
+    }
+    sched_wakeup(proc);
+    return true;
+}
+
+// Entries are removed as they are woken, so each waiter re-queues itself
+// in prepare_to_wait() if its condition still does not hold
+static void wake_up_nr(wait_queue_head_t* wq, u32 nr) {
+    u32 flags = spin_lock_irqsave(&wq->lock);
+    
+    while (wq->head && nr) {
+        wait_queue_entry_t* entry = wq->head;
+        wait_list_del(wq, entry);
+        if (wake_up_process(entry->task)) {
+            nr--;
+        }
+    }
+    
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wake_up(wait_queue_head_t* wq) {
+    wake_up_nr(wq, 0xFFFFFFFF);
+}
+
+void wake_up_one(wait_queue_head_t* wq) {
+    wake_up_nr(wq, 1);
+}
+
+// Take up to nr entries with a matching key off the queue and wake their
+// tasks. Returns how many were taken off; a waiter that finds itself
+// dequeued knows it was chosen, even if it was already running.
+u32 wake_up_key(wait_queue_head_t* wq, u32 key, u32 nr) {
+    u32 woken = 0;
+    u32 flags = spin_lock_irqsave(&wq->lock);
+    
+    wait_queue_entry_t* entry = wq->head;
+    while (entry && woken < nr) {
+        wait_queue_entry_t* next = entry->next;
+        if (entry->key == key) {
+            wait_list_del(wq, entry);
+            wake_up_process(entry->task);
+            woken++;
+        }
+        entry = next;
+    }
+    
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return woken;
+}
+
+bool wait_queue_active(wait_queue_head_t* wq) {
+    return wq->head != 0;
+}
+
+static void schedule_timeout_expired(u32 data) {
+    wake_up_process((process_t*)data);
+}
+
+// Switch away until woken or until ns have passed. The caller has already
+// marked itself blocked; returns true if something else woke it first.
+bool schedule_timeout(u64 ns) {
+    ktimer_t timer;
+    
+    timer_setup(&timer, schedule_timeout_expired, (u32)process_get_current());
+    timer_add(&timer, ns);
+    process_schedule();
+    return timer_del(&timer);
+}
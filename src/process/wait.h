@@ -0,0 +1,77 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+#include "kernel.h"
+#include <kernel/spinlock.h>
+#include "process.h"
+#include "../kernel/time.h"
+
+// One sleeping task; lives on the waiter's stack for the length of the wait.
+// key lets several kinds of waiter share one queue (see wake_up_key()).
+typedef struct wait_queue_entry {
+    struct process* task;
+    struct wait_queue_entry* next;
+    struct wait_queue_entry* prev;
+    u32 key;
+    bool queued;
+} wait_queue_entry_t;
+
+// Tasks blocked until some event; wakers run from any context, including
+// interrupt handlers and softirqs
+typedef struct wait_queue_head {
+    spinlock_t lock;
+    wait_queue_entry_t* head;
+    wait_queue_entry_t* tail;
+} wait_queue_head_t;
+
+#define WAIT_QUEUE_HEAD_INIT { SPINLOCK_INIT, 0, 0 }
+
+// Wait queue functions
+void wait_queue_init(wait_queue_head_t* wq);
+void wait_entry_init(wait_queue_entry_t* entry);
+void prepare_to_wait(wait_queue_head_t* wq, wait_queue_entry_t* entry);
+void finish_wait(wait_queue_head_t* wq, wait_queue_entry_t* entry);
+void wait_abort(struct process* proc);
+void wake_up(wait_queue_head_t* wq);
+void wake_up_one(wait_queue_head_t* wq);
+u32 wake_up_key(wait_queue_head_t* wq, u32 key, u32 nr);
+bool wake_up_process(struct process* proc);
+bool wait_queue_active(wait_queue_head_t* wq);
+bool schedule_timeout(u64 ns);
+
+// Block the current task until cond holds. The task is queued and marked
+// blocked before cond is tested, so a wake_up() between the test and the
+// switch just makes it runnable again.
+#define wait_event(wq, cond) do {                           \
+    wait_queue_entry_t __wait;                              \
+    wait_entry_init(&__wait);                               \
+    while (1) {                                             \
+        prepare_to_wait(&(wq), &__wait);                    \
+        if (cond) {                                         \
+            break;                                          \
+        }                                                   \
+        process_schedule();                                 \
+    }                                                       \
+    finish_wait(&(wq), &__wait);                            \
+} while (0)
+
+// As wait_event() but gives up after ns; evaluates to cond at the end
+#define wait_event_timeout(wq, cond, ns) ({                 \
+    wait_queue_entry_t __wait;                              \
+    u64 __deadline = time_ns() + (ns);                      \
+    bool __done;                                            \
+    wait_entry_init(&__wait);                               \
+    while (1) {                                             \
+        prepare_to_wait(&(wq), &__wait);                    \
+        __done = (cond);                                    \
+        u64 __now = time_ns();                              \
+        if (__done || __now >= __deadline) {                \
+            break;                                          \
+        }                                                   \
+        schedule_timeout(__deadline - __now);               \
+    }                                                       \
+    finish_wait(&(wq), &__wait);                            \
+    __done;                                                 \
+})
+
+#endif // WAIT_H
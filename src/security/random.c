@@ -4,12 +4,6 @@
 // Xorshift128+ state
 static u64 random_state[2];
 
-static u64 rdtsc(void) {
-    u32 low, high;
-    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
-    return ((u64)high << 32) | low;
-}
-
 void random_init(void) {
     // Gather entropy from multiple sources
     u64 entropy1 = rdtsc();
@@ -1,4 +1,5 @@
 #include "security.h"`n#include "../lib/string.h"`n#include <kernel/memory.h>`n#include "random.h"`n#include "audit.h"
+#include "../trace/boottime.h"
 #include "memory.h"
 #include "string.h"
 #include "random.h"
@@ -8,6 +9,7 @@ static u32 stack_canary = STACK_CANARY_VALUE;
 
 void security_init(void) {
     random_init();
+    boottime_mark("random_init");
     stack_canary = random_get();
     audit_init();
 }
@@ -0,0 +1,90 @@
+#include "boottime.h"
+#include <kernel/kernel.h>
+#include "../drivers/vga.h"
+#include "../drivers/serial.h"
+#include "../lib/string.h"
+#include "../lib/div64.h"
+
+// TSC sampled by _start in boot.asm before anything else runs
+extern u32 boot_tsc_entry[2];
+
+static boottime_stage_t boottime_stages[BOOTTIME_MAX_STAGES];
+static u32 boottime_count = 0;
+
+void boottime_start(void) {
+    boottime_stages[0].name = "multiboot entry";
+    boottime_stages[0].tsc = ((u64)boot_tsc_entry[1] << 32) | boot_tsc_entry[0];
+    boottime_count = 1;
+    boottime_mark("boot.asm");
+}
+
+void boottime_mark(const char* name) {
+    if (boottime_count >= BOOTTIME_MAX_STAGES) {
+        return;
+    }
+    boottime_stages[boottime_count].name = name;
+    boottime_stages[boottime_count].tsc = rdtsc();
+    boottime_count++;
+}
+
+static void boottime_print(void (*write)(const char*)) {
+    char buf[32];
+    
+    if (boottime_count < 2) {
+        write("No boot stages recorded.\n");
+        return;
+    }
+    
+    u64 total = boottime_stages[boottime_count - 1].tsc - boottime_stages[0].tsc;
+    u32 total_k = (u32)div_u64(total, 1000);
+    if (total_k == 0) {
+        total_k = 1;
+    }
+    
+    write("  stage                  kcycles      %\n");
+    
+    // Each mark closes the stage that started at the previous one
+    for (u32 i = 1; i < boottime_count; i++) {
+        u32 kcycles = (u32)div_u64(boottime_stages[i].tsc - boottime_stages[i - 1].tsc, 1000);
+        
+        write("  ");
+        write(boottime_stages[i].name);
+        for (u32 pad = strlen(boottime_stages[i].name); pad < 18; pad++) {
+            write(" ");
+        }
+        
+        utoa(kcycles, buf, 10);
+        for (u32 pad = strlen(buf); pad < 12; pad++) {
+            write(" ");
+        }
+        write(buf);
+        
+        utoa((u32)div_u64((u64)kcycles * 100, total_k), buf, 10);
+        for (u32 pad = strlen(buf); pad < 6; pad++) {
+            write(" ");
+        }
+        write(buf);
+        write("%\n");
+    }
+    
+    write("  total             ");
+    u64toa(div_u64(total, 1000), buf, 10);
+    for (u32 pad = strlen(buf); pad < 12; pad++) {
+        write(" ");
+    }
+    write(buf);
+    write("\n");
+}
+
+void boottime_report(void) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\n=== Boot Time ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    boottime_print(vga_writestring);
+    vga_writestring("\n");
+}
+
+void boottime_report_serial(void) {
+    serial_writestring("LainKernel boot time:\n");
+    boottime_print(serial_writestring);
+}
@@ -0,0 +1,19 @@
+#ifndef BOOTTIME_H
+#define BOOTTIME_H
+
+#include <kernel/kernel.h>
+
+#define BOOTTIME_MAX_STAGES 24
+
+typedef struct {
+    const char* name;
+    u64 tsc;
+} boottime_stage_t;
+
+// Boot-time profiling functions
+void boottime_start(void);
+void boottime_mark(const char* name);
+void boottime_report(void);
+void boottime_report_serial(void);
+
+#endif // BOOTTIME_H
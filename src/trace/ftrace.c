@@ -0,0 +1,276 @@
+#include "ftrace.h"
+#include <kernel/kernel.h>
+#include <kernel/irqflags.h>
+#include "../kernel/ksyms.h"
+#include "../drivers/vga.h"
+#include "../lib/string.h"
+
+typedef struct {
+    u32 func;
+    u32 calls;
+    u64 cycles;
+} ftrace_stat_t;
+
+static ftrace_cpu_t ftrace_cpus[NR_CPUS];
+static volatile bool ftrace_enabled = false;
+
+// Graph filter: when non-empty, only calls made beneath these functions are recorded
+static u32 ftrace_filters[FTRACE_MAX_FILTERS];
+static u32 ftrace_filter_count = 0;
+
+static ftrace_stat_t ftrace_stats[FTRACE_STATS_SLOTS];
+
+static NOTRACE bool ftrace_filtered(u32 func) {
+    for (u32 i = 0; i < ftrace_filter_count; i++) {
+        if (ftrace_filters[i] == func) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static NOTRACE void ftrace_record(ftrace_cpu_t* cpu, u32 func, u32 call_site, u32 depth, u32 exit) {
+    ftrace_entry_t* entry = &cpu->ring[cpu->head % FTRACE_RING_SIZE];
+    entry->tsc = rdtsc();
+    entry->func = func;
+    entry->call_site = call_site;
+    entry->info = (depth << 1) | exit;
+    cpu->head++;
+}
+
+void __cyg_profile_func_enter(void* func, void* call_site) {
+    if (!ftrace_enabled) {
+        return;
+    }
+    
+    // Interrupts off keeps depth and ring updates atomic against nested IRQs
+    u32 flags = raw_local_irq_save();
+    ftrace_cpu_t* cpu = &ftrace_cpus[cpu_id()];
+    u32 depth = cpu->depth++;
+    
+    if (ftrace_filter_count && cpu->graph_depth < 0 && ftrace_filtered((u32)func)) {
+        cpu->graph_depth = depth;
+    }
+    if (!ftrace_filter_count || cpu->graph_depth >= 0) {
+        ftrace_record(cpu, (u32)func, (u32)call_site, depth, 0);
+    }
+    
+    raw_local_irq_restore(flags);
+}
+
+void __cyg_profile_func_exit(void* func, void* call_site) {
+    if (!ftrace_enabled) {
+        return;
+    }
+    
+    u32 flags = raw_local_irq_save();
+    ftrace_cpu_t* cpu = &ftrace_cpus[cpu_id()];
+    
+    // Tracing may start mid-stack, so unmatched exits stay at depth 0
+    if (cpu->depth > 0) {
+        cpu->depth--;
+    }
+    
+    if (!ftrace_filter_count || cpu->graph_depth >= 0) {
+        ftrace_record(cpu, (u32)func, (u32)call_site, cpu->depth, FTRACE_ENTRY_EXIT);
+        if ((s32)cpu->depth == cpu->graph_depth) {
+            cpu->graph_depth = -1;
+        }
+    }
+    
+    raw_local_irq_restore(flags);
+}
+
+bool ftrace_available(void) {
+#ifdef CONFIG_FTRACE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void ftrace_start(void) {
+    u32 flags = raw_local_irq_save();
+    for (u32 i = 0; i < NR_CPUS; i++) {
+        ftrace_cpus[i].head = 0;
+        ftrace_cpus[i].depth = 0;
+        ftrace_cpus[i].graph_depth = -1;
+    }
+    ftrace_enabled = true;
+    raw_local_irq_restore(flags);
+}
+
+void ftrace_stop(void) {
+    ftrace_enabled = false;
+}
+
+bool ftrace_filter_add(const char* name) {
+    u32 addr = ksym_lookup_name(name);
+    if (!addr || ftrace_filter_count >= FTRACE_MAX_FILTERS) {
+        return false;
+    }
+    ftrace_filters[ftrace_filter_count++] = addr;
+    return true;
+}
+
+void ftrace_filter_clear(void) {
+    ftrace_filter_count = 0;
+}
+
+static u32 ftrace_window_start(u32 head) {
+    return head > FTRACE_RING_SIZE ? head - FTRACE_RING_SIZE : 0;
+}
+
+// The reports call into traced code such as the VGA driver, so they stop
+// recording while they walk the ring and work from one snapshot of head
+static bool ftrace_pause(void) {
+    bool was_enabled = ftrace_enabled;
+    ftrace_enabled = false;
+    return was_enabled;
+}
+
+static void ftrace_print_cycles(u64 cycles) {
+    char buf[32];
+    if (cycles > 0xFFFFFFFF) {
+        utoa((u32)(cycles >> 20), buf, 10);
+        vga_writestring(buf);
+        vga_writestring("M cyc");
+    } else {
+        utoa((u32)cycles, buf, 10);
+        vga_writestring(buf);
+        vga_writestring(" cyc");
+    }
+}
+
+void ftrace_dump(u32 count) {
+    bool was_enabled = ftrace_pause();
+    ftrace_cpu_t* cpu = &ftrace_cpus[cpu_id()];
+    u32 head = cpu->head;
+    u32 start = ftrace_window_start(head);
+    if (head - start > count) {
+        start = head - count;
+    }
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\n=== Function Trace ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    
+    for (u32 i = start; i < head; i++) {
+        ftrace_entry_t* entry = &cpu->ring[i % FTRACE_RING_SIZE];
+        u32 depth = entry->info >> 1;
+        
+        for (u32 d = 0; d < depth && d < 20; d++) {
+            vga_writestring("  ");
+        }
+        
+        if (entry->info & FTRACE_ENTRY_EXIT) {
+            vga_writestring("}\n");
+            continue;
+        }
+        
+        vga_writestring(ksym_lookup(entry->func, 0));
+        
+        // Collapse a leaf call into a single line with its duration
+        if (i + 1 < head) {
+            ftrace_entry_t* next = &cpu->ring[(i + 1) % FTRACE_RING_SIZE];
+            if ((next->info & FTRACE_ENTRY_EXIT) && next->func == entry->func) {
+                vga_writestring("(); ");
+                ftrace_print_cycles(next->tsc - entry->tsc);
+                vga_writestring("\n");
+                i++;
+                continue;
+            }
+        }
+        vga_writestring("() {\n");
+    }
+    vga_writestring("\n");
+    ftrace_enabled = was_enabled;
+}
+
+static ftrace_stat_t* ftrace_stat_slot(u32 func) {
+    u32 slot = (func >> 2) % FTRACE_STATS_SLOTS;
+    for (u32 probe = 0; probe < FTRACE_STATS_SLOTS; probe++) {
+        ftrace_stat_t* stat = &ftrace_stats[(slot + probe) % FTRACE_STATS_SLOTS];
+        if (stat->func == func || stat->func == 0) {
+            stat->func = func;
+            return stat;
+        }
+    }
+    return 0;
+}
+
+void ftrace_print_stats(void) {
+    bool was_enabled = ftrace_pause();
+    ftrace_cpu_t* cpu = &ftrace_cpus[cpu_id()];
+    u32 head = cpu->head;
+    u32 start = ftrace_window_start(head);
+    u32 stack_func[FTRACE_STACK_DEPTH];
+    u64 stack_tsc[FTRACE_STACK_DEPTH];
+    u32 sp = 0;
+    char buf[32];
+    
+    memset(ftrace_stats, 0, sizeof(ftrace_stats));
+    
+    // Pair entries with exits; exits without a recorded entry are skipped
+    for (u32 i = start; i < head; i++) {
+        ftrace_entry_t* entry = &cpu->ring[i % FTRACE_RING_SIZE];
+        
+        if (!(entry->info & FTRACE_ENTRY_EXIT)) {
+            if (sp < FTRACE_STACK_DEPTH) {
+                stack_func[sp] = entry->func;
+                stack_tsc[sp] = entry->tsc;
+            }
+            sp++;
+            continue;
+        }
+        
+        if (sp == 0) {
+            continue;
+        }
+        sp--;
+        if (sp >= FTRACE_STACK_DEPTH || stack_func[sp] != entry->func) {
+            continue;
+        }
+        
+        ftrace_stat_t* stat = ftrace_stat_slot(entry->func);
+        if (stat) {
+            stat->calls++;
+            stat->cycles += entry->tsc - stack_tsc[sp];
+        }
+    }
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\n=== Inclusive Function Time ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    vga_writestring("   calls  inclusive  function\n");
+    
+    for (u32 n = 0; n < FTRACE_TOP_COUNT; n++) {
+        ftrace_stat_t* best = 0;
+        for (u32 i = 0; i < FTRACE_STATS_SLOTS; i++) {
+            ftrace_stat_t* stat = &ftrace_stats[i];
+            if (stat->calls && (!best || stat->cycles > best->cycles)) {
+                best = stat;
+            }
+        }
+        if (!best) {
+            if (n == 0) {
+                vga_writestring("No completed calls in the trace window.\n");
+            }
+            break;
+        }
+        
+        utoa(best->calls, buf, 10);
+        for (u32 pad = strlen(buf); pad < 8; pad++) {
+            vga_putchar(' ');
+        }
+        vga_writestring(buf);
+        vga_writestring("  ");
+        ftrace_print_cycles(best->cycles);
+        vga_writestring("  ");
+        vga_writestring(ksym_lookup(best->func, 0));
+        vga_writestring("\n");
+        best->calls = 0;
+    }
+    vga_writestring("\n");
+    ftrace_enabled = was_enabled;
+}
@@ -0,0 +1,44 @@
+#ifndef FTRACE_H
+#define FTRACE_H
+
+#include <kernel/kernel.h>
+
+#define FTRACE_RING_SIZE    8192
+#define FTRACE_MAX_FILTERS  16
+#define FTRACE_STACK_DEPTH  64
+#define FTRACE_STATS_SLOTS  512
+#define FTRACE_TOP_COUNT    20
+
+#define FTRACE_ENTRY_EXIT   0x1
+
+// One function entry or exit; depth is stored above the exit bit
+typedef struct {
+    u64 tsc;
+    u32 func;
+    u32 call_site;
+    u32 info;
+} ftrace_entry_t;
+
+typedef struct {
+    ftrace_entry_t ring[FTRACE_RING_SIZE];
+    u32 head;
+    u32 depth;
+    s32 graph_depth;
+} ftrace_cpu_t;
+
+// Tracer control
+bool ftrace_available(void);
+void ftrace_start(void);
+void ftrace_stop(void);
+bool ftrace_filter_add(const char* name);
+void ftrace_filter_clear(void);
+
+// Reports over the recorded window
+void ftrace_dump(u32 count);
+void ftrace_print_stats(void);
+
+// Compiler hooks emitted by -finstrument-functions
+void __cyg_profile_func_enter(void* func, void* call_site) __attribute__((no_instrument_function));
+void __cyg_profile_func_exit(void* func, void* call_site) __attribute__((no_instrument_function));
+
+#endif // FTRACE_H
@@ -0,0 +1,168 @@
+#include "irqsoff.h"
+#include <kernel/kernel.h>
+#include <kernel/irqflags.h>
+#include "../kernel/ksyms.h"
+#include "../kernel/time.h"
+#include "../drivers/vga.h"
+#include "../lib/string.h"
+#include "../lib/bitops.h"
+#include "../lib/div64.h"
+
+static irqsoff_cpu_t irqsoff_cpus[NR_CPUS];
+static irqsoff_max_t irqsoff_max;
+static u32 irqsoff_histogram[IRQSOFF_BUCKETS];
+static u32 irqsoff_sections = 0;
+
+// Sections are only timed once the TSC has been calibrated
+static bool irqsoff_started = false;
+
+bool irqsoff_available(void) {
+#ifdef CONFIG_IRQSOFF_TRACER
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef CONFIG_IRQSOFF_TRACER
+void NOTRACE trace_hardirqs_off(u32 ip) {
+    irqsoff_cpu_t* cpu = &irqsoff_cpus[cpu_id()];
+    
+    // Nested disables extend the outer section
+    if (!irqsoff_started || cpu->active) {
+        return;
+    }
+    
+    cpu->active = true;
+    cpu->start_ip = ip;
+    cpu->start_tsc = rdtsc();
+}
+
+void NOTRACE trace_hardirqs_on(u32 ip) {
+    u64 end = rdtsc();
+    irqsoff_cpu_t* cpu = &irqsoff_cpus[cpu_id()];
+    
+    if (!cpu->active) {
+        return;
+    }
+    cpu->active = false;
+    
+    u64 cycles = end - cpu->start_tsc;
+    u64 us = div_u64(time_cycles_to_ns(cycles), NSEC_PER_USEC);
+    u32 bucket = us >= (1U << (IRQSOFF_BUCKETS - 1)) ? IRQSOFF_BUCKETS - 1 : fls((u32)us);
+    
+    irqsoff_histogram[bucket]++;
+    irqsoff_sections++;
+    
+    if (cycles > irqsoff_max.cycles) {
+        irqsoff_max.cycles = cycles;
+        irqsoff_max.start_ip = cpu->start_ip;
+        irqsoff_max.end_ip = ip;
+    }
+}
+#endif
+
+void irqsoff_init(void) {
+    irqsoff_reset();
+    irqsoff_started = true;
+}
+
+void irqsoff_reset(void) {
+    u32 flags = raw_local_irq_save();
+    
+    // Drop the section the caller is in, it ends with the flags restore below
+    for (u32 i = 0; i < NR_CPUS; i++) {
+        irqsoff_cpus[i].active = false;
+    }
+    memset(&irqsoff_max, 0, sizeof(irqsoff_max));
+    memset(irqsoff_histogram, 0, sizeof(irqsoff_histogram));
+    irqsoff_sections = 0;
+    
+    raw_local_irq_restore(flags);
+}
+
+static void irqsoff_print_ip(u32 ip) {
+    char buf[32];
+    u32 offset = 0;
+    
+    vga_writestring(ksym_lookup(ip, &offset));
+    vga_writestring("+0x");
+    utoa(offset, buf, 16);
+    vga_writestring(buf);
+}
+
+static void irqsoff_print_bucket(u32 bucket) {
+    char buf[32];
+    u32 len = 0;
+    
+    if (bucket == 0) {
+        vga_writestring("      <1");
+        len = 8;
+    } else if (bucket == IRQSOFF_BUCKETS - 1) {
+        utoa(1U << (bucket - 1), buf, 10);
+        vga_writestring("  >=");
+        vga_writestring(buf);
+        len = 4 + strlen(buf);
+    } else {
+        utoa(1U << (bucket - 1), buf, 10);
+        vga_writestring("  ");
+        vga_writestring(buf);
+        vga_writestring("-");
+        len = 3 + strlen(buf);
+        utoa(1U << bucket, buf, 10);
+        vga_writestring(buf);
+        len += strlen(buf);
+    }
+    
+    vga_writestring(" us");
+    for (u32 pad = len; pad < 14; pad++) {
+        vga_putchar(' ');
+    }
+    
+    utoa(irqsoff_histogram[bucket], buf, 10);
+    vga_writestring(buf);
+    vga_writestring("\n");
+}
+
+void irqsoff_report(void) {
+    char buf[32];
+    
+    // Snapshot with interrupts off so the worst case is consistent
+    u32 flags = raw_local_irq_save();
+    irqsoff_max_t max = irqsoff_max;
+    u32 sections = irqsoff_sections;
+    raw_local_irq_restore(flags);
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\n=== Interrupts-off latency ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    
+    vga_writestring("Sections: ");
+    utoa(sections, buf, 10);
+    vga_writestring(buf);
+    vga_writestring("\n");
+    
+    if (sections == 0) {
+        vga_writestring("No interrupts-off sections recorded.\n\n");
+        return;
+    }
+    
+    vga_writestring("Worst case: ");
+    u64toa(div_u64(time_cycles_to_ns(max.cycles), NSEC_PER_USEC), buf, 10);
+    vga_writestring(buf);
+    vga_writestring(" us (");
+    u64toa(max.cycles, buf, 10);
+    vga_writestring(buf);
+    vga_writestring(" cycles)\n  off at ");
+    irqsoff_print_ip(max.start_ip);
+    vga_writestring("\n  on at  ");
+    irqsoff_print_ip(max.end_ip);
+    vga_writestring("\n\n");
+    
+    for (u32 i = 0; i < IRQSOFF_BUCKETS; i++) {
+        if (irqsoff_histogram[i]) {
+            irqsoff_print_bucket(i);
+        }
+    }
+    vga_writestring("\n");
+}
@@ -0,0 +1,28 @@
+#ifndef IRQSOFF_H
+#define IRQSOFF_H
+
+#include <kernel/kernel.h>
+
+// Power-of-two histogram of section lengths: <1us, 1-2us, ... , >=16ms
+#define IRQSOFF_BUCKETS 16
+
+typedef struct {
+    u64 start_tsc;
+    u32 start_ip;
+    bool active;
+} irqsoff_cpu_t;
+
+// Longest interrupts-off section seen since the last reset
+typedef struct {
+    u64 cycles;
+    u32 start_ip;
+    u32 end_ip;
+} irqsoff_max_t;
+
+// Tracer control
+bool irqsoff_available(void);
+void irqsoff_init(void);
+void irqsoff_reset(void);
+void irqsoff_report(void);
+
+#endif // IRQSOFF_H
@@ -0,0 +1,239 @@
+#include "profile.h"
+#include <kernel/kernel.h>
+#include <kernel/irqflags.h>
+#include <kernel/memory.h>
+#include <kernel/interrupts.h>
+#include "../kernel/ksyms.h"
+#include "../drivers/vga.h"
+#include "../drivers/keyboard.h"
+#include "../kernel/time.h"
+#include "../lib/string.h"
+#include "../lib/div64.h"
+
+#define CMOS_ADDRESS    0x70
+#define CMOS_DATA       0x71
+#define CMOS_NMI_OFF    0x80
+#define RTC_REG_A       0x0A
+#define RTC_REG_B       0x0B
+#define RTC_REG_C       0x0C
+#define RTC_B_PIE       0x40
+#define RTC_IRQ_VECTOR  40
+
+static profile_sample_t profile_ring[PROFILE_RING_SIZE];
+static volatile u32 profile_head = 0;
+static volatile bool profile_running = false;
+static bool profile_backtrace = false;
+
+static u8 cmos_read(u8 reg) {
+    outb(CMOS_ADDRESS, CMOS_NMI_OFF | reg);
+    return inb(CMOS_DATA);
+}
+
+static void cmos_write(u8 reg, u8 value) {
+    outb(CMOS_ADDRESS, CMOS_NMI_OFF | reg);
+    outb(CMOS_DATA, value);
+}
+
+// Frame pointers live on the boot stack or on heap-allocated kernel stacks
+static bool profile_frame_ok(u32 ebp) {
+    if (ebp == 0 || (ebp & 3)) {
+        return false;
+    }
+    if (ebp < 0x400000) {
+        return true;
+    }
+    return ebp >= KERNEL_HEAP_START && ebp < KERNEL_HEAP_START + KERNEL_HEAP_SIZE;
+}
+
+static void profile_tick(struct registers* regs) {
+    // Reading register C acknowledges the RTC so it keeps firing
+    cmos_read(RTC_REG_C);
+    
+    if (!profile_running) {
+        return;
+    }
+    
+    profile_sample_t* sample = &profile_ring[profile_head % PROFILE_RING_SIZE];
+    sample->eip = regs->eip;
+    sample->depth = 0;
+    
+    // Only kernel frames can be walked safely (-fno-omit-frame-pointer builds)
+    if (profile_backtrace && (regs->cs & 0x3) == 0) {
+        u32 ebp = regs->ebp;
+        while (sample->depth < PROFILE_MAX_DEPTH && profile_frame_ok(ebp)) {
+            u32* frame = (u32*)ebp;
+            sample->frames[sample->depth++] = frame[1];
+            if (frame[0] <= ebp) {
+                break;
+            }
+            ebp = frame[0];
+        }
+    }
+    
+    profile_head++;
+}
+
+void profile_init(void) {
+    register_interrupt_handler(RTC_IRQ_VECTOR, profile_tick);
+}
+
+void profile_start(bool backtrace) {
+    local_irq_disable();
+    
+    profile_head = 0;
+    profile_backtrace = backtrace;
+    profile_running = true;
+    
+    cmos_write(RTC_REG_A, (cmos_read(RTC_REG_A) & 0xF0) | PROFILE_RTC_RATE);
+    cmos_write(RTC_REG_B, cmos_read(RTC_REG_B) | RTC_B_PIE);
+    cmos_read(RTC_REG_C);
+    
+    local_irq_enable();
+}
+
+void profile_stop(void) {
+    local_irq_disable();
+    
+    profile_running = false;
+    cmos_write(RTC_REG_B, cmos_read(RTC_REG_B) & ~RTC_B_PIE);
+    cmos_read(RTC_REG_C);
+    
+    local_irq_enable();
+}
+
+static void profile_print_row(u32 hits, u32 total, u32 inclusive, const char* name) {
+    char buf[32];
+    
+    utoa(hits, buf, 10);
+    for (u32 pad = strlen(buf); pad < 8; pad++) {
+        vga_putchar(' ');
+    }
+    vga_writestring(buf);
+    
+    utoa(hits * 100 / total, buf, 10);
+    for (u32 pad = strlen(buf); pad < 5; pad++) {
+        vga_putchar(' ');
+    }
+    vga_writestring(buf);
+    vga_writestring("%  ");
+    
+    if (profile_backtrace) {
+        utoa(inclusive, buf, 10);
+        for (u32 pad = strlen(buf); pad < 8; pad++) {
+            vga_putchar(' ');
+        }
+        vga_writestring(buf);
+        vga_writestring("  ");
+    }
+    
+    vga_writestring(name);
+    vga_writestring("\n");
+}
+
+void profile_report(void) {
+    u32 total = profile_head < PROFILE_RING_SIZE ? profile_head : PROFILE_RING_SIZE;
+    u32 nsyms = ksym_total();
+    char buf[32];
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\n=== Profile ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    
+    if (total == 0) {
+        vga_writestring("No samples collected.\n\n");
+        return;
+    }
+    if (nsyms == 0) {
+        vga_writestring("Kernel symbol table missing, rebuild to embed it.\n\n");
+        return;
+    }
+    
+    u32* self = (u32*)kmalloc(nsyms * sizeof(u32));
+    u32* inclusive = (u32*)kmalloc(nsyms * sizeof(u32));
+    memset(self, 0, nsyms * sizeof(u32));
+    memset(inclusive, 0, nsyms * sizeof(u32));
+    u32 unknown = 0;
+    
+    for (u32 i = 0; i < total; i++) {
+        profile_sample_t* sample = &profile_ring[i];
+        u32 idx = ksym_index(sample->eip);
+        if (idx == KSYM_NONE) {
+            unknown++;
+            continue;
+        }
+        self[idx]++;
+        inclusive[idx]++;
+        
+        // Count each caller once per sample, skipping recursion
+        for (u32 d = 0; d < sample->depth; d++) {
+            u32 caller = ksym_index(sample->frames[d] - 1);
+            if (caller == KSYM_NONE || caller == idx) {
+                continue;
+            }
+            bool seen = false;
+            for (u32 e = 0; e < d; e++) {
+                if (ksym_index(sample->frames[e] - 1) == caller) {
+                    seen = true;
+                    break;
+                }
+            }
+            if (!seen) {
+                inclusive[caller]++;
+            }
+        }
+    }
+    
+    vga_writestring("Samples: ");
+    utoa(total, buf, 10);
+    vga_writestring(buf);
+    if (profile_head > PROFILE_RING_SIZE) {
+        vga_writestring(" (");
+        utoa(profile_head - PROFILE_RING_SIZE, buf, 10);
+        vga_writestring(buf);
+        vga_writestring(" oldest dropped)");
+    }
+    vga_writestring("\n\n");
+    vga_writestring(profile_backtrace ? "    self      %     incl  function\n"
+                                      : "    self      %  function\n");
+    
+    // Repeated max selection keeps the report allocation-free beyond the counters
+    for (u32 n = 0; n < PROFILE_TOP_COUNT; n++) {
+        u32 best = KSYM_NONE;
+        for (u32 i = 0; i < nsyms; i++) {
+            if (self[i] && (best == KSYM_NONE || self[i] > self[best])) {
+                best = i;
+            }
+        }
+        if (best == KSYM_NONE) {
+            break;
+        }
+        profile_print_row(self[best], total, inclusive[best], ksym_name(best));
+        self[best] = 0;
+    }
+    
+    if (unknown) {
+        profile_print_row(unknown, total, unknown, "[user/unknown]");
+    }
+    vga_writestring("\n");
+    
+    kfree(inclusive);
+    kfree(self);
+}
+
+void profile_run(u32 seconds, bool backtrace) {
+    u32 target = seconds * PROFILE_HZ;
+    
+    profile_start(backtrace);
+    
+    // A key press ends the run early. The shell blocks meanwhile, so the
+    // samples show whatever else the CPU runs.
+    while (profile_head < target) {
+        u64 left = div_u64((u64)(target - profile_head) * NSEC_PER_SEC, PROFILE_HZ);
+        if (keyboard_wait_timeout(left)) {
+            break;
+        }
+    }
+    
+    profile_stop();
+    profile_report();
+}
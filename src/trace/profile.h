@@ -0,0 +1,26 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <kernel/kernel.h>
+
+// RTC periodic interrupt drives the sampler: 32768 >> (rate - 1) Hz
+#define PROFILE_RTC_RATE    6
+#define PROFILE_HZ          1024
+#define PROFILE_RING_SIZE   8192
+#define PROFILE_MAX_DEPTH   3
+#define PROFILE_TOP_COUNT   15
+
+typedef struct {
+    u32 eip;
+    u32 depth;
+    u32 frames[PROFILE_MAX_DEPTH];
+} profile_sample_t;
+
+// Profiler functions
+void profile_init(void);
+void profile_start(bool backtrace);
+void profile_stop(void);
+void profile_report(void);
+void profile_run(u32 seconds, bool backtrace);
+
+#endif // PROFILE_H
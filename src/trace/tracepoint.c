@@ -0,0 +1,197 @@
+#include "tracepoint.h"
+#include <kernel/kernel.h>
+#include <kernel/irqflags.h>
+#include "../arch/x86/smp.h"
+#include "../drivers/vga.h"
+#include "../lib/string.h"
+
+#define TRACEPOINT_NOP_SIZE 5
+#define X86_JMP_REL32       0xE9
+
+static const u8 tracepoint_nop[TRACEPOINT_NOP_SIZE] = { 0x0F, 0x1F, 0x44, 0x00, 0x00 };
+
+DEFINE_TRACEPOINT(syscall_entry);
+DEFINE_TRACEPOINT(irq_entry);
+DEFINE_TRACEPOINT(page_alloc);
+DEFINE_TRACEPOINT(page_free);
+DEFINE_TRACEPOINT(sched_switch);
+
+static tracepoint_t* const tracepoints[] = {
+    &__tracepoint_syscall_entry,
+    &__tracepoint_irq_entry,
+    &__tracepoint_page_alloc,
+    &__tracepoint_page_free,
+    &__tracepoint_sched_switch
+};
+
+#define TRACEPOINT_COUNT (sizeof(tracepoints) / sizeof(tracepoints[0]))
+
+// Bounds of the site table, provided by linker.ld
+extern tracepoint_site_t __tracepoint_sites_start[];
+extern tracepoint_site_t __tracepoint_sites_end[];
+
+static tracepoint_cpu_t tracepoint_cpus[NR_CPUS];
+
+static void tracepoint_patch(tracepoint_site_t* site, bool enable) {
+    u8* code = (u8*)site->code;
+    
+    // Kernel text is identity mapped writable. Every other CPU is parked
+    // by tracepoint_enable(), so no one can run the half-written site.
+    if (enable) {
+        u32 rel = site->target - (site->code + TRACEPOINT_NOP_SIZE);
+        code[0] = X86_JMP_REL32;
+        memcpy(code + 1, &rel, sizeof(rel));
+    } else {
+        memcpy(code, tracepoint_nop, TRACEPOINT_NOP_SIZE);
+    }
+}
+
+void tracepoint_init(void) {
+    // Every site must still hold the compiled-in NOP
+    for (tracepoint_site_t* site = __tracepoint_sites_start; site < __tracepoint_sites_end; site++) {
+        if (memcmp((void*)site->code, tracepoint_nop, TRACEPOINT_NOP_SIZE) != 0) {
+            kernel_panic("Tracepoint site does not hold the expected NOP");
+        }
+    }
+}
+
+void tracepoint_probe(tracepoint_t* tp, u32 arg0, u32 arg1) {
+    u32 flags = local_irq_save();
+    
+    tracepoint_cpu_t* cpu = &tracepoint_cpus[cpu_id()];
+    tracepoint_event_t* event = &cpu->ring[cpu->head % TRACEPOINT_RING_SIZE];
+    event->tsc = rdtsc();
+    event->tp = tp;
+    event->args[0] = arg0;
+    event->args[1] = arg1;
+    cpu->head++;
+    __sync_fetch_and_add(&tp->hits, 1);
+    
+    local_irq_restore(flags);
+}
+
+tracepoint_t* tracepoint_find(const char* name) {
+    for (u32 i = 0; i < TRACEPOINT_COUNT; i++) {
+        if (strcmp(tracepoints[i]->name, name) == 0) {
+            return tracepoints[i];
+        }
+    }
+    return 0;
+}
+
+void tracepoint_enable(tracepoint_t* tp, bool enable) {
+    if (tp->enabled == enable) {
+        return;
+    }
+    
+    u32 flags = smp_stop_others();
+    for (tracepoint_site_t* site = __tracepoint_sites_start; site < __tracepoint_sites_end; site++) {
+        if (site->tp == tp) {
+            tracepoint_patch(site, enable);
+        }
+    }
+    tp->enabled = enable;
+    smp_resume_others(flags);
+}
+
+void tracepoint_enable_all(bool enable) {
+    for (u32 i = 0; i < TRACEPOINT_COUNT; i++) {
+        tracepoint_enable(tracepoints[i], enable);
+    }
+}
+
+void tracepoint_list(void) {
+    char buf[32];
+    
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\n=== Tracepoints ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    
+    for (u32 i = 0; i < TRACEPOINT_COUNT; i++) {
+        tracepoint_t* tp = tracepoints[i];
+        u32 sites = 0;
+        for (tracepoint_site_t* site = __tracepoint_sites_start; site < __tracepoint_sites_end; site++) {
+            if (site->tp == tp) {
+                sites++;
+            }
+        }
+        
+        vga_writestring(tp->enabled ? "  [on]  " : "  [off] ");
+        vga_writestring(tp->name);
+        vga_writestring(" - sites: ");
+        utoa(sites, buf, 10);
+        vga_writestring(buf);
+        vga_writestring(", hits: ");
+        utoa(tp->hits, buf, 10);
+        vga_writestring(buf);
+        vga_writestring("\n");
+    }
+    vga_writestring("\n");
+}
+
+// Up to count events from one CPU's ring, oldest first. head is read once,
+// since printing may itself hit tracepoints.
+static bool tracepoint_show_cpu(u32 id, u32 count) {
+    tracepoint_cpu_t* cpu = &tracepoint_cpus[id];
+    u32 head = cpu->head;
+    u32 start = head > TRACEPOINT_RING_SIZE ? head - TRACEPOINT_RING_SIZE : 0;
+    if (head - start > count) {
+        start = head - count;
+    }
+    if (start == head) {
+        return false;
+    }
+    char buf[32];
+    
+    vga_writestring("CPU ");
+    utoa(id, buf, 10);
+    vga_writestring(buf);
+    vga_writestring(":\n");
+    
+    u64 first_tsc = cpu->ring[start % TRACEPOINT_RING_SIZE].tsc;
+    for (u32 i = start; i < head; i++) {
+        tracepoint_event_t* event = &cpu->ring[i % TRACEPOINT_RING_SIZE];
+        
+        vga_writestring("+");
+        utoa((u32)(event->tsc - first_tsc), buf, 10);
+        vga_writestring(buf);
+        vga_writestring(" ");
+        vga_writestring(event->tp->name);
+        vga_writestring(" 0x");
+        utoa(event->args[0], buf, 16);
+        vga_writestring(buf);
+        vga_writestring(" 0x");
+        utoa(event->args[1], buf, 16);
+        vga_writestring(buf);
+        vga_writestring("\n");
+    }
+    return true;
+}
+
+// Rings are listed per CPU; TSCs are not comparable across CPUs, so times
+// are offsets from each CPU's first listed event
+void tracepoint_show(u32 count) {
+    vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    vga_writestring("\n=== Trace Events ===\n");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    
+    bool any = false;
+    for (u32 id = 0; id < smp_num_cpus(); id++) {
+        any |= tracepoint_show_cpu(id, count);
+    }
+    if (!any) {
+        vga_writestring("No trace events recorded.\n");
+    }
+    vga_writestring("\n");
+}
+
+void tracepoint_clear(void) {
+    u32 flags = local_irq_save();
+    for (u32 id = 0; id < NR_CPUS; id++) {
+        tracepoint_cpus[id].head = 0;
+    }
+    for (u32 i = 0; i < TRACEPOINT_COUNT; i++) {
+        tracepoints[i]->hits = 0;
+    }
+    local_irq_restore(flags);
+}
@@ -0,0 +1,74 @@
+#ifndef TRACEPOINT_H
+#define TRACEPOINT_H
+
+#include <kernel/kernel.h>
+
+#define TRACEPOINT_RING_SIZE 1024
+
+typedef struct tracepoint {
+    const char* name;
+    bool enabled;
+    u32 hits;
+} tracepoint_t;
+
+// Emitted into the __tracepoint_sites section for every TRACE_EVENT use
+typedef struct {
+    u32 code;
+    u32 target;
+    tracepoint_t* tp;
+} tracepoint_site_t;
+
+typedef struct {
+    u64 tsc;
+    tracepoint_t* tp;
+    u32 args[2];
+} tracepoint_event_t;
+
+// Each CPU records into its own ring, written only with its interrupts off
+typedef struct {
+    tracepoint_event_t ring[TRACEPOINT_RING_SIZE];
+    u32 head;
+} tracepoint_cpu_t;
+
+#define DECLARE_TRACEPOINT(name) extern tracepoint_t __tracepoint_##name
+#define DEFINE_TRACEPOINT(name) tracepoint_t __tracepoint_##name = { #name, false, 0 }
+
+// A 5-byte NOP that tracepoint_enable() rewrites into a jmp to the probe
+// block. While disabled the probe code is out of line and never reached.
+static inline __attribute__((always_inline, no_instrument_function))
+bool tracepoint_site(tracepoint_t* tp) {
+    __asm__ goto("1: .byte 0x0f, 0x1f, 0x44, 0x00, 0x00\n\t"
+                 ".pushsection __tracepoint_sites, \"aw\"\n\t"
+                 ".long 1b, %l[enabled], %c0\n\t"
+                 ".popsection"
+                 : : "i"(tp) : : enabled);
+    return false;
+enabled:
+    return true;
+}
+
+#define TRACE_EVENT(name, arg0, arg1)                                           \
+    do {                                                                        \
+        if (tracepoint_site(&__tracepoint_##name)) {                            \
+            tracepoint_probe(&__tracepoint_##name, (u32)(arg0), (u32)(arg1));   \
+        }                                                                       \
+    } while (0)
+
+// Kernel tracepoints
+DECLARE_TRACEPOINT(syscall_entry);
+DECLARE_TRACEPOINT(irq_entry);
+DECLARE_TRACEPOINT(page_alloc);
+DECLARE_TRACEPOINT(page_free);
+DECLARE_TRACEPOINT(sched_switch);
+
+// Tracepoint functions
+void tracepoint_init(void);
+void tracepoint_probe(tracepoint_t* tp, u32 arg0, u32 arg1);
+tracepoint_t* tracepoint_find(const char* name);
+void tracepoint_enable(tracepoint_t* tp, bool enable);
+void tracepoint_enable_all(bool enable);
+void tracepoint_list(void);
+void tracepoint_show(u32 count);
+void tracepoint_clear(void);
+
+#endif // TRACEPOINT_H